@@ -0,0 +1,30 @@
+#ifndef __FSMOD_BENCH_BENCH_H_
+#define __FSMOD_BENCH_BENCH_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Each benchmark at each scale repeats until it has done at least this many ops, so small
+ * scales are not lost in timer noise */
+extern size_t bench_min_ops;
+/* Threaded benchmarks go up to this many threads */
+extern size_t bench_max_threads;
+
+/* Whether name was asked for on the command line */
+bool bench_enabled(const char* name);
+uint64_t bench_now(void);
+/* ns is the total over ops operations at a scale of n entries */
+void bench_report(const char* name, size_t n, size_t ops, uint64_t ns);
+/* xorshift, so every run walks the same order */
+uint64_t bench_rand(uint64_t* state);
+
+size_t bench_rounds(size_t n);
+
+/* Sets up the slab caches of impl.c the first time */
+void bench_impl_caches(void);
+void bench_impl(size_t n);
+void bench_data(size_t n);
+void bench_http(size_t n);
+
+#endif  // __FSMOD_BENCH_BENCH_H_
@@ -0,0 +1,156 @@
+#include "bench.h"
+#include "impl.h"
+
+/* Largest file the data benchmarks run on, in blocks, 40 MiB with 4 KiB ones */
+#define BENCH_DATA_MAX_BLOCKS 10000
+/* One write in this many ops of the mixed benchmark */
+#define BENCH_DATA_WRITE_EVERY 8
+
+static volatile uintptr_t sink;
+
+static void bench_fail(const char* what, int status) {
+  fprintf(stderr, "%s failed: %d\n", what, status);
+  exit(1);
+}
+
+enum bench_data_kind {
+  BENCH_DATA_READ,
+  BENCH_DATA_WRITE,
+  BENCH_DATA_MIXED,
+};
+
+/* What one thread does, and where it does it */
+struct bench_data_thread {
+  pthread_t thread;
+  pthread_barrier_t* start;
+  struct snfs_inode* file;
+  enum bench_data_kind kind;
+  size_t first; /* block the slice this thread writes to starts at */
+  size_t blocks;
+  size_t ops;
+  uint64_t seed;
+};
+
+// Reads go anywhere in the file, writes stay in the thread's own slice the way the page
+// cache keeps concurrent writeback of a file to disjoint folios.
+static void* bench_data_run(void* arg) {
+  struct bench_data_thread* t = arg;
+  char buf[SNFS_BLOCK_SZ];
+  size_t total = t->file->size >> SNFS_BLOCK_SHIFT;
+  memset(buf, 0x5a, sizeof(buf));
+
+  pthread_barrier_wait(t->start);
+  for (size_t i = 0; i < t->ops; i++) {
+    uint64_t r = bench_rand(&t->seed);
+    bool write = t->kind == BENCH_DATA_WRITE ||
+                 (t->kind == BENCH_DATA_MIXED && r % BENCH_DATA_WRITE_EVERY == 0);
+    if (write) {
+      loff_t pos = (loff_t)(t->first + (r >> 8) % t->blocks) << SNFS_BLOCK_SHIFT;
+      int status = snfs_write_data(t->file, buf, pos, SNFS_BLOCK_SZ);
+      if (status < 0) {
+        bench_fail("snfs_write_data", status);
+      }
+    } else {
+      loff_t pos = (loff_t)((r >> 8) % total) << SNFS_BLOCK_SHIFT;
+      sink += snfs_read_data(t->file, buf, pos, SNFS_BLOCK_SZ);
+    }
+  }
+  return NULL;
+}
+
+// all threads on the one file, ns/op is wall time over the ops of all of them
+static uint64_t bench_data_once(
+    struct snfs_inode* file, enum bench_data_kind kind, size_t nthreads, size_t ops
+) {
+  struct bench_data_thread* threads = calloc(nthreads, sizeof(*threads));
+  pthread_barrier_t start;
+  size_t total = file->size >> SNFS_BLOCK_SHIFT;
+  if (threads == NULL) {
+    bench_fail("calloc", -ENOMEM);
+  }
+  pthread_barrier_init(&start, NULL, nthreads + 1);
+  for (size_t i = 0; i < nthreads; i++) {
+    struct bench_data_thread* t = &threads[i];
+    t->start = &start;
+    t->file = file;
+    t->kind = kind;
+    t->blocks = max(total / nthreads, (size_t)1);
+    t->first = i * total / nthreads;
+    t->ops = ops / nthreads;
+    t->seed = 0x9e3779b97f4a7c15 * (i + 1);
+    int status = pthread_create(&t->thread, NULL, bench_data_run, t);
+    if (status != 0) {
+      bench_fail("pthread_create", -status);
+    }
+  }
+  pthread_barrier_wait(&start);
+  uint64_t begin = bench_now();
+  for (size_t i = 0; i < nthreads; i++) {
+    pthread_join(threads[i].thread, NULL);
+  }
+  uint64_t ns = bench_now() - begin;
+  pthread_barrier_destroy(&start);
+  free(threads);
+  return ns;
+}
+
+// Block reads and writes of an n block file from 1, 2, 4, ... up to bench_max_threads
+// threads, which shows how far file data access scales with the cores.
+void bench_data(size_t n) {
+  static const struct {
+    const char* name;
+    enum bench_data_kind kind;
+  } kinds[] = {
+      {"data_read", BENCH_DATA_READ},
+      {"data_write", BENCH_DATA_WRITE},
+      {"data_mixed", BENCH_DATA_MIXED},
+  };
+  bool any = false;
+  for (size_t k = 0; k < ARRAY_SIZE(kinds); k++) {
+    any |= bench_enabled(kinds[k].name);
+  }
+  if (!any || n > BENCH_DATA_MAX_BLOCKS) {
+    return;
+  }
+  bench_impl_caches();
+
+  struct snfs_superblock fs;
+  int status = snfs_init_sb(&fs);
+  if (status < 0) {
+    bench_fail("snfs_init_sb", status);
+  }
+  struct snfs_dentry* entry = snfs_alloc_dentry();
+  if (entry == NULL) {
+    bench_fail("snfs_alloc_dentry", -ENOMEM);
+  }
+  strscpy(entry->name, "data", SNFS_NAME_SZ);
+  status = snfs_create_file(&fs, entry, S_IFREG);
+  if (status == 0) {
+    status = snfs_add_child(fs.root, entry);
+  }
+  if (status < 0) {
+    bench_fail("snfs_create_file", status);
+  }
+  // every block is there, so the threads only ever overwrite
+  char block[SNFS_BLOCK_SZ] = {0};
+  for (size_t i = 0; i < n; i++) {
+    status = snfs_write_data(entry->inode, block, (loff_t)i << SNFS_BLOCK_SHIFT, sizeof(block));
+    if (status < 0) {
+      bench_fail("snfs_write_data", status);
+    }
+  }
+
+  size_t ops = max(bench_min_ops, n);
+  for (size_t k = 0; k < ARRAY_SIZE(kinds); k++) {
+    if (!bench_enabled(kinds[k].name)) {
+      continue;
+    }
+    for (size_t nthreads = 1; nthreads <= bench_max_threads; nthreads *= 2) {
+      uint64_t ns = bench_data_once(entry->inode, kinds[k].kind, nthreads, ops);
+      char name[32];
+      snprintf(name, sizeof(name), "%s/%zu", kinds[k].name, nthreads);
+      bench_report(name, n, ops / nthreads * nthreads, ns);
+    }
+  }
+  snfs_destroy_sb(&fs);
+}
@@ -0,0 +1,258 @@
+// built into this file, so the static parser and request builder are in reach
+#include "../source/http.c"
+
+#include "bench.h"
+#include "impl.h"
+
+/* One entry of a listing, an InodeDto and a short name the way the server sends them */
+#define BENCH_ENTRY_SZ 28
+/* Chunk size Tomcat uses for bodies of unknown length */
+#define BENCH_CHUNK_SZ 8192
+
+static volatile uintptr_t sink;
+
+static void bench_fail(const char* what, int64_t status) {
+  fprintf(stderr, "%s failed: %lld\n", what, (long long)status);
+  exit(1);
+}
+
+/* A growing buffer the responses are written into */
+struct bench_buf {
+  char* data;
+  size_t len;
+  size_t cap;
+};
+
+static void bench_put(struct bench_buf* buf, const void* data, size_t len) {
+  if (buf->len + len > buf->cap) {
+    buf->cap = max(2 * buf->cap, buf->len + len);
+    buf->data = realloc(buf->data, buf->cap);
+    if (buf->data == NULL) {
+      bench_fail("realloc", -ENOMEM);
+    }
+  }
+  memcpy(buf->data + buf->len, data, len);
+  buf->len += len;
+}
+
+static void bench_printf(struct bench_buf* buf, const char* fmt, ...) {
+  char line[256];
+  va_list args;
+  va_start(args, fmt);
+  int len = vsnprintf(line, sizeof(line), fmt, args);
+  va_end(args);
+  bench_put(buf, line, len);
+}
+
+// A response as Spring on Tomcat sends it, the body is the int64 length and then payload.
+// Chunked ones are cut into BENCH_CHUNK_SZ pieces.
+static void bench_response(struct bench_buf* buf, const char* payload, size_t len, bool chunked) {
+  char prefix[sizeof(int64_t)];
+  put_unaligned_le64(len, prefix);
+
+  bench_printf(buf, "HTTP/1.1 200 \r\nContent-Type: application/octet-stream\r\n");
+  if (!chunked) {
+    bench_printf(buf, "Content-Length: %zu\r\n", sizeof(prefix) + len);
+  } else {
+    bench_printf(buf, "Transfer-Encoding: chunked\r\n");
+  }
+  bench_printf(buf, "Date: Thu, 01 Jan 2026 00:00:00 GMT\r\n");
+  bench_printf(buf, "Keep-Alive: timeout=60\r\nConnection: keep-alive\r\n\r\n");
+  if (!chunked) {
+    bench_put(buf, prefix, sizeof(prefix));
+    bench_put(buf, payload, len);
+    return;
+  }
+  bench_printf(buf, "%zx\r\n", sizeof(prefix));
+  bench_put(buf, prefix, sizeof(prefix));
+  bench_printf(buf, "\r\n");
+  for (size_t off = 0; off < len; off += BENCH_CHUNK_SZ) {
+    size_t n = min_t(size_t, len - off, BENCH_CHUNK_SZ);
+    bench_printf(buf, "%zx\r\n", n);
+    bench_put(buf, payload + off, n);
+    bench_printf(buf, "\r\n");
+  }
+  bench_printf(buf, "0\r\n\r\n");
+}
+
+/* A connection that reads buf back as the server's side of the stream */
+struct bench_conn {
+  struct socket sock;
+  struct snfs_http_conn conn;
+};
+
+static void bench_conn_reset(struct bench_conn* c, const struct bench_buf* buf) {
+  memset(c, 0, sizeof(*c));
+  c->sock.rx = buf->data;
+  c->sock.rx_len = buf->len;
+  c->conn.sock = &c->sock;
+}
+
+static int64_t bench_read(
+    struct bench_conn* c, char* buffer, size_t buffer_size, struct iov_iter* body
+) {
+  struct snfs_http_parser parser;
+  snfs_http_parser_init(&parser, buffer, buffer_size, body);
+  int status = snfs_http_read_response(&c->conn, &parser);
+  if (status < 0) {
+    return status;
+  }
+  return snfs_http_result(&parser);
+}
+
+// n lookups as pipelined responses, each parsed on its own like snfs_http_pipeline does
+static void bench_responses(size_t n) {
+  struct bench_buf buf = {0};
+  struct bench_conn c;
+  char inode[4 * sizeof(int32_t)] = {0};
+  char resp[SNFS_HTTP_RBUF_SZ];
+
+  for (size_t i = 0; i < n; i++) {
+    bench_response(&buf, inode, sizeof(inode), false);
+  }
+  size_t rounds = bench_rounds(n);
+  uint64_t start = bench_now();
+  for (size_t r = 0; r < rounds; r++) {
+    bench_conn_reset(&c, &buf);
+    for (size_t i = 0; i < n; i++) {
+      int64_t len = bench_read(&c, resp, sizeof(resp), NULL);
+      if (len != sizeof(inode)) {
+        bench_fail("pipelined response", len);
+      }
+    }
+  }
+  bench_report("parse_pipelined", n, rounds * n, bench_now() - start);
+  free(buf.data);
+}
+
+// one listing of n entries, everything past the Msg goes straight into a big buffer
+static void bench_listing(size_t n, bool chunked) {
+  struct bench_buf buf = {0};
+  struct bench_conn c;
+  size_t len = n * BENCH_ENTRY_SZ;
+  char* payload = malloc(sizeof(int32_t) + len);
+  char* dst = malloc(len);
+  char resp[sizeof(int32_t)];
+  if (payload == NULL || dst == NULL) {
+    bench_fail("malloc", -ENOMEM);
+  }
+  memset(payload, 'x', sizeof(int32_t) + len);
+  bench_response(&buf, payload, sizeof(int32_t) + len, chunked);
+
+  size_t rounds = bench_rounds(n);
+  uint64_t start = bench_now();
+  for (size_t r = 0; r < rounds; r++) {
+    struct kvec vec = {.iov_base = dst, .iov_len = len};
+    struct iov_iter body;
+    iov_iter_kvec(&body, ITER_DEST, &vec, 1, len);
+    bench_conn_reset(&c, &buf);
+    int64_t got = bench_read(&c, resp, sizeof(resp), &body);
+    if (got != sizeof(int32_t) + len) {
+      bench_fail("listing response", got);
+    }
+  }
+  bench_report(chunked ? "parse_chunked" : "parse_listing", n, rounds * n, bench_now() - start);
+  free(dst);
+  free(payload);
+  free(buf.data);
+}
+
+// heads of n lookups, built and given back to the head pool like a completion does
+static void bench_requests(size_t n) {
+  struct snfs_http_req req;
+  char resp[64];
+  char name[3 * SNFS_NAME_SZ + 1];
+
+  size_t rounds = bench_rounds(n);
+  uint64_t start = bench_now();
+  for (size_t r = 0; r < rounds; r++) {
+    for (size_t i = 0; i < n; i++) {
+      char dir[16];
+      char plain[SNFS_NAME_SZ];
+      snprintf(dir, sizeof(dir), "%u", (unsigned int)i);
+      snprintf(plain, sizeof(plain), "file %u", (unsigned int)i);
+      encode(plain, name);
+      int error = snfs_http_req_get(
+          &req, "token", "lookup", resp, sizeof(resp), 2, "dir", dir, "name", name
+      );
+      if (error != 0) {
+        bench_fail("snfs_http_req_get", error);
+      }
+      sink ^= req.request_size;
+      mempool_free(req.head.iov_base, snfs_http_heads);
+    }
+  }
+  bench_report("build_request", n, rounds * n, bench_now() - start);
+}
+
+// a batch of n removes, the way write-back queues them
+static void bench_batch(size_t n) {
+  struct snfs_http_batch batch;
+  snfs_http_batch_init(&batch, false);
+
+  size_t rounds = bench_rounds(n);
+  uint64_t start = bench_now();
+  for (size_t r = 0; r < rounds; r++) {
+    for (size_t i = 0; i < n; i++) {
+      char dir[16];
+      char name[SNFS_NAME_SZ];
+      snprintf(dir, sizeof(dir), "%u", (unsigned int)i);
+      snprintf(name, sizeof(name), "f%u", (unsigned int)i);
+      int error = snfs_http_batch_add(&batch, "remove", 2, "dir", dir, "name", name);
+      if (error != 0) {
+        bench_fail("snfs_http_batch_add", error);
+      }
+    }
+    sink ^= batch.size;
+    snfs_http_batch_reset(&batch);
+  }
+  bench_report("build_batch", n, rounds * n, bench_now() - start);
+  snfs_http_batch_destroy(&batch);
+}
+
+// what every completed RPC costs on top
+static void bench_metrics(size_t n) {
+  struct snfs_metrics metrics;
+  int error = snfs_metrics_init(&metrics, 0);
+  if (error != 0) {
+    bench_fail("snfs_metrics_init", error);
+  }
+  size_t rounds = bench_rounds(n);
+  uint64_t start = bench_now();
+  for (size_t r = 0; r < rounds; r++) {
+    for (size_t i = 0; i < n; i++) {
+      snfs_metrics_record(&metrics, snfs_metrics_rpc("lookup"), start, 0, i);
+    }
+  }
+  bench_report("metrics_record", n, rounds * n, bench_now() - start);
+  snfs_metrics_destroy(&metrics);
+}
+
+void bench_http(size_t n) {
+  static bool ready;
+  if (!ready) {
+    int error = snfs_http_caches_init();
+    if (error != 0) {
+      bench_fail("snfs_http_caches_init", error);
+    }
+    ready = true;
+  }
+  if (bench_enabled("build_request")) {
+    bench_requests(n);
+  }
+  if (bench_enabled("build_batch")) {
+    bench_batch(n);
+  }
+  if (bench_enabled("parse_pipelined")) {
+    bench_responses(n);
+  }
+  if (bench_enabled("parse_listing")) {
+    bench_listing(n, false);
+  }
+  if (bench_enabled("parse_chunked")) {
+    bench_listing(n, true);
+  }
+  if (bench_enabled("metrics_record")) {
+    bench_metrics(n);
+  }
+}
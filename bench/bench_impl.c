@@ -0,0 +1,181 @@
+#include "impl.h"
+
+#include "bench.h"
+
+/* Keeps results alive so the loops are not optimized away */
+static volatile uintptr_t sink;
+/* Entries per call when readdir is resumed, about what getdents fits into 1 KiB */
+#define BENCH_READDIR_CHUNK 32
+
+static void bench_fail(const char* what, int status) {
+  fprintf(stderr, "%s failed: %d\n", what, status);
+  exit(1);
+}
+
+// the local part of snfs_create_dentry
+static struct snfs_dentry* bench_create(struct snfs_inode* dir, const char* name) {
+  struct snfs_dentry* entry = snfs_alloc_dentry();
+  if (entry == NULL) {
+    bench_fail("snfs_alloc_dentry", -ENOMEM);
+  }
+  strscpy(entry->name, name, SNFS_NAME_SZ);
+  int status = snfs_create_file(dir->sb, entry, S_IFREG);
+  if (status < 0) {
+    bench_fail("snfs_create_file", status);
+  }
+  status = snfs_add_child(dir, entry);
+  if (status < 0) {
+    bench_fail("snfs_add_child", status);
+  }
+  return entry;
+}
+
+// What one snfs_iterate_shared call does, minus dir_emit: picks up at the cookie in *pos
+// and stops after max entries, the way a full getdents buffer stops it.
+static size_t bench_readdir(struct snfs_inode* dir, unsigned long* pos, size_t max) {
+  unsigned long cookie;
+  struct snfs_dentry* entry;
+  size_t n = 0;
+
+  mutex_lock(&dir->lock);
+  xa_for_each_start(&dir->cookies, cookie, entry, *pos) {
+    if (n == max) {
+      break;
+    }
+    sink += strnlen(entry->name, SNFS_NAME_SZ) + entry->inode->no;
+    n++;
+    *pos = cookie + 1;
+  }
+  mutex_unlock(&dir->lock);
+  return n;
+}
+
+void bench_impl_caches(void) {
+  static bool ready;
+  if (!ready) {
+    int status = snfs_impl_caches_init();
+    if (status < 0) {
+      bench_fail("snfs_impl_caches_init", status);
+    }
+    ready = true;
+  }
+}
+
+// Creates n files in the root, looks each up by name, lists the root and unlinks them all.
+// Lookups and unlinks go in a shuffled order, the way cache misses would come. The root is
+// listed once in one call and once in calls of BENCH_READDIR_CHUNK entries, the second is
+// reported per call and stays flat with n as long as a call resumes in O(1).
+void bench_impl(size_t n) {
+  if (!bench_enabled("create") && !bench_enabled("lookup") && !bench_enabled("readdir") &&
+      !bench_enabled("unlink")) {
+    return;
+  }
+  bench_impl_caches();
+
+  char(*names)[SNFS_NAME_SZ] = calloc(n, SNFS_NAME_SZ);
+  char(*misses)[SNFS_NAME_SZ] = calloc(n, SNFS_NAME_SZ);
+  size_t* order = malloc(n * sizeof(*order));
+  struct snfs_dentry** entries = malloc(n * sizeof(*entries));
+  if (names == NULL || misses == NULL || order == NULL || entries == NULL) {
+    bench_fail("malloc", -ENOMEM);
+  }
+  uint64_t seed = 0x9e3779b97f4a7c15;
+  for (size_t i = 0; i < n; i++) {
+    snprintf(names[i], SNFS_NAME_SZ, "f%u", (unsigned int)i);
+    snprintf(misses[i], SNFS_NAME_SZ, "m%u", (unsigned int)i);
+    order[i] = i;
+  }
+  for (size_t i = n - 1; i > 0; i--) {
+    size_t j = bench_rand(&seed) % (i + 1);
+    size_t tmp = order[i];
+    order[i] = order[j];
+    order[j] = tmp;
+  }
+
+  uint64_t create = 0;
+  uint64_t lookup = 0;
+  uint64_t miss = 0;
+  uint64_t readdir = 0;
+  uint64_t resume = 0;
+  size_t resumes = 0;
+  uint64_t unlink = 0;
+  size_t rounds = bench_rounds(n);
+  struct snfs_superblock fs;
+  for (size_t r = 0; r < rounds; r++) {
+    int status = snfs_init_sb(&fs);
+    if (status < 0) {
+      bench_fail("snfs_init_sb", status);
+    }
+    struct snfs_inode* root = snfs_inode_by_ino(&fs, SNFS_ROOT_NO);
+
+    uint64_t start = bench_now();
+    for (size_t i = 0; i < n; i++) {
+      entries[i] = bench_create(root, names[i]);
+    }
+    create += bench_now() - start;
+
+    start = bench_now();
+    for (size_t i = 0; i < n; i++) {
+      sink ^= (uintptr_t)snfs_find_child(root, names[order[i]]);
+    }
+    lookup += bench_now() - start;
+
+    start = bench_now();
+    for (size_t i = 0; i < n; i++) {
+      sink ^= (uintptr_t)snfs_find_child(root, misses[i]);
+    }
+    miss += bench_now() - start;
+
+    start = bench_now();
+    unsigned long pos = SNFS_FIRST_COOKIE;
+    size_t listed = bench_readdir(root, &pos, SIZE_MAX);
+    readdir += bench_now() - start;
+    if (listed != n) {
+      bench_fail("readdir", -EIO);
+    }
+
+    start = bench_now();
+    pos = SNFS_FIRST_COOKIE;
+    listed = 0;
+    for (size_t got; (got = bench_readdir(root, &pos, BENCH_READDIR_CHUNK)) != 0; resumes++) {
+      listed += got;
+    }
+    resume += bench_now() - start;
+    if (listed != n) {
+      bench_fail("readdir_resume", -EIO);
+    }
+
+    start = bench_now();
+    for (size_t i = 0; i < n; i++) {
+      status = snfs_remove_file(entries[order[i]], root);
+      if (status < 0) {
+        bench_fail("snfs_remove_file", status);
+      }
+    }
+    unlink += bench_now() - start;
+
+    // the next round starts a new tree
+    snfs_inode_put(root);
+    snfs_destroy_sb(&fs);
+  }
+
+  size_t ops = rounds * n;
+  if (bench_enabled("create")) {
+    bench_report("create", n, ops, create);
+  }
+  if (bench_enabled("lookup")) {
+    bench_report("lookup", n, ops, lookup);
+    bench_report("lookup_miss", n, ops, miss);
+  }
+  if (bench_enabled("readdir")) {
+    bench_report("readdir", n, ops, readdir);
+    bench_report("readdir_resume", n, resumes, resume);
+  }
+  if (bench_enabled("unlink")) {
+    bench_report("unlink", n, ops, unlink);
+  }
+  free(entries);
+  free(order);
+  free(misses);
+  free(names);
+}
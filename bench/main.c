@@ -0,0 +1,92 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "bench.h"
+
+size_t bench_min_ops = 100000;
+size_t bench_max_threads;
+static size_t max_entries = 1000000;
+static char** filters;
+static int nfilters;
+
+bool bench_enabled(const char* name) {
+  if (nfilters == 0) {
+    return true;
+  }
+  for (int i = 0; i < nfilters; i++) {
+    if (strstr(name, filters[i]) != NULL) {
+      return true;
+    }
+  }
+  return false;
+}
+
+uint64_t bench_now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void bench_report(const char* name, size_t n, size_t ops, uint64_t ns) {
+  printf("%-20s %8zu %10zu %12.1f\n", name, n, ops, (double)ns / ops);
+  fflush(stdout);
+}
+
+uint64_t bench_rand(uint64_t* state) {
+  uint64_t x = *state;
+  x ^= x << 13;
+  x ^= x >> 7;
+  x ^= x << 17;
+  return *state = x;
+}
+
+size_t bench_rounds(size_t n) {
+  return n >= bench_min_ops ? 1 : (bench_min_ops + n - 1) / n;
+}
+
+static void usage(const char* prog) {
+  fprintf(
+      stderr,
+      "Usage: %s [-n max entries] [-o min ops] [-t max threads] [name...]\n"
+      "Runs every benchmark whose name contains one of the names, at 10, 100, ... entries\n"
+      "Threaded ones run at 1, 2, 4, ... threads, up to one per CPU by default\n",
+      prog
+  );
+  exit(2);
+}
+
+int main(int argc, char** argv) {
+  int opt;
+  bench_max_threads = sysconf(_SC_NPROCESSORS_ONLN);
+  while ((opt = getopt(argc, argv, "n:o:t:h")) != -1) {
+    switch (opt) {
+      case 'n':
+        max_entries = strtoull(optarg, NULL, 10);
+        break;
+      case 'o':
+        bench_min_ops = strtoull(optarg, NULL, 10);
+        break;
+      case 't':
+        bench_max_threads = strtoull(optarg, NULL, 10);
+        break;
+      default:
+        usage(argv[0]);
+    }
+  }
+  filters = argv + optind;
+  nfilters = argc - optind;
+  if (max_entries < 10 || bench_min_ops == 0 || bench_max_threads == 0) {
+    usage(argv[0]);
+  }
+
+  printf("%-20s %8s %10s %12s\n", "bench", "entries", "ops", "ns/op");
+  for (size_t n = 10; n <= max_entries; n *= 10) {
+    bench_impl(n);
+    bench_data(n);
+    bench_http(n);
+  }
+  return 0;
+}
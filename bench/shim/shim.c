@@ -0,0 +1,672 @@
+#include "shim.h"
+
+#include <ctype.h>
+
+struct net init_net;
+
+/* Strings */
+
+ssize_t strscpy(char* dst, const char* src, size_t count) {
+  if (count == 0) {
+    return -E2BIG;
+  }
+  size_t len = strnlen(src, count);
+  if (len == count) {
+    memcpy(dst, src, count - 1);
+    dst[count - 1] = '\0';
+    return -E2BIG;
+  }
+  memcpy(dst, src, len + 1);
+  return len;
+}
+
+int scnprintf(char* buf, size_t size, const char* fmt, ...) {
+  if (size == 0) {
+    return 0;
+  }
+  va_list args;
+  va_start(args, fmt);
+  int len = vsnprintf(buf, size, fmt, args);
+  va_end(args);
+  if (len < 0) {
+    return 0;
+  }
+  return (size_t)len < size ? len : (int)size - 1;
+}
+
+char* skip_spaces(const char* str) {
+  while (isspace((unsigned char)*str)) {
+    str++;
+  }
+  return (char*)str;
+}
+
+char* strim(char* s) {
+  size_t len = strlen(s);
+  while (len != 0 && isspace((unsigned char)s[len - 1])) {
+    s[--len] = '\0';
+  }
+  return skip_spaces(s);
+}
+
+char* strreplace(char* s, char old, char new) {
+  for (; *s != '\0'; s++) {
+    if (*s == old) {
+      *s = new;
+    }
+  }
+  return s;
+}
+
+// like the kernel, a single trailing newline is fine and nothing else is
+int kstrtou64(const char* s, unsigned int base, u64* res) {
+  char* end;
+  if (*s == '\0' || *s == '-' || isspace((unsigned char)*s)) {
+    return -EINVAL;
+  }
+  errno = 0;
+  unsigned long long v = strtoull(s, &end, base);
+  if (errno == ERANGE) {
+    return -ERANGE;
+  }
+  if (end == s || (*end != '\0' && !(end[0] == '\n' && end[1] == '\0'))) {
+    return -EINVAL;
+  }
+  *res = v;
+  return 0;
+}
+
+u32 in_aton(const char* str) {
+  u32 addr = 0;
+  for (int i = 0; i < 4; i++) {
+    addr |= (u32)strtoul(str, (char**)&str, 10) << (8 * i);
+    if (*str == '.') {
+      str++;
+    }
+  }
+  return addr;
+}
+
+/* Sockets */
+
+// the end of rx reads as the peer closing
+int kernel_recvmsg(
+    struct socket* sock, struct msghdr* msg, struct kvec* vec, size_t num, size_t len, int flags
+) {
+  size_t n = min(len, sock->rx_len - sock->rx_pos);
+  n = min(n, vec[0].iov_len);
+  memcpy(vec[0].iov_base, sock->rx + sock->rx_pos, n);
+  sock->rx_pos += n;
+  return n;
+}
+
+int sock_recvmsg(struct socket* sock, struct msghdr* msg, int flags) {
+  size_t n = copy_to_iter(sock->rx + sock->rx_pos, sock->rx_len - sock->rx_pos, &msg->msg_iter);
+  sock->rx_pos += n;
+  return n;
+}
+
+int sock_sendmsg(struct socket* sock, struct msghdr* msg) {
+  size_t n = iov_iter_count(&msg->msg_iter);
+  sock->tx_bytes += n;
+  return n;
+}
+
+/* Memory */
+
+void* kmalloc(size_t size, gfp_t flags) {
+  return malloc(size);
+}
+
+void* kzalloc(size_t size, gfp_t flags) {
+  return calloc(1, size);
+}
+
+void* krealloc(const void* p, size_t size, gfp_t flags) {
+  return realloc((void*)p, size);
+}
+
+void kfree(const void* p) {
+  free((void*)p);
+}
+
+struct kmem_cache* kmem_cache_create(
+    const char* name,
+    unsigned int size,
+    unsigned int align,
+    unsigned long flags,
+    void (*ctor)(void*)
+) {
+  struct kmem_cache* cache = malloc(sizeof(*cache));
+  if (cache == NULL) {
+    return NULL;
+  }
+  cache->name = name;
+  cache->align = align < sizeof(void*) ? sizeof(void*) : align;
+  // aligned_alloc wants a multiple of the alignment
+  cache->size = (size + cache->align - 1) / cache->align * cache->align;
+  return cache;
+}
+
+void kmem_cache_destroy(struct kmem_cache* cache) {
+  free(cache);
+}
+
+void* kmem_cache_alloc(struct kmem_cache* cache, gfp_t flags) {
+  return aligned_alloc(cache->align, cache->size);
+}
+
+void* kmem_cache_zalloc(struct kmem_cache* cache, gfp_t flags) {
+  void* p = kmem_cache_alloc(cache, flags);
+  if (p != NULL) {
+    memset(p, 0, cache->size);
+  }
+  return p;
+}
+
+void kmem_cache_free(struct kmem_cache* cache, void* p) {
+  free(p);
+}
+
+mempool_t* mempool_create_slab_pool(int min_nr, struct kmem_cache* cache) {
+  mempool_t* pool = malloc(sizeof(*pool));
+  if (pool != NULL) {
+    pool->cache = cache;
+  }
+  return pool;
+}
+
+void mempool_destroy(mempool_t* pool) {
+  free(pool);
+}
+
+void* mempool_alloc(mempool_t* pool, gfp_t flags) {
+  void* p = kmem_cache_alloc(pool->cache, flags);
+  if (p == NULL) {
+    abort();
+  }
+  return p;
+}
+
+void mempool_free(void* element, mempool_t* pool) {
+  kmem_cache_free(pool->cache, element);
+}
+
+/* Vectors */
+
+void iov_iter_kvec(
+    struct iov_iter* i, unsigned int direction, const struct kvec* kvec, unsigned long nr_segs,
+    size_t count
+) {
+  *i = (struct iov_iter){
+      .data_source = direction,
+      .kvec = kvec,
+      .nr_segs = nr_segs,
+      .count = count,
+  };
+}
+
+void iov_iter_advance(struct iov_iter* i, size_t bytes) {
+  bytes = min(bytes, i->count);
+  i->count -= bytes;
+  bytes += i->iov_offset;
+  while (i->nr_segs != 0 && bytes >= i->kvec->iov_len) {
+    bytes -= i->kvec->iov_len;
+    i->kvec++;
+    i->nr_segs--;
+  }
+  i->iov_offset = bytes;
+}
+
+size_t copy_to_iter(const void* addr, size_t bytes, struct iov_iter* i) {
+  size_t done = 0;
+  bytes = min(bytes, i->count);
+  while (done < bytes) {
+    size_t n = min(bytes - done, i->kvec->iov_len - i->iov_offset);
+    memcpy((char*)i->kvec->iov_base + i->iov_offset, (const char*)addr + done, n);
+    done += n;
+    iov_iter_advance(i, n);
+  }
+  return done;
+}
+
+/* XArray */
+
+struct xa_node {
+  unsigned int shift; /* of the index bits this node picks a slot by */
+  unsigned int count; /* slots in use */
+  u64 present;        /* bit per slot in use */
+  u64 marks[XA_MAX_MARKS];
+  void* slots[XA_CHUNK_SIZE];
+};
+
+#define XA_ERROR(errno) ((void*)(((long)(errno) << 2) | 2))
+
+static unsigned long xa_capacity(unsigned int height) {
+  unsigned int bits = height * XA_CHUNK_SHIFT;
+  return bits >= 64 ? ULONG_MAX : (1UL << bits) - 1;
+}
+
+// largest index below node, which lookups go by since the height may change under them
+static unsigned long xa_node_capacity(const struct xa_node* node) {
+  unsigned int bits = node->shift + XA_CHUNK_SHIFT;
+  return bits >= 64 ? ULONG_MAX : (1UL << bits) - 1;
+}
+
+static unsigned int xa_offset(const struct xa_node* node, unsigned long index) {
+  return (index >> node->shift) & (XA_CHUNK_SIZE - 1);
+}
+
+static u64 xa_filter_bits(const struct xa_node* node, xa_mark_t filter) {
+  return filter == XA_PRESENT ? node->present : node->marks[filter];
+}
+
+static struct xa_node* xa_node_alloc(unsigned int shift) {
+  struct xa_node* node = calloc(1, sizeof(*node));
+  if (node != NULL) {
+    node->shift = shift;
+  }
+  return node;
+}
+
+void* xa_load(struct xarray* xa, unsigned long index) {
+  struct xa_node* node = READ_ONCE(xa->xa_head);
+  if (node == NULL || index > xa_node_capacity(node)) {
+    return NULL;
+  }
+  for (;;) {
+    void* slot = READ_ONCE(node->slots[xa_offset(node, index)]);
+    if (node->shift == 0 || slot == NULL) {
+      return slot;
+    }
+    node = slot;
+  }
+}
+
+// adds levels on top until index fits, the old head becomes slot 0 of the new one
+static int xa_grow(struct xarray* xa, unsigned long index) {
+  while (xa->xa_head == NULL || index > xa_capacity(xa->height)) {
+    struct xa_node* node = xa_node_alloc(xa->height * XA_CHUNK_SHIFT);
+    if (node == NULL) {
+      return -ENOMEM;
+    }
+    struct xa_node* old = xa->xa_head;
+    if (old != NULL) {
+      node->slots[0] = old;
+      node->count = 1;
+      node->present = 1;
+      for (int m = 0; m < XA_MAX_MARKS; m++) {
+        node->marks[m] = old->marks[m] != 0;
+      }
+    }
+    // the new head is complete before lookups can see it
+    smp_store_release(&xa->xa_head, node);
+    xa->height++;
+  }
+  return 0;
+}
+
+// nodes from the head down to the leaf slot of index, the path is as long as height
+static int xa_walk(struct xarray* xa, unsigned long index, struct xa_node** path) {
+  struct xa_node* node = READ_ONCE(xa->xa_head);
+  int depth = 0;
+  if (node == NULL || index > xa_node_capacity(node)) {
+    return -1;
+  }
+  for (;;) {
+    path[depth] = node;
+    if (node->shift == 0) {
+      return depth;
+    }
+    node = READ_ONCE(node->slots[xa_offset(node, index)]);
+    if (node == NULL) {
+      return -1;
+    }
+    depth++;
+  }
+}
+
+// clears mark up the path from the leaf for as long as nothing else below has it
+static void xa_clear_path(struct xa_node** path, int depth, unsigned long index, xa_mark_t mark) {
+  for (int d = depth; d >= 0; d--) {
+    path[d]->marks[mark] &= ~(1ULL << xa_offset(path[d], index));
+    if (path[d]->marks[mark] != 0) {
+      break;
+    }
+  }
+}
+
+static void* __xa_erase(struct xarray* xa, unsigned long index) {
+  struct xa_node* path[64 / XA_CHUNK_SHIFT + 1];
+  int depth = xa_walk(xa, index, path);
+  if (depth < 0) {
+    return NULL;
+  }
+  unsigned int offset = xa_offset(path[depth], index);
+  void* old = path[depth]->slots[offset];
+  if (old == NULL) {
+    return NULL;
+  }
+  for (xa_mark_t m = 0; m < XA_MAX_MARKS; m++) {
+    if (path[depth]->marks[m] & (1ULL << offset)) {
+      xa_clear_path(path, depth, index, m);
+    }
+  }
+  // empty nodes go, up to and including the head
+  for (int d = depth; d >= 0; d--) {
+    struct xa_node* node = path[d];
+    offset = xa_offset(node, index);
+    node->slots[offset] = NULL;
+    node->present &= ~(1ULL << offset);
+    if (--node->count != 0) {
+      break;
+    }
+    free(node);
+    if (d == 0) {
+      xa->xa_head = NULL;
+      xa->height = 0;
+    }
+  }
+  return old;
+}
+
+void* xa_erase(struct xarray* xa, unsigned long index) {
+  pthread_mutex_lock(&xa->xa_lock);
+  void* old = __xa_erase(xa, index);
+  pthread_mutex_unlock(&xa->xa_lock);
+  return old;
+}
+
+static void* __xa_store(struct xarray* xa, unsigned long index, void* entry, gfp_t gfp) {
+  if (entry == NULL) {
+    return __xa_erase(xa, index);
+  }
+  if (xa_grow(xa, index) < 0) {
+    return XA_ERROR(-ENOMEM);
+  }
+  struct xa_node* node = xa->xa_head;
+  for (;;) {
+    unsigned int offset = xa_offset(node, index);
+    if (node->shift == 0) {
+      void* old = node->slots[offset];
+      if (old == NULL) {
+        node->count++;
+        node->present |= 1ULL << offset;
+      }
+      smp_store_release(&node->slots[offset], entry);
+      return old;
+    }
+    if (node->slots[offset] == NULL) {
+      struct xa_node* child = xa_node_alloc(node->shift - XA_CHUNK_SHIFT);
+      if (child == NULL) {
+        return XA_ERROR(-ENOMEM);
+      }
+      smp_store_release(&node->slots[offset], child);
+      node->count++;
+      node->present |= 1ULL << offset;
+    }
+    node = node->slots[offset];
+  }
+}
+
+void* xa_store(struct xarray* xa, unsigned long index, void* entry, gfp_t gfp) {
+  pthread_mutex_lock(&xa->xa_lock);
+  void* old = __xa_store(xa, index, entry, gfp);
+  pthread_mutex_unlock(&xa->xa_lock);
+  return old;
+}
+
+int xa_insert(struct xarray* xa, unsigned long index, void* entry, gfp_t gfp) {
+  int status = -EBUSY;
+  pthread_mutex_lock(&xa->xa_lock);
+  if (xa_load(xa, index) == NULL) {
+    status = xa_err(__xa_store(xa, index, entry, gfp));
+  }
+  pthread_mutex_unlock(&xa->xa_lock);
+  return status;
+}
+
+static void xa_free_node(struct xa_node* node) {
+  if (node->shift != 0) {
+    for (unsigned int i = 0; i < XA_CHUNK_SIZE; i++) {
+      if (node->slots[i] != NULL) {
+        xa_free_node(node->slots[i]);
+      }
+    }
+  }
+  free(node);
+}
+
+void xa_destroy(struct xarray* xa) {
+  if (xa->xa_head != NULL) {
+    xa_free_node(xa->xa_head);
+  }
+  xa->xa_head = NULL;
+  xa->height = 0;
+}
+
+// first entry at or after *index within the subtree of node that passes filter
+static void* xa_find_in(
+    struct xa_node* node, unsigned long* index, unsigned long max, xa_mark_t filter
+) {
+  unsigned int offset = xa_offset(node, *index);
+  u64 bits = xa_filter_bits(node, filter) & (~0ULL << offset);
+  while (bits != 0) {
+    unsigned int slot = __builtin_ctzll(bits);
+    bits &= bits - 1;
+    // the part of the index above this node stays, the part below starts over past offset
+    unsigned long span = node->shift + XA_CHUNK_SHIFT >= 64
+                             ? ULONG_MAX
+                             : (1UL << (node->shift + XA_CHUNK_SHIFT)) - 1;
+    unsigned long base = (*index & ~span) | ((unsigned long)slot << node->shift);
+    unsigned long start = slot == offset ? *index : base;
+    if (start > max) {
+      return NULL;
+    }
+    if (node->shift == 0) {
+      *index = start;
+      return READ_ONCE(node->slots[slot]);
+    }
+    unsigned long at = start;
+    void* entry = xa_find_in(READ_ONCE(node->slots[slot]), &at, max, filter);
+    if (entry != NULL) {
+      *index = at;
+      return entry;
+    }
+  }
+  return NULL;
+}
+
+void* xa_find(struct xarray* xa, unsigned long* index, unsigned long max, xa_mark_t filter) {
+  struct xa_node* head = READ_ONCE(xa->xa_head);
+  if (head == NULL || *index > xa_node_capacity(head) || *index > max) {
+    return NULL;
+  }
+  return xa_find_in(head, index, max, filter);
+}
+
+void* xa_find_after(struct xarray* xa, unsigned long* index, unsigned long max, xa_mark_t filter) {
+  if (*index == ULONG_MAX) {
+    return NULL;
+  }
+  unsigned long next = *index + 1;
+  void* entry = xa_find(xa, &next, max, filter);
+  if (entry != NULL) {
+    *index = next;
+  }
+  return entry;
+}
+
+bool xa_get_mark(struct xarray* xa, unsigned long index, xa_mark_t mark) {
+  struct xa_node* path[64 / XA_CHUNK_SHIFT + 1];
+  int depth = xa_walk(xa, index, path);
+  return depth >= 0 && (path[depth]->marks[mark] & (1ULL << xa_offset(path[depth], index)));
+}
+
+void xa_set_mark(struct xarray* xa, unsigned long index, xa_mark_t mark) {
+  struct xa_node* path[64 / XA_CHUNK_SHIFT + 1];
+  pthread_mutex_lock(&xa->xa_lock);
+  int depth = xa_walk(xa, index, path);
+  if (depth >= 0 && path[depth]->slots[xa_offset(path[depth], index)] != NULL) {
+    for (int d = depth; d >= 0; d--) {
+      path[d]->marks[mark] |= 1ULL << xa_offset(path[d], index);
+    }
+  }
+  pthread_mutex_unlock(&xa->xa_lock);
+}
+
+void xa_clear_mark(struct xarray* xa, unsigned long index, xa_mark_t mark) {
+  struct xa_node* path[64 / XA_CHUNK_SHIFT + 1];
+  pthread_mutex_lock(&xa->xa_lock);
+  int depth = xa_walk(xa, index, path);
+  if (depth >= 0) {
+    xa_clear_path(path, depth, index, mark);
+  }
+  pthread_mutex_unlock(&xa->xa_lock);
+}
+
+// probes for a free index from *next on, which the cyclic use keeps to one probe mostly
+int xa_alloc_cyclic(
+    struct xarray* xa, u32* id, void* entry, struct xa_limit limit, u32* next, gfp_t gfp
+) {
+  pthread_mutex_lock(&xa->xa_lock);
+  u32 start = max(*next, limit.min);
+  bool wrapped = false;
+  u32 at = start;
+  while (xa_load(xa, at) != NULL) {
+    if (at == limit.max) {
+      at = limit.min;
+      wrapped = true;
+    } else {
+      at++;
+    }
+    if (at == start) {
+      pthread_mutex_unlock(&xa->xa_lock);
+      return -EBUSY;
+    }
+  }
+  int status = xa_err(__xa_store(xa, at, entry, gfp));
+  if (status == 0) {
+    *id = at;
+    *next = at == limit.max ? limit.min : at + 1;
+    status = wrapped ? 1 : 0;
+  }
+  pthread_mutex_unlock(&xa->xa_lock);
+  return status;
+}
+
+/* Resizable hash table */
+
+#define RHT_MIN_SIZE 4
+#define RHT_DEFAULT_SIZE 64
+
+// FNV-1a, the kernel uses jhash, both touch every key byte once
+static u32 rht_hash(const void* key, size_t len) {
+  const unsigned char* p = key;
+  u32 h = 2166136261u;
+  for (size_t i = 0; i < len; i++) {
+    h = (h ^ p[i]) * 16777619u;
+  }
+  return h;
+}
+
+static const void* rht_obj_key(const struct rhashtable* ht, const struct rhash_head* head) {
+  return (const char*)head - ht->p.head_offset + ht->p.key_offset;
+}
+
+static int rht_resize(struct rhashtable* ht, size_t size) {
+  struct rhash_head** buckets = calloc(size, sizeof(*buckets));
+  if (buckets == NULL) {
+    return -ENOMEM;
+  }
+  for (size_t i = 0; i < ht->size; i++) {
+    struct rhash_head* head = ht->buckets[i];
+    while (head != NULL) {
+      struct rhash_head* next = head->next;
+      size_t b = rht_hash(rht_obj_key(ht, head), ht->p.key_len) & (size - 1);
+      head->next = buckets[b];
+      buckets[b] = head;
+      head = next;
+    }
+  }
+  free(ht->buckets);
+  ht->buckets = buckets;
+  ht->size = size;
+  return 0;
+}
+
+int rhashtable_init(struct rhashtable* ht, const struct rhashtable_params* params) {
+  ht->p = *params;
+  ht->size = RHT_DEFAULT_SIZE;
+  ht->nelems = 0;
+  ht->buckets = calloc(ht->size, sizeof(*ht->buckets));
+  return ht->buckets == NULL ? -ENOMEM : 0;
+}
+
+void rhashtable_destroy(struct rhashtable* ht) {
+  free(ht->buckets);
+  ht->buckets = NULL;
+}
+
+void* rhashtable_lookup_fast(
+    struct rhashtable* ht, const void* key, const struct rhashtable_params params
+) {
+  size_t b = rht_hash(key, params.key_len) & (ht->size - 1);
+  for (struct rhash_head* head = ht->buckets[b]; head != NULL; head = head->next) {
+    if (memcmp(rht_obj_key(ht, head), key, params.key_len) == 0) {
+      return (char*)head - params.head_offset;
+    }
+  }
+  return NULL;
+}
+
+// grows past 75% load and shrinks under 30%, like the kernel's defaults
+int rhashtable_lookup_insert_fast(
+    struct rhashtable* ht, struct rhash_head* obj, const struct rhashtable_params params
+) {
+  const void* key = rht_obj_key(ht, obj);
+  if (rhashtable_lookup_fast(ht, key, params) != NULL) {
+    return -EEXIST;
+  }
+  if (ht->nelems + 1 > ht->size / 4 * 3 && rht_resize(ht, ht->size * 2) < 0) {
+    return -ENOMEM;
+  }
+  size_t b = rht_hash(key, params.key_len) & (ht->size - 1);
+  obj->next = ht->buckets[b];
+  ht->buckets[b] = obj;
+  ht->nelems++;
+  return 0;
+}
+
+int rhashtable_remove_fast(
+    struct rhashtable* ht, struct rhash_head* obj, const struct rhashtable_params params
+) {
+  size_t b = rht_hash(rht_obj_key(ht, obj), params.key_len) & (ht->size - 1);
+  for (struct rhash_head** link = &ht->buckets[b]; *link != NULL; link = &(*link)->next) {
+    if (*link == obj) {
+      *link = obj->next;
+      ht->nelems--;
+      if (params.automatic_shrinking && ht->size > RHT_MIN_SIZE &&
+          ht->nelems < ht->size * 3 / 10) {
+        // failing to shrink only wastes memory
+        rht_resize(ht, ht->size / 2);
+      }
+      return 0;
+    }
+  }
+  return -ENOENT;
+}
+
+/* Workqueues */
+
+struct workqueue_struct* alloc_workqueue(const char* fmt, unsigned int flags, int max_active) {
+  struct workqueue_struct* wq = malloc(sizeof(*wq));
+  if (wq != NULL) {
+    wq->name = fmt;
+  }
+  return wq;
+}
+
+void destroy_workqueue(struct workqueue_struct* wq) {
+  free(wq);
+}
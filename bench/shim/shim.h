@@ -0,0 +1,671 @@
+#ifndef __FSMOD_BENCH_SHIM_H_
+#define __FSMOD_BENCH_SHIM_H_
+
+/* Just enough of the kernel API for source/impl.c, http.c and metrics.c to build as a
+ * userspace program. Locks are pthread ones and the xarray is safe to use from several
+ * threads, so the file data paths can be run in parallel. RCU callbacks still run at once,
+ * so nothing may be freed while other threads look at it, and per-CPU data has one copy.
+ * Work runs when it is queued and sockets never connect, the parser reads responses from
+ * memory instead. */
+
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <time.h>
+
+/* Types */
+
+typedef uint8_t u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef uint64_t u64;
+typedef int64_t s64;
+typedef uint32_t __le32;
+typedef uint64_t __le64;
+typedef unsigned short umode_t;
+typedef unsigned int gfp_t;
+
+#define __percpu
+#define __init
+#define __exit
+#define __user
+
+#define U64_MAX UINT64_MAX
+#define GFP_KERNEL 0u
+
+#define PAGE_SHIFT 12
+#define PAGE_SIZE (1UL << PAGE_SHIFT)
+#define PAGE_MASK (~(PAGE_SIZE - 1))
+
+#define NSEC_PER_USEC 1000L
+#define NSEC_PER_SEC 1000000000L
+
+#define MINORBITS 20
+#define MAJOR(dev) ((unsigned int)((dev) >> MINORBITS))
+#define MINOR(dev) ((unsigned int)((dev) & ((1U << MINORBITS) - 1)))
+
+/* Helpers */
+
+#define min(a, b) ((a) < (b) ? (a) : (b))
+#define max(a, b) ((a) > (b) ? (a) : (b))
+#define min_t(type, a, b) min((type)(a), (type)(b))
+#define max_t(type, a, b) max((type)(a), (type)(b))
+#define ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
+#define container_of(ptr, type, member) ((type*)((char*)(ptr) - offsetof(type, member)))
+#define READ_ONCE(x) (*(volatile typeof(x)*)&(x))
+#define WRITE_ONCE(x, val) (*(volatile typeof(x)*)&(x) = (val))
+#define smp_store_release(p, v) __atomic_store_n(p, v, __ATOMIC_RELEASE)
+#define try_cmpxchg(p, old, new) \
+  __atomic_compare_exchange_n(p, old, new, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)
+#define likely(x) __builtin_expect(!!(x), 1)
+#define unlikely(x) __builtin_expect(!!(x), 0)
+
+static inline int fls64(u64 x) {
+  return x == 0 ? 0 : 64 - __builtin_clzll(x);
+}
+
+static inline u64 div_u64(u64 dividend, u32 divisor) {
+  return dividend / divisor;
+}
+
+#define MAX_ERRNO 4095
+#define IS_ERR_VALUE(x) ((unsigned long)(void*)(x) >= (unsigned long)-MAX_ERRNO)
+
+static inline void* ERR_PTR(long error) {
+  return (void*)error;
+}
+
+static inline long PTR_ERR(const void* ptr) {
+  return (long)ptr;
+}
+
+static inline bool IS_ERR(const void* ptr) {
+  return IS_ERR_VALUE(ptr);
+}
+
+static inline int PTR_ERR_OR_ZERO(const void* ptr) {
+  return IS_ERR(ptr) ? PTR_ERR(ptr) : 0;
+}
+
+#define ERR_CAST(ptr) ((void*)(ptr))
+
+/* printk */
+
+#define KERN_ERR ""
+#define printk(fmt, ...) fprintf(stderr, fmt, ##__VA_ARGS__)
+#define pr_info(fmt, ...) fprintf(stderr, fmt, ##__VA_ARGS__)
+
+/* Strings */
+
+ssize_t strscpy(char* dst, const char* src, size_t count);
+int scnprintf(char* buf, size_t size, const char* fmt, ...);
+char* skip_spaces(const char* str);
+char* strim(char* s);
+char* strreplace(char* s, char old, char new);
+int kstrtou64(const char* s, unsigned int base, u64* res);
+
+/* Unaligned access, the benchmarks run on little-endian hosts only */
+
+static inline u64 get_unaligned_le64(const void* p) {
+  u64 v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+static inline u32 get_unaligned_le32(const void* p) {
+  u32 v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+static inline void put_unaligned_le32(u32 v, void* p) {
+  memcpy(p, &v, sizeof(v));
+}
+
+static inline void put_unaligned_le64(u64 v, void* p) {
+  memcpy(p, &v, sizeof(v));
+}
+
+/* Time */
+
+#define HZ 1000
+
+static inline u64 ktime_get_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (u64)ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+#define jiffies ((unsigned long)(ktime_get_ns() / (NSEC_PER_SEC / HZ)))
+#define time_after(a, b) ((long)((b) - (a)) < 0)
+#define time_before(a, b) time_after(b, a)
+
+static inline unsigned long msecs_to_jiffies(unsigned int ms) {
+  return ms * HZ / 1000;
+}
+
+/* Memory */
+
+void* kmalloc(size_t size, gfp_t flags);
+void* kzalloc(size_t size, gfp_t flags);
+void* krealloc(const void* p, size_t size, gfp_t flags);
+void kfree(const void* p);
+#define kmalloc_array(n, size, flags) kmalloc((n) * (size), flags)
+#define kcalloc(n, size, flags) kzalloc((n) * (size), flags)
+#define kvmalloc kmalloc
+#define kvfree kfree
+
+#define SLAB_RECLAIM_ACCOUNT 0
+
+struct kmem_cache {
+  const char* name;
+  size_t size;
+  size_t align;
+};
+
+struct kmem_cache* kmem_cache_create(
+    const char* name,
+    unsigned int size,
+    unsigned int align,
+    unsigned long flags,
+    void (*ctor)(void*)
+);
+void kmem_cache_destroy(struct kmem_cache* cache);
+void* kmem_cache_alloc(struct kmem_cache* cache, gfp_t flags);
+void* kmem_cache_zalloc(struct kmem_cache* cache, gfp_t flags);
+void kmem_cache_free(struct kmem_cache* cache, void* p);
+#define KMEM_CACHE(s, flags) \
+  kmem_cache_create(#s, sizeof(struct s), __alignof__(struct s), flags, NULL)
+
+/* Never runs dry, there is no reserve to fall back on */
+typedef struct mempool {
+  struct kmem_cache* cache;
+} mempool_t;
+
+mempool_t* mempool_create_slab_pool(int min_nr, struct kmem_cache* cache);
+void mempool_destroy(mempool_t* pool);
+void* mempool_alloc(mempool_t* pool, gfp_t flags);
+void mempool_free(void* element, mempool_t* pool);
+
+/* Per-CPU data, there is one CPU */
+
+#define __alloc_percpu(size, align) kzalloc(size, GFP_KERNEL)
+#define free_percpu(p) kfree(p)
+#define per_cpu_ptr(p, cpu) (p)
+#define for_each_possible_cpu(cpu) for ((cpu) = 0; (cpu) < 1; (cpu)++)
+#define this_cpu_inc(x) ((x)++)
+#define this_cpu_add(x, v) ((x) += (v))
+
+/* Locking, real mutexes so their cost shows */
+
+struct mutex {
+  pthread_mutex_t m;
+};
+
+#define mutex_init(l) pthread_mutex_init(&(l)->m, NULL)
+#define mutex_lock(l) pthread_mutex_lock(&(l)->m)
+#define mutex_unlock(l) pthread_mutex_unlock(&(l)->m)
+
+typedef struct {
+  pthread_mutex_t m;
+} spinlock_t;
+
+#define spin_lock_init(l) pthread_mutex_init(&(l)->m, NULL)
+#define spin_lock(l) pthread_mutex_lock(&(l)->m)
+#define spin_unlock(l) pthread_mutex_unlock(&(l)->m)
+
+struct rw_semaphore {
+  pthread_rwlock_t rw;
+};
+
+#define init_rwsem(l) pthread_rwlock_init(&(l)->rw, NULL)
+#define down_read(l) pthread_rwlock_rdlock(&(l)->rw)
+#define up_read(l) pthread_rwlock_unlock(&(l)->rw)
+#define down_write(l) pthread_rwlock_wrlock(&(l)->rw)
+#define up_write(l) pthread_rwlock_unlock(&(l)->rw)
+
+struct semaphore {
+  int count;
+};
+
+static inline void sema_init(struct semaphore* sem, int val) {
+  sem->count = val;
+}
+
+static inline int down_interruptible(struct semaphore* sem) {
+  sem->count--;
+  return 0;
+}
+
+static inline void up(struct semaphore* sem) {
+  sem->count++;
+}
+
+typedef struct {
+  int counter;
+} atomic_t;
+
+#define atomic_inc_return(v) __atomic_add_fetch(&(v)->counter, 1, __ATOMIC_SEQ_CST)
+
+typedef struct {
+  int refs;
+} refcount_t;
+
+static inline void refcount_set(refcount_t* r, int n) {
+  r->refs = n;
+}
+
+static inline void refcount_inc(refcount_t* r) {
+  r->refs++;
+}
+
+static inline bool refcount_inc_not_zero(refcount_t* r) {
+  return r->refs != 0 && ++r->refs;
+}
+
+static inline bool refcount_dec_and_test(refcount_t* r) {
+  return --r->refs == 0;
+}
+
+/* RCU, with one thread a grace period is over at once */
+
+struct rcu_head {
+  struct rcu_head* next;
+  void (*func)(struct rcu_head* head);
+};
+
+#define rcu_read_lock()
+#define rcu_read_unlock()
+#define rcu_barrier()
+
+static inline void call_rcu(struct rcu_head* head, void (*func)(struct rcu_head* head)) {
+  func(head);
+}
+
+/* Lists */
+
+struct list_head {
+  struct list_head* next;
+  struct list_head* prev;
+};
+
+#define LIST_HEAD_INIT(name) {&(name), &(name)}
+#define LIST_HEAD(name) struct list_head name = LIST_HEAD_INIT(name)
+
+static inline void INIT_LIST_HEAD(struct list_head* list) {
+  list->next = list;
+  list->prev = list;
+}
+
+static inline void __list_add(
+    struct list_head* new, struct list_head* prev, struct list_head* next
+) {
+  next->prev = new;
+  new->next = next;
+  new->prev = prev;
+  prev->next = new;
+}
+
+static inline void list_add(struct list_head* new, struct list_head* head) {
+  __list_add(new, head, head->next);
+}
+
+static inline void list_add_tail(struct list_head* new, struct list_head* head) {
+  __list_add(new, head->prev, head);
+}
+
+static inline void list_del(struct list_head* entry) {
+  entry->next->prev = entry->prev;
+  entry->prev->next = entry->next;
+}
+
+static inline void list_del_init(struct list_head* entry) {
+  list_del(entry);
+  INIT_LIST_HEAD(entry);
+}
+
+static inline void list_move_tail(struct list_head* list, struct list_head* head) {
+  list_del(list);
+  list_add_tail(list, head);
+}
+
+static inline bool list_empty(const struct list_head* head) {
+  return head->next == head;
+}
+
+#define list_entry(ptr, type, member) container_of(ptr, type, member)
+#define list_first_entry(ptr, type, member) list_entry((ptr)->next, type, member)
+#define list_next_entry(pos, member) list_entry((pos)->member.next, typeof(*(pos)), member)
+#define list_for_each_entry(pos, head, member)                                          \
+  for (pos = list_first_entry(head, typeof(*pos), member); &pos->member != (head); \
+       pos = list_next_entry(pos, member))
+#define list_for_each_entry_safe(pos, n, head, member)                                      \
+  for (pos = list_first_entry(head, typeof(*pos), member), n = list_next_entry(pos, member); \
+       &pos->member != (head);                                                              \
+       pos = n, n = list_next_entry(n, member))
+
+/* Vectors */
+
+struct kvec {
+  void* iov_base;
+  size_t iov_len;
+};
+
+#define ITER_SOURCE 1
+#define ITER_DEST 0
+
+/* Only kvec iterators */
+struct iov_iter {
+  int data_source;
+  const struct kvec* kvec;
+  unsigned long nr_segs;
+  size_t iov_offset;
+  size_t count;
+};
+
+void iov_iter_kvec(
+    struct iov_iter* i, unsigned int direction, const struct kvec* kvec, unsigned long nr_segs,
+    size_t count
+);
+void iov_iter_advance(struct iov_iter* i, size_t bytes);
+size_t copy_to_iter(const void* addr, size_t bytes, struct iov_iter* i);
+
+static inline size_t iov_iter_count(const struct iov_iter* i) {
+  return i->count;
+}
+
+static inline void iov_iter_truncate(struct iov_iter* i, u64 count) {
+  if (i->count > count) {
+    i->count = count;
+  }
+}
+
+/* XArray, a radix tree of 64 slots per node with marks kept per level */
+
+#define XA_CHUNK_SHIFT 6
+#define XA_CHUNK_SIZE (1UL << XA_CHUNK_SHIFT)
+#define XA_MAX_MARKS 3
+#define XA_FLAGS_ALLOC 1u
+
+typedef unsigned int xa_mark_t;
+#define XA_MARK_0 0u
+#define XA_MARK_1 1u
+#define XA_MARK_2 2u
+#define XA_PRESENT 8u
+
+struct xa_node;
+
+/* Changes are serialized by xa_lock, lookups take no lock like RCU readers do */
+struct xarray {
+  pthread_mutex_t xa_lock;
+  unsigned int xa_flags;
+  unsigned int height; /* levels below xa_head, 0 while it is NULL */
+  struct xa_node* xa_head;
+};
+
+struct xa_limit {
+  u32 max;
+  u32 min;
+};
+
+#define XA_LIMIT(_min, _max) ((struct xa_limit){.max = (_max), .min = (_min)})
+
+static inline void xa_init_flags(struct xarray* xa, unsigned int flags) {
+  pthread_mutex_init(&xa->xa_lock, NULL);
+  xa->xa_flags = flags;
+  xa->height = 0;
+  xa->xa_head = NULL;
+}
+
+static inline void xa_init(struct xarray* xa) {
+  xa_init_flags(xa, 0);
+}
+
+static inline bool xa_empty(const struct xarray* xa) {
+  return xa->xa_head == NULL;
+}
+
+/* Errors come back from xa_store encoded like the kernel does it */
+static inline int xa_err(void* entry) {
+  if (((unsigned long)entry & 3) == 2 && (long)entry < 0) {
+    return (long)entry >> 2;
+  }
+  return 0;
+}
+
+void* xa_load(struct xarray* xa, unsigned long index);
+void* xa_store(struct xarray* xa, unsigned long index, void* entry, gfp_t gfp);
+void* xa_erase(struct xarray* xa, unsigned long index);
+/* -EBUSY if index is taken */
+int xa_insert(struct xarray* xa, unsigned long index, void* entry, gfp_t gfp);
+void xa_destroy(struct xarray* xa);
+void* xa_find(struct xarray* xa, unsigned long* index, unsigned long max, xa_mark_t filter);
+void* xa_find_after(struct xarray* xa, unsigned long* index, unsigned long max, xa_mark_t filter);
+bool xa_get_mark(struct xarray* xa, unsigned long index, xa_mark_t mark);
+void xa_set_mark(struct xarray* xa, unsigned long index, xa_mark_t mark);
+void xa_clear_mark(struct xarray* xa, unsigned long index, xa_mark_t mark);
+int xa_alloc_cyclic(
+    struct xarray* xa, u32* id, void* entry, struct xa_limit limit, u32* next, gfp_t gfp
+);
+
+#define xa_for_each_start(xa, index, entry, start)                       \
+  for (index = start, entry = xa_find(xa, &index, ULONG_MAX, XA_PRESENT); \
+       entry != NULL;                                                    \
+       entry = xa_find_after(xa, &index, ULONG_MAX, XA_PRESENT))
+#define xa_for_each(xa, index, entry) xa_for_each_start(xa, index, entry, 0)
+
+/* Resizable hash table, resized in place rather than by a worker */
+
+struct rhash_head {
+  struct rhash_head* next;
+};
+
+struct rhashtable_params {
+  u16 key_len;
+  u16 key_offset;
+  u16 head_offset;
+  bool automatic_shrinking;
+};
+
+struct rhashtable {
+  struct rhash_head** buckets;
+  size_t size; /* power of two */
+  size_t nelems;
+  struct rhashtable_params p;
+};
+
+int rhashtable_init(struct rhashtable* ht, const struct rhashtable_params* params);
+void rhashtable_destroy(struct rhashtable* ht);
+void* rhashtable_lookup_fast(
+    struct rhashtable* ht, const void* key, const struct rhashtable_params params
+);
+int rhashtable_lookup_insert_fast(
+    struct rhashtable* ht, struct rhash_head* obj, const struct rhashtable_params params
+);
+int rhashtable_remove_fast(
+    struct rhashtable* ht, struct rhash_head* obj, const struct rhashtable_params params
+);
+
+/* Completions and work run inline */
+
+struct completion {
+  bool done;
+};
+
+static inline void init_completion(struct completion* x) {
+  x->done = false;
+}
+
+static inline void complete(struct completion* x) {
+  x->done = true;
+}
+
+static inline void wait_for_completion(struct completion* x) {
+}
+
+struct work_struct;
+typedef void (*work_func_t)(struct work_struct* work);
+
+struct work_struct {
+  work_func_t func;
+};
+
+struct workqueue_struct {
+  const char* name;
+};
+
+#define WQ_UNBOUND 0
+#define WQ_MEM_RECLAIM 0
+#define INIT_WORK(w, f) ((w)->func = (f))
+
+struct workqueue_struct* alloc_workqueue(const char* fmt, unsigned int flags, int max_active);
+void destroy_workqueue(struct workqueue_struct* wq);
+
+static inline bool queue_work(struct workqueue_struct* wq, struct work_struct* work) {
+  work->func(work);
+  return true;
+}
+
+/* Sockets */
+
+#define AF_INET 2
+#define SOCK_STREAM 1
+#define IPPROTO_TCP 6
+#define SHUT_RDWR 2
+#define MSG_MORE 0x8000
+#define TCP_ESTABLISHED 1
+
+struct in_addr {
+  u32 s_addr;
+};
+
+struct sockaddr {
+  u16 sa_family;
+  char sa_data[14];
+};
+
+struct sockaddr_in {
+  u16 sin_family;
+  u16 sin_port;
+  struct in_addr sin_addr;
+  unsigned char sin_zero[8];
+};
+
+#define htons(x) __builtin_bswap16(x)
+
+struct sk_buff_head {
+  u32 qlen;
+};
+
+struct sock {
+  long sk_rcvtimeo;
+  long sk_sndtimeo;
+  int sk_state;
+  struct sk_buff_head sk_receive_queue;
+};
+
+/* Replays rx to whoever receives and counts what is sent, so response parsing runs the
+ * same code it does against the server */
+struct socket {
+  struct sock* sk;
+  const char* rx;
+  size_t rx_len;
+  size_t rx_pos;
+  size_t tx_bytes;
+};
+
+struct msghdr {
+  unsigned int msg_flags;
+  struct iov_iter msg_iter;
+};
+
+struct net {
+  int unused;
+};
+
+extern struct net init_net;
+
+u32 in_aton(const char* str);
+
+static inline int sock_create_kern(
+    struct net* net, int family, int type, int protocol, struct socket** res
+) {
+  return -EAFNOSUPPORT;
+}
+
+static inline int kernel_connect(struct socket* sock, struct sockaddr* addr, int len, int flags) {
+  return -ECONNREFUSED;
+}
+
+static inline int kernel_sock_shutdown(struct socket* sock, int how) {
+  return 0;
+}
+
+static inline void sock_release(struct socket* sock) {
+}
+
+static inline void tcp_sock_set_nodelay(struct sock* sk) {
+}
+
+static inline bool skb_queue_empty_lockless(const struct sk_buff_head* list) {
+  return list->qlen == 0;
+}
+
+int kernel_recvmsg(
+    struct socket* sock, struct msghdr* msg, struct kvec* vec, size_t num, size_t len, int flags
+);
+int sock_recvmsg(struct socket* sock, struct msghdr* msg, int flags);
+int sock_sendmsg(struct socket* sock, struct msghdr* msg);
+
+/* debugfs and seq_file, nothing is shown anywhere */
+
+struct dentry;
+
+struct seq_file {
+  void* private;
+};
+
+struct file_operations {
+  int (*show)(struct seq_file* m, void* v);
+};
+
+#define DEFINE_SHOW_ATTRIBUTE(__name) \
+  static const struct file_operations __name##_fops = {.show = __name##_show}
+
+#define seq_printf(m, fmt, ...) ((void)(m))
+#define seq_puts(m, s) ((void)(m))
+#define seq_putc(m, c) ((void)(m))
+
+static inline struct dentry* debugfs_create_dir(const char* name, struct dentry* parent) {
+  return NULL;
+}
+
+static inline struct dentry* debugfs_create_file(
+    const char* name, umode_t mode, struct dentry* parent, void* data,
+    const struct file_operations* fops
+) {
+  return NULL;
+}
+
+static inline void debugfs_remove(struct dentry* dentry) {
+}
+
+/* Tracepoints compile to nothing */
+
+#define TP_PROTO(...) __VA_ARGS__
+#define TP_ARGS(...) __VA_ARGS__
+#define TRACE_EVENT(name, proto, args, tstruct, assign, print) \
+  static inline void trace_##name(proto) {                     \
+  }
+
+#endif  // __FSMOD_BENCH_SHIM_H_
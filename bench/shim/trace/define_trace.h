@@ -0,0 +1 @@
+/* Tracepoints are plain inline functions here, there is nothing to define */
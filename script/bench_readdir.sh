@@ -0,0 +1,49 @@
+#!/bin/bash
+# Lists directories of growing size on a mounted snfs and prints the time per entry, then
+# lists them again through getdents calls of about 32 entries each and prints the time per
+# call, which stays flat as long as readdir resumes from its cookie in O(1).
+# Usage: script/bench_readdir.sh [mountpoint] [max entries]
+MNT=${1:-/mnt/sn}
+MAX=${2:-20000}
+DIR="$MNT/bench_readdir"
+
+# getdents64 into a 1 KiB buffer, 32 entries of names like f12345, on the directory in $1
+resume() {
+  python3 - "$1" <<'EOF'
+import ctypes, os, sys, time
+libc = ctypes.CDLL(None, use_errno=True)
+SYS_getdents64 = 217  # x86_64
+buf = ctypes.create_string_buffer(1024)
+fd = os.open(sys.argv[1], os.O_RDONLY | os.O_DIRECTORY)
+calls = 0
+start = time.perf_counter_ns()
+while True:
+    got = libc.syscall(SYS_getdents64, fd, buf, len(buf))
+    if got < 0:
+        sys.exit(f"getdents64: {os.strerror(ctypes.get_errno())}")
+    if got == 0:
+        break
+    calls += 1
+end = time.perf_counter_ns()
+os.close(fd)
+print(f"{calls} {(end - start) // calls}")
+EOF
+}
+
+sudo mkdir "$DIR" || exit 1
+count=0
+for size in 1000 5000 $MAX; do
+  while [ $count -lt $size ]; do
+    sudo touch "$DIR/f$count"
+    count=$((count + 1))
+  done
+  start=$(date +%s%N)
+  # ls -f does not sort, so this is getdents and nothing else
+  listed=$(ls -f "$DIR" | wc -l)
+  end=$(date +%s%N)
+  echo "$size entries: listed $((listed - 2)) in $(((end - start) / 1000)) us," \
+    "$(((end - start) / size)) ns per entry"
+  read -r calls per_call < <(resume "$DIR")
+  echo "$size entries: resumed $calls times, $per_call ns per getdents call"
+done
+sudo rm -rf "$DIR"
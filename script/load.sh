@@ -1,4 +1,5 @@
 #!/bin/bash
+# load.sh [token] [mount options, e.g. addr=10.0.0.2,port=8080]
 sudo insmod snfs.ko
 sudo mkdir /mnt/sn
-sudo mount -t snfs "TKN" /mnt/sn
+sudo mount -t snfs snfs /mnt/sn -o "token=${1:-TKN}${2:+,$2}"
@@ -0,0 +1,73 @@
+#!/bin/bash
+# Mounts snfs against the in-memory stand-in server, runs metadata and data phases on it and
+# prints the time of each, then the mount's per-op stats. Run from the repo root after make.
+# Usage: script/standin_workload.sh [files] [latency us] [jitter us] [threads]
+FILES=${1:-10000}
+LATENCY=${2:-0}
+JITTER=${3:-0}
+THREADS=${4:-4}
+MNT=/mnt/sn
+DIR="$MNT/workload"
+
+make -C standin snfs_standin >/dev/null || exit 1
+standin/snfs_standin -t "$THREADS" -l "$LATENCY" -j "$JITTER" &
+SERVER=$!
+trap 'kill -INT $SERVER; wait $SERVER' EXIT
+# the module connects at mount, so the port has to be up first
+until bash -c 'echo > /dev/tcp/127.0.0.1/8080' 2>/dev/null; do
+  sleep 0.1
+done
+script/load.sh || exit 1
+
+phase() {
+  local name=$1
+  shift
+  local start=$(date +%s%N)
+  "$@"
+  local end=$(date +%s%N)
+  printf "%-10s %10d us\n" "$name" $(((end - start) / 1000))
+}
+
+create_files() {
+  for ((i = 0; i < FILES; i++)); do
+    : >"$DIR/f$i"
+  done
+}
+
+stat_files() {
+  for ((i = 0; i < FILES; i++)); do
+    [ -e "$DIR/f$i" ] || echo "f$i is missing"
+  done
+}
+
+write_data() {
+  dd if=/dev/zero of="$DIR/data" bs=1M count=64 conv=fsync status=none
+}
+
+read_data() {
+  # dropped first, so the data comes from the server and not the page cache
+  echo 3 >/proc/sys/vm/drop_caches
+  dd if="$DIR/data" of=/dev/null bs=1M status=none
+}
+
+list_files() {
+  ls -f "$DIR" >/dev/null
+}
+
+remove_files() {
+  rm -rf "$DIR"
+  sync
+}
+
+sudo bash -c "$(declare -p FILES DIR); $(declare -f phase create_files stat_files write_data \
+  read_data list_files remove_files)
+  mkdir $DIR || exit 1
+  phase create create_files
+  phase stat stat_files
+  phase write write_data
+  phase read read_data
+  phase readdir list_files
+  phase remove remove_files"
+
+sudo sh -c "cat /sys/kernel/debug/snfs/*/stats"
+script/unload.sh
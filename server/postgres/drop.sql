@@ -1,4 +1,5 @@
 DROP TABLE IF EXISTS inode CASCADE;
+DROP TABLE IF EXISTS block CASCADE;
 DROP TABLE IF EXISTS dentry CASCADE;
 DROP TABLE IF EXISTS token CASCADE;
 DROP TABLE IF EXISTS children CASCADE;
\ No newline at end of file
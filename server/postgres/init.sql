@@ -7,15 +7,26 @@ create table inode
     no   bigint generated by default as identity
         primary key,
     type varchar(64) not null,
-    text text
+    size bigint default 0 not null
+);
+
+create table block
+(
+    inode_no    bigint references inode on update cascade on delete cascade not null,
+    block_index bigint                                                      not null,
+    data        bytea                                                       not null,
+    constraint block_pk primary key (inode_no, block_index)
 );
 
 create table dentry
 (
-    id       bigint generated by default as identity
+    id        bigint generated by default as identity
         primary key,
-    name     varchar(255)                                                not null,
-    inode_no bigint references inode on update cascade on delete cascade not null
+    parent_no bigint references inode on update cascade on delete cascade not null,
+    name      varchar(255)                                                not null,
+    inode_no  bigint references inode on update cascade on delete cascade not null,
+    -- lookups and duplicate checks go through this index
+    constraint dentry_name_uq unique (parent_no, name)
 );
 
 create table token
@@ -24,11 +35,4 @@ create table token
         primary key,
     token   varchar(255) unique                                         not null,
     root_no bigint references inode on update cascade on delete cascade not null
-);
-
-create table children
-(
-    parent_no bigint references inode on update cascade on delete cascade  not null,
-    child_no  bigint references dentry on update cascade on delete cascade not null,
-    constraint children_pk unique (parent_no, child_no)
 );
\ No newline at end of file
@@ -0,0 +1,37 @@
+package snfs.fserver.entity;
+
+import jakarta.persistence.*;
+import lombok.AllArgsConstructor;
+import lombok.Data;
+import lombok.NoArgsConstructor;
+
+import java.io.Serializable;
+
+/* One fixed-size piece of a file, the last one of a file may be shorter */
+@Entity
+@Data
+@IdClass(Block.Key.class)
+public class Block {
+
+    /* Same as the client's page size, so a flushed page is one upsert */
+    public static final int SIZE = 4096;
+
+    @Id
+    @Column(name = "inode_no")
+    private Long inodeNo;
+
+    @Id
+    @Column(name = "block_index")
+    private Long blockIndex;
+
+    private byte[] data;
+
+    @Data
+    @NoArgsConstructor
+    @AllArgsConstructor
+    public static class Key implements Serializable {
+        private Long inodeNo;
+        private Long blockIndex;
+    }
+
+}
@@ -11,6 +11,10 @@ public class Dentry {
     @GeneratedValue(strategy = GenerationType.IDENTITY)
     private Long id;
 
+    /* Unique together with name, see dentry_name_uq */
+    @Column(name = "parent_no")
+    private Long parentNo;
+
     private String name;
 
     @OneToOne(fetch = FetchType.EAGER, cascade = CascadeType.PERSIST)
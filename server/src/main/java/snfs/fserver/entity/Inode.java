@@ -4,8 +4,6 @@ import jakarta.persistence.*;
 import lombok.Data;
 import snfs.fserver.protocol.InodeType;
 
-import java.util.List;
-
 @Entity
 @Data
 public class Inode {
@@ -17,13 +15,8 @@ public class Inode {
     @Enumerated(EnumType.STRING)
     private InodeType type;
 
-    //Probably should've used blobs and stream, but...
-    private String text;
-
-    @OneToMany(fetch = FetchType.LAZY)
-    @JoinTable(name = "children", joinColumns = {@JoinColumn(name = "parent_no")}, inverseJoinColumns =
-            {@JoinColumn(name = "child_no")})
-    private List<Dentry> files;
+    /* File data lives in Block rows */
+    private Long size = 0L;
 
 
 }
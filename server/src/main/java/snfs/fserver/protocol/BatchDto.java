@@ -0,0 +1,20 @@
+package snfs.fserver.protocol;
+
+import lombok.Data;
+
+import java.nio.ByteBuffer;
+import java.util.List;
+
+/* Responses of the ops a batch ran, in order, each behind its length */
+@Data
+public class BatchDto implements ByteSerializable {
+    private List<byte[]> results;
+
+    public void putToBuffer(ByteBuffer buffer) {
+        buffer.putInt(results.size());
+        for (var result : results) {
+            buffer.putInt(result.length);
+            buffer.put(result);
+        }
+    }
+}
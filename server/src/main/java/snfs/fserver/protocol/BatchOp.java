@@ -0,0 +1,78 @@
+package snfs.fserver.protocol;
+
+import lombok.Data;
+
+import java.io.EOFException;
+import java.io.IOException;
+import java.io.InputStream;
+import java.net.URLDecoder;
+import java.nio.ByteBuffer;
+import java.nio.ByteOrder;
+import java.nio.charset.StandardCharsets;
+import java.util.ArrayList;
+import java.util.HashMap;
+import java.util.List;
+import java.util.Map;
+
+/* One op of a /batch body: its length, then the method and arguments as a GET query carries them */
+@Data
+public class BatchOp {
+    private String method;
+    private Map<String, String> params;
+
+    public String get(String key) {
+        var value = params.get(key);
+        if (value == null) {
+            throw new IllegalArgumentException("Missing " + key + " for " + method);
+        }
+        return value;
+    }
+
+    public Long getLong(String key) {
+        return Long.valueOf(get(key));
+    }
+
+    public Long getLong(String key, Long fallback) {
+        return params.containsKey(key) ? getLong(key) : fallback;
+    }
+
+    public static List<BatchOp> readAll(InputStream stream) throws IOException {
+        var ops = new ArrayList<BatchOp>();
+        while (true) {
+            var prefix = stream.readNBytes(Integer.BYTES);
+            if (prefix.length == 0) {
+                return ops;
+            }
+            if (prefix.length != Integer.BYTES) {
+                throw new EOFException("Truncated batch op");
+            }
+            var length = ByteBuffer.wrap(prefix).order(ByteOrder.LITTLE_ENDIAN).getInt();
+            if (length < 0) {
+                throw new EOFException("Bad batch op length");
+            }
+            var bytes = stream.readNBytes(length);
+            if (bytes.length != length) {
+                throw new EOFException("Truncated batch op");
+            }
+            ops.add(parse(new String(bytes, StandardCharsets.US_ASCII)));
+        }
+    }
+
+    private static BatchOp parse(String query) {
+        var op = new BatchOp();
+        var params = new HashMap<String, String>();
+        var split = query.indexOf('?');
+        op.setMethod(split < 0 ? query : query.substring(0, split));
+        op.setParams(params);
+        if (split < 0) {
+            return op;
+        }
+        for (var pair : query.substring(split + 1).split("&")) {
+            var eq = pair.indexOf('=');
+            var key = eq < 0 ? pair : pair.substring(0, eq);
+            var value = eq < 0 ? "" : pair.substring(eq + 1);
+            params.put(URLDecoder.decode(key, StandardCharsets.UTF_8), URLDecoder.decode(value, StandardCharsets.UTF_8));
+        }
+        return op;
+    }
+}
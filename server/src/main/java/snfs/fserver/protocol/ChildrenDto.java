@@ -0,0 +1,23 @@
+package snfs.fserver.protocol;
+
+import lombok.Data;
+
+import java.nio.ByteBuffer;
+import java.util.List;
+
+/* One page of a directory, next is the cursor for the following one or 0 after the last */
+@Data
+public class ChildrenDto implements ByteSerializable{
+    /* Entries per page, so that a page fits the 4 KiB response buffer of the client */
+    public static final int PAGE_SZ = 28;
+
+    private long next;
+    private List<DentryDto> children;
+
+    public void putToBuffer(ByteBuffer buffer) {
+        var len = children.size();
+        buffer.putInt(len);
+        buffer.putLong(next);
+        children.forEach(child -> child.putToBuffer(buffer));
+    }
+}
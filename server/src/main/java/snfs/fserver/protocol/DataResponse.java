@@ -0,0 +1,51 @@
+package snfs.fserver.protocol;
+
+import java.io.IOException;
+import java.io.OutputStream;
+import java.nio.ByteBuffer;
+import java.nio.ByteOrder;
+
+/* Msg, followed by a TextDto with the data when it is OK. Written straight
+ * to the response stream instead of going through ResponseBuilder. */
+public class DataResponse {
+    /* Most bytes one read may ask for, the client's readahead asks for 128 KiB */
+    public static final int MAX_LENGTH = 1 << 20;
+
+    private final ErrStatus status;
+    private final byte[] data;
+
+    private DataResponse(ErrStatus status, byte[] data) {
+        this.status = status;
+        this.data = data;
+    }
+
+    public static DataResponse of(ErrStatus status) {
+        return new DataResponse(status, null);
+    }
+
+    public static DataResponse ok(byte[] data) {
+        return new DataResponse(ErrStatus.OK, data);
+    }
+
+    public int getDataLength() {
+        return data == null ? 0 : data.length;
+    }
+
+    /* Whole response including the length prefix */
+    public long size() {
+        return Long.BYTES + Integer.BYTES + (data == null ? 0 : Integer.BYTES + data.length);
+    }
+
+    public void writeTo(OutputStream out) throws IOException {
+        var head = ByteBuffer.allocate(Long.BYTES + 2 * Integer.BYTES).order(ByteOrder.LITTLE_ENDIAN);
+        head.putLong(size() - Long.BYTES);
+        head.putInt(status.ordinal());
+        if (data != null) {
+            head.putInt(data.length);
+        }
+        out.write(head.array(), 0, head.position());
+        if (data != null) {
+            out.write(data);
+        }
+    }
+}
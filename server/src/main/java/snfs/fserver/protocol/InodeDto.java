@@ -0,0 +1,18 @@
+package snfs.fserver.protocol;
+
+import lombok.Data;
+
+import java.nio.ByteBuffer;
+
+@Data
+public class InodeDto implements ByteSerializable {
+    private int no;
+    private InodeType type;
+    private long size;
+
+    public void putToBuffer(ByteBuffer buffer) {
+        buffer.putInt(no);
+        buffer.putInt(type.ordinal());
+        buffer.putLong(size);
+    }
+}
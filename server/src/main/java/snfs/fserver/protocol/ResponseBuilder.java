@@ -0,0 +1,49 @@
+package snfs.fserver.protocol;
+
+import java.nio.BufferOverflowException;
+import java.nio.ByteBuffer;
+import java.nio.ByteOrder;
+import java.util.Arrays;
+
+public class ResponseBuilder {
+    private static final int BUF_SZ = 4096;
+    private ByteBuffer buffer;
+
+    public ResponseBuilder() {
+        buffer = ByteBuffer.allocate(BUF_SZ);
+        buffer.order(ByteOrder.LITTLE_ENDIAN);
+    }
+
+    public ResponseBuilder addItem(ByteSerializable item) {
+        var start = buffer.position();
+        while (true) {
+            try {
+                item.putToBuffer(buffer);
+                return this;
+            } catch (BufferOverflowException e) {
+                // large directory listings outgrow the initial buffer, redo the item in a bigger one
+                var bigger = ByteBuffer.allocate(buffer.capacity() * 2).order(ByteOrder.LITTLE_ENDIAN);
+                bigger.put(buffer.array(), 0, start);
+                buffer = bigger;
+            }
+        }
+    }
+
+    /* What was added so far, without the length in front */
+    public byte[] toByteArray() {
+        return Arrays.copyOf(buffer.array(), buffer.position());
+    }
+
+    public byte[] toSizedByteArray() {
+        var length = buffer.position();
+        byte[] buf = new byte[length + 8];
+        buffer.rewind();
+        buffer.get(buf, 8, length);
+        buffer.clear();
+        buffer.putLong(length);
+        buffer.rewind();
+        buffer.get(buf, 0, 8);
+        return buf;
+    }
+
+}
@@ -0,0 +1,49 @@
+package snfs.fserver.protocol;
+
+import lombok.Data;
+
+import java.nio.ByteBuffer;
+import java.nio.charset.StandardCharsets;
+import java.util.List;
+
+/* Directories of a tree breadth first, so every one comes after the entry that names it */
+@Data
+public class SnapshotDto implements ByteSerializable {
+    private List<Dir> dirs;
+
+    /* One directory with every entry it has */
+    @Data
+    public static class Dir {
+        private int no;
+        private List<Entry> entries;
+
+        public int size() {
+            return 2 * Integer.BYTES + entries.stream().mapToInt(Entry::size).sum();
+        }
+    }
+
+    /* InodeDto, then the name behind its length */
+    @Data
+    public static class Entry {
+        private String name;
+        private InodeDto inode;
+
+        public int size() {
+            return 3 * Integer.BYTES + Long.BYTES + name.getBytes(StandardCharsets.US_ASCII).length;
+        }
+    }
+
+    public void putToBuffer(ByteBuffer buffer) {
+        buffer.putInt(dirs.size());
+        for (var dir : dirs) {
+            buffer.putInt(dir.getNo());
+            buffer.putInt(dir.getEntries().size());
+            for (var entry : dir.getEntries()) {
+                var name = entry.getName().getBytes(StandardCharsets.US_ASCII);
+                entry.getInode().putToBuffer(buffer);
+                buffer.putInt(name.length);
+                buffer.put(name);
+            }
+        }
+    }
+}
@@ -0,0 +1,18 @@
+package snfs.fserver.protocol;
+
+import lombok.Data;
+
+import java.nio.ByteBuffer;
+
+/* Revision of the wire format. The client sends it with mount and gets the server's back.
+   2: InodeDto.size is an int64 */
+@Data
+public class VersionDto implements ByteSerializable {
+    public static final int CURRENT = 2;
+
+    private int version = CURRENT;
+
+    public void putToBuffer(ByteBuffer buffer) {
+        buffer.putInt(version);
+    }
+}
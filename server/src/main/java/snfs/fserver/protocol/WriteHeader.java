@@ -0,0 +1,32 @@
+package snfs.fserver.protocol;
+
+import lombok.Data;
+
+import java.io.EOFException;
+import java.io.IOException;
+import java.io.InputStream;
+import java.nio.ByteBuffer;
+import java.nio.ByteOrder;
+
+/* Leads the body of a write, the data follows it */
+@Data
+public class WriteHeader {
+    public static final int SIZE = 3 * Long.BYTES;
+
+    private long ino;
+    private long offset;
+    private long length;
+
+    public static WriteHeader readFrom(InputStream stream) throws IOException {
+        var bytes = stream.readNBytes(SIZE);
+        if (bytes.length != SIZE) {
+            throw new EOFException("Truncated write header");
+        }
+        var buffer = ByteBuffer.wrap(bytes).order(ByteOrder.LITTLE_ENDIAN);
+        var header = new WriteHeader();
+        header.setIno(buffer.getLong());
+        header.setOffset(buffer.getLong());
+        header.setLength(buffer.getLong());
+        return header;
+    }
+}
@@ -0,0 +1,26 @@
+package snfs.fserver.repository;
+
+import org.springframework.data.jpa.repository.JpaRepository;
+import org.springframework.data.jpa.repository.Modifying;
+import org.springframework.data.jpa.repository.Query;
+import org.springframework.data.repository.query.Param;
+import snfs.fserver.entity.Block;
+
+import java.util.List;
+
+public interface BlockRepository extends JpaRepository<Block, Block.Key> {
+
+    /* Blocks first..last of a file that exist, holes are simply missing */
+    @Query("select b from Block b where b.inodeNo = :ino and b.blockIndex between :first and :last")
+    List<Block> findRange(@Param("ino") Long ino, @Param("first") Long first, @Param("last") Long last);
+
+    @Modifying
+    @Query(value = "insert into block (inode_no, block_index, data) values (:ino, :index, :data) " +
+            "on conflict (inode_no, block_index) do update set data = excluded.data", nativeQuery = true)
+    void upsert(@Param("ino") Long ino, @Param("index") Long index, @Param("data") byte[] data);
+
+    /* Drops every block of a file from first on */
+    @Modifying
+    @Query("delete from Block b where b.inodeNo = :ino and b.blockIndex >= :first")
+    int deleteFrom(@Param("ino") Long ino, @Param("first") Long first);
+}
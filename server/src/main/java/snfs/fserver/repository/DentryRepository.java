@@ -1,7 +1,31 @@
 package snfs.fserver.repository;
 
+import org.springframework.data.domain.Pageable;
 import org.springframework.data.jpa.repository.JpaRepository;
+import org.springframework.data.jpa.repository.Modifying;
+import org.springframework.data.jpa.repository.Query;
+import org.springframework.data.repository.query.Param;
 import snfs.fserver.entity.Dentry;
 
+import java.util.Collection;
+import java.util.List;
+import java.util.Optional;
+
 public interface DentryRepository extends JpaRepository<Dentry, Long> {
+
+    Optional<Dentry> findByParentNoAndName(Long parentNo, String name);
+
+    boolean existsByParentNoAndName(Long parentNo, String name);
+
+    @Modifying
+    @Query("delete from Dentry d where d.parentNo = :dir and d.name = :name")
+    int deleteByParentNoAndName(@Param("dir") Long dir, @Param("name") String name);
+
+    /* Entries after the cursor in id order, inodes come in the same query */
+    @Query("select d from Dentry d join fetch d.inode where d.parentNo = :dir and d.id > :after order by d.id")
+    List<Dentry> findPage(@Param("dir") Long dir, @Param("after") Long after, Pageable page);
+
+    /* Every entry of the given directories in id order, with their inodes */
+    @Query("select d from Dentry d join fetch d.inode where d.parentNo in :dirs order by d.id")
+    List<Dentry> findByParentNoIn(@Param("dirs") Collection<Long> dirs);
 }
@@ -2,29 +2,55 @@ package snfs.fserver.resource;
 
 import org.slf4j.Logger;
 import org.slf4j.LoggerFactory;
+import org.springframework.http.HttpStatus;
+import org.springframework.http.MediaType;
 import org.springframework.http.ResponseEntity;
 import org.springframework.web.bind.annotation.GetMapping;
+import org.springframework.web.bind.annotation.PostMapping;
 import org.springframework.web.bind.annotation.RequestParam;
 import org.springframework.web.bind.annotation.RestController;
+import org.springframework.web.servlet.mvc.method.annotation.StreamingResponseBody;
+import snfs.fserver.protocol.BatchOp;
+import snfs.fserver.protocol.DataResponse;
 import snfs.fserver.protocol.InodeType;
+import snfs.fserver.protocol.WriteHeader;
+import snfs.fserver.service.BatchService;
 import snfs.fserver.service.FileService;
+import snfs.fserver.service.MetaCache;
 
+import java.io.EOFException;
 import java.io.IOException;
+import java.io.InputStream;
+import java.util.List;
 
 @RestController("/api")
 public class FileResource {
 
     private final Logger logger = LoggerFactory.getLogger(FileResource.class);
     private final FileService fileService;
+    private final BatchService batchService;
+    private final MetaCache metaCache;
 
-    public FileResource(FileService fileService) {
+    public FileResource(FileService fileService, BatchService batchService, MetaCache metaCache) {
         this.fileService = fileService;
+        this.batchService = batchService;
+        this.metaCache = metaCache;
     }
 
-    /* Returns InodeMsg with root */
+    /* Returns InodeMsg with root, then VersionMsg. Clients from before versions send none. */
     @GetMapping("/mount")
-    public ResponseEntity<byte[]> mount(@RequestParam String token) {
-        var res = fileService.mount(token);
+    public ResponseEntity<byte[]> mount(@RequestParam String token,
+                                        @RequestParam(defaultValue = "1") Integer version) {
+        var res = fileService.mount(token, version);
+        return ResponseEntity.ok(res.toSizedByteArray());
+    }
+
+    /* Returns Msg, then SnapshotMsg with the tree under the root down to depth levels,
+       as much of it as fits in limit bytes */
+    @GetMapping("/snapshot")
+    public ResponseEntity<byte[]> snapshot(@RequestParam String token, @RequestParam Integer depth,
+                                           @RequestParam Integer limit) {
+        var res = fileService.snapshot(token, depth, limit);
         return ResponseEntity.ok(res.toSizedByteArray());
     }
 
@@ -44,6 +70,13 @@ public class FileResource {
         return ResponseEntity.ok(res.toSizedByteArray());
     }
 
+    /* Returns InodeMsg */
+    @GetMapping("/getattr")
+    public ResponseEntity<byte[]> getattr(@RequestParam String token, @RequestParam Long ino) {
+        var res = fileService.getattr(token, ino);
+        return ResponseEntity.ok(res.toSizedByteArray());
+    }
+
     /* Returns Msg */
     @GetMapping("/remove")
     public ResponseEntity<byte[]> remove(@RequestParam String token, @RequestParam Long dir,
@@ -52,29 +85,79 @@ public class FileResource {
         return ResponseEntity.ok(res.toSizedByteArray());
     }
 
-    /* Returns ChildrenMsg with entries */
+    /* Returns ChildrenMsg with the page of entries that follows cursor after, 0 for the first one */
     @GetMapping("/children")
-    public ResponseEntity<byte[]> children(@RequestParam String token, @RequestParam Long dir) {
-        var res = fileService.children(token, dir);
+    public ResponseEntity<byte[]> children(@RequestParam String token, @RequestParam Long dir,
+                                           @RequestParam(defaultValue = "0") Long after) {
+        var res = fileService.children(token, dir, after);
         return ResponseEntity.ok(res.toSizedByteArray());
     }
 
-    /* Returns TextMsg */
+    /* Returns Msg, then TextMsg with at most length bytes from offset. length is at most
+       DataResponse.MAX_LENGTH */
     @GetMapping("/read")
-    public ResponseEntity<byte[]> read(@RequestParam String token, @RequestParam Long ino, @RequestParam Long offset) {
-        var res = fileService.read(token, ino, offset);
-        logger.info("Read: {}", res);
+    public ResponseEntity<StreamingResponseBody> read(@RequestParam String token, @RequestParam Long ino,
+                                                      @RequestParam Long offset, @RequestParam Integer length) {
+        if (offset < 0 || length < 0 || length > DataResponse.MAX_LENGTH) {
+            return ResponseEntity.badRequest().build();
+        }
+        var res = fileService.read(token, ino, offset, length);
+        logger.trace("Read {} bytes from {}", res.getDataLength(), ino);
+        return ResponseEntity.ok()
+                .contentType(MediaType.APPLICATION_OCTET_STREAM)
+                .contentLength(res.size())
+                .body(res::writeTo);
+    }
+
+    /* Body is a WriteHeader followed by the data. Returns Msg */
+    @PostMapping(value = "/write", consumes = MediaType.APPLICATION_OCTET_STREAM_VALUE)
+    public ResponseEntity<byte[]> write(@RequestParam String token, InputStream body) throws IOException {
+        var header = WriteHeader.readFrom(body);
+        var data = body.readNBytes(Math.toIntExact(header.getLength()));
+        if (data.length != header.getLength()) {
+            return ResponseEntity.badRequest().build();
+        }
+        var res = fileService.write(token, header.getIno(), header.getOffset(), data);
+        logger.trace("Wrote {} bytes to {}", data.length, header.getIno());
         return ResponseEntity.ok(res.toSizedByteArray());
     }
 
     /* Returns Msg */
-    @GetMapping("/write")
-    public ResponseEntity<byte[]> write(@RequestParam String token, @RequestParam Long ino,
-                                        @RequestParam String text, @RequestParam Long offset) {
-        var res = fileService.write(token, ino, text, offset);
-        logger.info("Wrote: {}", res);
+    @GetMapping("/truncate")
+    public ResponseEntity<byte[]> truncate(@RequestParam String token, @RequestParam Long ino,
+                                           @RequestParam Long size) {
+        if (size < 0) {
+            return ResponseEntity.badRequest().build();
+        }
+        var res = fileService.truncate(token, ino, size);
+        return ResponseEntity.ok(res.toSizedByteArray());
+    }
+
+    /* Body is a sequence of BatchOps, run in one transaction if atomic.
+       Returns Msg, then BatchMsg with the response of every op that ran */
+    @PostMapping(value = "/batch", consumes = MediaType.APPLICATION_OCTET_STREAM_VALUE)
+    public ResponseEntity<byte[]> batch(@RequestParam String token,
+                                        @RequestParam(defaultValue = "false") boolean atomic,
+                                        InputStream body) throws IOException {
+        List<BatchOp> ops;
+        try {
+            ops = BatchOp.readAll(body);
+        } catch (EOFException e) {
+            return ResponseEntity.badRequest().build();
+        }
+        var res = batchService.batch(token, ops, atomic);
+        logger.debug("Ran a batch of {} ops", ops.size());
         return ResponseEntity.ok(res.toSizedByteArray());
     }
 
+    /* Plain text, hits, misses and sizes of the metadata cache one per line. Only for a token
+       that has mounted */
+    @GetMapping(value = "/stats", produces = MediaType.TEXT_PLAIN_VALUE)
+    public ResponseEntity<String> stats(@RequestParam String token) {
+        if (!fileService.isRegistered(token)) {
+            return ResponseEntity.status(HttpStatus.FORBIDDEN).build();
+        }
+        return ResponseEntity.ok(metaCache.stats());
+    }
 
 }
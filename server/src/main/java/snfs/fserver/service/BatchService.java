@@ -0,0 +1,96 @@
+package snfs.fserver.service;
+
+import org.slf4j.Logger;
+import org.slf4j.LoggerFactory;
+import org.springframework.stereotype.Service;
+import org.springframework.transaction.PlatformTransactionManager;
+import org.springframework.transaction.support.TransactionTemplate;
+import snfs.fserver.protocol.*;
+
+import java.nio.ByteBuffer;
+import java.nio.ByteOrder;
+import java.util.ArrayList;
+import java.util.List;
+
+@Service
+public class BatchService {
+
+    private final Logger logger = LoggerFactory.getLogger(BatchService.class);
+    private final FileService fileService;
+    private final TransactionTemplate transactionTemplate;
+
+    public BatchService(FileService fileService, PlatformTransactionManager transactionManager) {
+        this.fileService = fileService;
+        this.transactionTemplate = new TransactionTemplate(transactionManager);
+    }
+
+    private MsgDto msgDto(ErrStatus status) {
+        var dto = new MsgDto();
+        dto.setStatus(status);
+        return dto;
+    }
+
+    private ResponseBuilder respond(ErrStatus status, List<byte[]> results) {
+        var dto = new BatchDto();
+        dto.setResults(results);
+        return new ResponseBuilder().addItem(msgDto(status)).addItem(dto);
+    }
+
+    private ErrStatus statusOf(byte[] result) {
+        return ErrStatus.values()[ByteBuffer.wrap(result).order(ByteOrder.LITTLE_ENDIAN).getInt(0)];
+    }
+
+    /* Each call goes through the FileService proxy, so it opens its own transaction or joins ours */
+    private byte[] run(String tk, BatchOp op) {
+        try {
+            var res = switch (op.getMethod()) {
+                case "create" -> fileService.create(tk, op.getLong("dir"), op.get("name"),
+                        InodeType.valueOf(op.get("type")));
+                case "lookup" -> fileService.lookup(tk, op.getLong("dir"), op.get("name"));
+                case "getattr" -> fileService.getattr(tk, op.getLong("ino"));
+                case "remove" -> fileService.remove(tk, op.getLong("dir"), op.get("name"));
+                case "children" -> fileService.children(tk, op.getLong("dir"), op.getLong("after", 0L));
+                default -> new ResponseBuilder().addItem(msgDto(ErrStatus.UNKNOWN));
+            };
+            return res.toByteArray();
+        } catch (RuntimeException e) {
+            logger.warn("Batched {} failed", op.getMethod(), e);
+            return new ResponseBuilder().addItem(msgDto(ErrStatus.UNKNOWN)).toByteArray();
+        }
+    }
+
+    public ResponseBuilder batch(String tk, List<BatchOp> ops, boolean atomic) {
+        if (!atomic) {
+            var results = new ArrayList<byte[]>();
+            ops.forEach(op -> results.add(run(tk, op)));
+            return respond(ErrStatus.OK, results);
+        }
+        try {
+            return atomically(tk, ops);
+        } catch (RuntimeException e) {
+            // the commit itself failed, a constraint only checked on flush, so nothing ran
+            logger.warn("Atomic batch failed to commit", e);
+            return respond(ErrStatus.UNKNOWN, List.of());
+        }
+    }
+
+    private ResponseBuilder atomically(String tk, List<BatchOp> ops) {
+        return transactionTemplate.execute(tx -> {
+            var results = new ArrayList<byte[]>();
+            for (var op : ops) {
+                // An op that throws has already marked the shared transaction rollback-only on its
+                // way out. Marking it here too makes the template roll back instead of failing the
+                // commit with UnexpectedRollbackException.
+                var result = run(tk, op);
+                results.add(result);
+                var status = statusOf(result);
+                if (status != ErrStatus.OK) {
+                    // nothing of the batch is applied, the last result tells which op it was
+                    tx.setRollbackOnly();
+                    return respond(status, results);
+                }
+            }
+            return respond(ErrStatus.OK, results);
+        });
+    }
+}
@@ -2,16 +2,24 @@ package snfs.fserver.service;
 
 import org.slf4j.Logger;
 import org.slf4j.LoggerFactory;
+import org.springframework.dao.DataIntegrityViolationException;
+import org.springframework.data.domain.PageRequest;
 import org.springframework.stereotype.Service;
 import org.springframework.transaction.annotation.Transactional;
+import org.springframework.transaction.interceptor.TransactionAspectSupport;
+import snfs.fserver.entity.Block;
 import snfs.fserver.entity.Dentry;
 import snfs.fserver.entity.Inode;
 import snfs.fserver.entity.Token;
 import snfs.fserver.protocol.*;
+import snfs.fserver.repository.BlockRepository;
 import snfs.fserver.repository.DentryRepository;
 import snfs.fserver.repository.InodeRepository;
 import snfs.fserver.repository.TokenRepository;
 
+import java.util.ArrayList;
+import java.util.Arrays;
+import java.util.LinkedHashMap;
 import java.util.List;
 
 @Service
@@ -22,11 +30,17 @@ public class FileService {
     private final TokenRepository tokenRepository;
     private final InodeRepository inodeRepository;
     private final DentryRepository dentryRepository;
+    private final BlockRepository blockRepository;
+    private final MetaCache metaCache;
 
-    public FileService(TokenRepository tokenRepository, InodeRepository inodeRepository, DentryRepository dentryRepository) {
+    public FileService(TokenRepository tokenRepository, InodeRepository inodeRepository,
+                       DentryRepository dentryRepository, BlockRepository blockRepository,
+                       MetaCache metaCache) {
         this.tokenRepository = tokenRepository;
         this.inodeRepository = inodeRepository;
         this.dentryRepository = dentryRepository;
+        this.blockRepository = blockRepository;
+        this.metaCache = metaCache;
     }
 
     private Token registerToken(String token) {
@@ -38,6 +52,11 @@ public class FileService {
         return tokenRepository.save(newToken);
     }
 
+    @Transactional(readOnly = true)
+    public boolean isRegistered(String tk) {
+        return tokenRepository.findByToken(tk).isPresent();
+    }
+
     @Transactional
     protected Token getToken(String tk) {
         var tokenOpt = tokenRepository.findByToken(tk);
@@ -45,8 +64,9 @@ public class FileService {
     }
 
     @Transactional
-    protected ChildrenDto childrenToDto(List<Dentry> dentries) {
+    protected ChildrenDto childrenToDto(List<Dentry> dentries, long next) {
         var dto = new ChildrenDto();
+        dto.setNext(next);
         dto.setChildren(dentries.stream().map(this::dentryToDto).toList());
         return dto;
     }
@@ -69,112 +89,212 @@ public class FileService {
         var dto = new InodeDto();
         dto.setNo(Math.toIntExact(inode.getNo()));
         dto.setType(inode.getType());
-        dto.setSize(inode.getText() == null ? 0 : inode.getText().length());
+        dto.setSize(inode.getSize());
+        return dto;
+    }
+
+    private InodeDto inodeToDto(MetaCache.CachedInode inode) {
+        var dto = new InodeDto();
+        dto.setNo(Math.toIntExact(inode.no()));
+        dto.setType(inode.type());
+        dto.setSize(inode.size());
         return dto;
     }
 
-    private Dentry createFile(String name, InodeType type) {
+    private Dentry createFile(Long dir, String name, InodeType type) {
         var inode = new Inode();
         inode.setType(type);
         var dentry = new Dentry();
+        dentry.setParentNo(dir);
         dentry.setName(name);
         dentry.setInode(inode);
         return dentry;
     }
 
+    /* A client that speaks another revision of the protocol gets UNKNOWN and nothing else */
     @Transactional
-    public ResponseBuilder mount(String token) {
-
+    public ResponseBuilder mount(String token, Integer version) {
+        var builder = new ResponseBuilder();
+        if (version != VersionDto.CURRENT) {
+            return builder.addItem(msgDto(ErrStatus.UNKNOWN));
+        }
         var tokenOpt = tokenRepository.findByToken(token);
         var tk = tokenOpt.orElseGet(() -> registerToken(token));
         var inodeDto = inodeToDto(tk.getRoot());
+        return builder.addItem(msgDto(ErrStatus.OK)).addItem(inodeDto).addItem(new VersionDto());
+    }
+
+    /* Lists directories level by level, one query each, until depth levels are done or
+       the next directory would take the response past limit bytes */
+    @Transactional(readOnly = true)
+    public ResponseBuilder snapshot(String tk, Integer depth, Integer limit) {
         var builder = new ResponseBuilder();
-        return builder.addItem(msgDto(ErrStatus.OK)).addItem(inodeDto);
+        var tokenOpt = tokenRepository.findByToken(tk);
+        if (tokenOpt.isEmpty()) {
+            return builder.addItem(msgDto(ErrStatus.MISSING));
+        }
+        var dto = new SnapshotDto();
+        dto.setDirs(new ArrayList<>());
+        var size = 2 * Integer.BYTES;
+        List<Long> level = List.of(tokenOpt.get().getRoot().getNo());
+        for (var i = 0; i < depth && !level.isEmpty(); i++) {
+            var byDir = new LinkedHashMap<Long, List<Dentry>>();
+            level.forEach(dir -> byDir.put(dir, new ArrayList<>()));
+            dentryRepository.findByParentNoIn(level).forEach(d -> byDir.get(d.getParentNo()).add(d));
+            var next = new ArrayList<Long>();
+            for (var entry : byDir.entrySet()) {
+                var dir = snapshotDir(entry.getKey(), entry.getValue());
+                size += dir.size();
+                if (size > limit) {
+                    return builder.addItem(msgDto(ErrStatus.OK)).addItem(dto);
+                }
+                dto.getDirs().add(dir);
+                entry.getValue().stream()
+                        .map(Dentry::getInode)
+                        .filter(inode -> inode.getType() == InodeType.DIR)
+                        .forEach(inode -> next.add(inode.getNo()));
+            }
+            level = next;
+        }
+        return builder.addItem(msgDto(ErrStatus.OK)).addItem(dto);
+    }
+
+    private SnapshotDto.Dir snapshotDir(Long no, List<Dentry> dentries) {
+        var dir = new SnapshotDto.Dir();
+        dir.setNo(Math.toIntExact(no));
+        dir.setEntries(dentries.stream().map(dentry -> {
+            var entry = new SnapshotDto.Entry();
+            entry.setName(dentry.getName());
+            entry.setInode(inodeToDto(dentry.getInode()));
+            return entry;
+        }).toList());
+        return dir;
     }
 
     @Transactional
     public ResponseBuilder create(String tk, Long dir, String name, InodeType type) {
-        var dirOpt = inodeRepository.findById(dir);
+        var dirOpt = metaCache.inode(dir);
         var builder = new ResponseBuilder();
         if (dirOpt.isEmpty()) {
             return builder.addItem(msgDto(ErrStatus.MISSING));
         }
         var dirNode = dirOpt.get();
-        if (dirNode.getType() != InodeType.DIR) {
+        if (dirNode.type() != InodeType.DIR) {
             return builder.addItem(msgDto(ErrStatus.NOTDIR));
         }
-        for (var entry : dirNode.getFiles()) {
-            if (entry.getName().equals(name)) {
-                return builder.addItem(msgDto(ErrStatus.DUPLICATE));
-            }
+        if (metaCache.lookup(dir, name).isPresent()) {
+            return builder.addItem(msgDto(ErrStatus.DUPLICATE));
         }
-        var file = createFile(name, type);
-        dentryRepository.save(file);
-        dirNode.getFiles().add(file);
+        var file = createFile(dir, name, type);
+        try {
+            // flushed here so that a create racing ours trips the (parent, name) index now
+            dentryRepository.saveAndFlush(file);
+        } catch (DataIntegrityViolationException e) {
+            // the failed insert left the transaction rollback-only, roll it back quietly
+            TransactionAspectSupport.currentTransactionStatus().setRollbackOnly();
+            return builder.addItem(msgDto(ErrStatus.DUPLICATE));
+        }
+        metaCache.changedName(dir, name);
         logger.debug("Created file with name {}", name);
         return builder.addItem(msgDto(ErrStatus.OK)).addItem(inodeToDto(file.getInode()));
     }
 
     @Transactional
-    public ResponseBuilder children(String tk, Long dir) {
+    public ResponseBuilder children(String tk, Long dir, Long after) {
         var builder = new ResponseBuilder();
-        var dirOpt = inodeRepository.findById(dir);
+        var dirOpt = metaCache.inode(dir);
         if (dirOpt.isEmpty()) {
             return builder.addItem(msgDto(ErrStatus.MISSING));
         }
         var dirNode = dirOpt.get();
-        if (dirNode.getType() != InodeType.DIR) {
+        if (dirNode.type() != InodeType.DIR) {
             return builder.addItem(msgDto(ErrStatus.NOTDIR));
         }
 
-        for (var entry : dirNode.getFiles()) {
-            logger.debug("Dentry: {} {}", entry.getInode().getNo(), entry.getName());
+        // one extra row tells whether there is a next page
+        var gen = metaCache.generation();
+        var page = dentryRepository.findPage(dir, after, PageRequest.ofSize(ChildrenDto.PAGE_SZ + 1));
+        // a listing is usually followed by lookups and getattrs of what it returned
+        metaCache.fill(page, gen);
+        long next = 0;
+        if (page.size() > ChildrenDto.PAGE_SZ) {
+            page = page.subList(0, ChildrenDto.PAGE_SZ);
+            next = page.get(page.size() - 1).getId();
         }
-        return builder.addItem(msgDto(ErrStatus.OK)).addItem(childrenToDto(dirNode.getFiles()));
+        return builder.addItem(msgDto(ErrStatus.OK)).addItem(childrenToDto(page, next));
     }
 
     @Transactional
     public ResponseBuilder remove(String tk, Long dir, String name) {
-        var dirOpt = inodeRepository.findById(dir);
+        var dirOpt = metaCache.inode(dir);
         var builder = new ResponseBuilder();
         if (dirOpt.isEmpty()) {
             return builder.addItem(msgDto(ErrStatus.MISSING));
         }
         var dirNode = dirOpt.get();
-        if (dirNode.getType() != InodeType.DIR) {
+        if (dirNode.type() != InodeType.DIR) {
             return builder.addItem(msgDto(ErrStatus.NOTDIR));
         }
-        for (var child : dirNode.getFiles()) {
-            if (child.getName().equals(name)) {
-                dentryRepository.delete(child);
-                dirNode.getFiles().remove(child);
-                return builder.addItem(msgDto(ErrStatus.OK));
-            }
+        if (dentryRepository.deleteByParentNoAndName(dir, name) == 0) {
+            return builder.addItem(msgDto(ErrStatus.MISSING));
         }
-        return builder.addItem(msgDto(ErrStatus.MISSING));
+        metaCache.changedName(dir, name);
+        return builder.addItem(msgDto(ErrStatus.OK));
     }
 
     @Transactional
     public ResponseBuilder lookup(String tk, Long dir, String name) {
-        var dirOpt = inodeRepository.findById(dir);
+        var dirOpt = metaCache.inode(dir);
         var builder = new ResponseBuilder();
         if (dirOpt.isEmpty()) {
             return builder.addItem(msgDto(ErrStatus.MISSING));
         }
         var dirNode = dirOpt.get();
-        if (dirNode.getType() != InodeType.DIR) {
+        if (dirNode.type() != InodeType.DIR) {
             return builder.addItem(msgDto(ErrStatus.NOTDIR));
         }
-        for (var child : dirNode.getFiles()) {
-            if (child.getName().equals(name)) {
-                return builder.addItem(msgDto(ErrStatus.OK)).addItem(inodeToDto(child.getInode()));
+        return metaCache.lookup(dir, name)
+                .map(child -> builder.addItem(msgDto(ErrStatus.OK)).addItem(inodeToDto(child)))
+                .orElseGet(() -> builder.addItem(msgDto(ErrStatus.MISSING)));
+    }
+
+    @Transactional(readOnly = true)
+    public ResponseBuilder getattr(String tk, Long ino) {
+        var builder = new ResponseBuilder();
+        return metaCache.inode(ino)
+                .map(inode -> builder.addItem(msgDto(ErrStatus.OK)).addItem(inodeToDto(inode)))
+                .orElseGet(() -> builder.addItem(msgDto(ErrStatus.MISSING)));
+    }
+
+    @Transactional(readOnly = true)
+    public DataResponse read(String tk, Long ino, Long offset, Integer length) {
+        var fileOpt = metaCache.inode(ino);
+        if (fileOpt.isEmpty()) {
+            return DataResponse.of(ErrStatus.MISSING);
+        }
+        var fileNode = fileOpt.get();
+        if (fileNode.type() != InodeType.REG) {
+            return DataResponse.of(ErrStatus.ISDIR);
+        }
+        var end = Math.min(fileNode.size(), offset + length);
+        if (offset >= end) {
+            return DataResponse.of(ErrStatus.EMPTY);
+        }
+        // blocks that were never written stay zero
+        var data = new byte[Math.toIntExact(end - offset)];
+        for (var block : blockRepository.findRange(ino, offset / Block.SIZE, (end - 1) / Block.SIZE)) {
+            var start = block.getBlockIndex() * Block.SIZE;
+            var from = Math.max(start, offset);
+            var to = Math.min(start + block.getData().length, end);
+            if (from < to) {
+                System.arraycopy(block.getData(), (int) (from - start), data, (int) (from - offset), (int) (to - from));
             }
         }
-        return builder.addItem(msgDto(ErrStatus.MISSING));
+        return DataResponse.ok(data);
     }
 
     @Transactional
-    public ResponseBuilder read(String tk, Long ino, Long offset) {
+    public ResponseBuilder write(String tk, Long ino, Long offset, byte[] data) {
         var fileOpt = inodeRepository.findById(ino);
         var builder = new ResponseBuilder();
         if (fileOpt.isEmpty()) {
@@ -184,17 +304,35 @@ public class FileService {
         if (fileNode.getType() != InodeType.REG) {
             return builder.addItem(msgDto(ErrStatus.ISDIR));
         }
-        var text = fileNode.getText();
-        if (text == null || offset >= text.length()) {
-            return builder.addItem(msgDto(ErrStatus.EMPTY));
+        var end = offset + data.length;
+        for (var pos = offset; pos < end; ) {
+            var index = pos / Block.SIZE;
+            var inBlock = (int) (pos % Block.SIZE);
+            var chunk = (int) Math.min(end - pos, Block.SIZE - inBlock);
+            var from = (int) (pos - offset);
+            byte[] block;
+            if (chunk == Block.SIZE) {
+                block = Arrays.copyOfRange(data, from, from + chunk);
+            } else {
+                // only partially covered blocks are read back
+                var old = blockRepository.findById(new Block.Key(ino, index)).map(Block::getData).orElse(new byte[0]);
+                block = Arrays.copyOf(old, Math.max(old.length, inBlock + chunk));
+                System.arraycopy(data, from, block, inBlock, chunk);
+            }
+            blockRepository.upsert(ino, index, block);
+            pos += chunk;
+        }
+        if (end > fileNode.getSize()) {
+            fileNode.setSize(end);
+            metaCache.changedInode(ino);
         }
-        var dto = new TextDto();
-        dto.setText(text);
-        return builder.addItem(msgDto(ErrStatus.OK)).addItem(dto);
+        return builder.addItem(msgDto(ErrStatus.OK));
     }
 
+    /* Sets the size either way. Blocks past the new end go and the one it falls in is cut
+       short, so growing the file again reads zeroes there. */
     @Transactional
-    public ResponseBuilder write(String tk, Long ino, String text, Long offset) {
+    public ResponseBuilder truncate(String tk, Long ino, Long size) {
         var fileOpt = inodeRepository.findById(ino);
         var builder = new ResponseBuilder();
         if (fileOpt.isEmpty()) {
@@ -204,13 +342,18 @@ public class FileService {
         if (fileNode.getType() != InodeType.REG) {
             return builder.addItem(msgDto(ErrStatus.ISDIR));
         }
-        var oldText = fileNode.getText();
-        var sb = new StringBuilder();
-        if (oldText != null) sb.append(oldText, 0, Math.min(Math.toIntExact(offset), oldText.length()));
-        var spaces = offset - sb.length();
-        sb.append(" ".repeat((int) spaces));
-        sb.append(text);
-        fileNode.setText(sb.toString());
+        var inBlock = (int) (size % Block.SIZE);
+        var last = size / Block.SIZE;
+        blockRepository.deleteFrom(ino, inBlock == 0 ? last : last + 1);
+        if (inBlock != 0) {
+            blockRepository.findById(new Block.Key(ino, last))
+                    .filter(block -> block.getData().length > inBlock)
+                    .ifPresent(block -> blockRepository.upsert(ino, last, Arrays.copyOf(block.getData(), inBlock)));
+        }
+        if (size != fileNode.getSize()) {
+            fileNode.setSize(size);
+            metaCache.changedInode(ino);
+        }
         return builder.addItem(msgDto(ErrStatus.OK));
     }
 
@@ -0,0 +1,192 @@
+package snfs.fserver.service;
+
+import org.springframework.beans.factory.annotation.Value;
+import org.springframework.stereotype.Component;
+import org.springframework.transaction.support.TransactionSynchronization;
+import org.springframework.transaction.support.TransactionSynchronizationManager;
+import snfs.fserver.entity.Dentry;
+import snfs.fserver.entity.Inode;
+import snfs.fserver.protocol.InodeType;
+import snfs.fserver.repository.DentryRepository;
+import snfs.fserver.repository.InodeRepository;
+
+import java.util.ArrayList;
+import java.util.List;
+import java.util.Map;
+import java.util.Optional;
+import java.util.concurrent.ConcurrentHashMap;
+import java.util.concurrent.atomic.AtomicInteger;
+import java.util.concurrent.atomic.AtomicLong;
+import java.util.concurrent.atomic.LongAdder;
+
+/* Read-through cache of inodes and of the names in every directory, in front of the repositories.
+   A change drops what it touched at once and again when its transaction completes, and a load
+   that raced with a completing change is not kept, so nothing older than the last commit is
+   served. A transaction that changed something reads past the cache until it completes. */
+@Component
+public class MetaCache {
+
+    /* What the protocol needs of an inode */
+    public record CachedInode(long no, InodeType type, long size) {
+        static CachedInode of(Inode inode) {
+            return new CachedInode(inode.getNo(), inode.getType(), inode.getSize());
+        }
+    }
+
+    /* Hits and misses of one of the maps */
+    private static class Counters {
+        final LongAdder hits = new LongAdder();
+        final LongAdder misses = new LongAdder();
+
+        String format(String name) {
+            return String.format("%s_hits %d%n%s_misses %d%n", name, hits.sum(), name, misses.sum());
+        }
+    }
+
+    private final InodeRepository inodeRepository;
+    private final DentryRepository dentryRepository;
+    private final int maxEntries;
+
+    private final Map<Long, CachedInode> inodes = new ConcurrentHashMap<>();
+    /* Inode number by name, per directory number. Only names that exist are here. */
+    private final Map<Long, Map<String, Long>> names = new ConcurrentHashMap<>();
+    private final AtomicInteger nameCount = new AtomicInteger();
+    /* Goes up with every completed change, loads that saw it move are not kept */
+    private final AtomicLong generation = new AtomicLong();
+    private final Counters inodeCounters = new Counters();
+    private final Counters nameCounters = new Counters();
+
+    public MetaCache(InodeRepository inodeRepository, DentryRepository dentryRepository,
+                     @Value("${snfs.cache.max-entries:100000}") int maxEntries) {
+        this.inodeRepository = inodeRepository;
+        this.dentryRepository = dentryRepository;
+        this.maxEntries = maxEntries;
+    }
+
+    /* Set while the current transaction has changes that are not committed yet */
+    private boolean bypass() {
+        return TransactionSynchronizationManager.hasResource(this);
+    }
+
+    public Optional<CachedInode> inode(Long no) {
+        if (!bypass()) {
+            var cached = inodes.get(no);
+            if (cached != null) {
+                inodeCounters.hits.increment();
+                return Optional.of(cached);
+            }
+        }
+        inodeCounters.misses.increment();
+        var gen = generation.get();
+        var loaded = inodeRepository.findById(no).map(CachedInode::of);
+        loaded.ifPresent(inode -> keepInode(inode, gen));
+        return loaded;
+    }
+
+    /* The inode dir has under name */
+    public Optional<CachedInode> lookup(Long dir, String name) {
+        if (!bypass()) {
+            var dirNames = names.get(dir);
+            var no = dirNames == null ? null : dirNames.get(name);
+            if (no != null) {
+                nameCounters.hits.increment();
+                return inode(no);
+            }
+        }
+        nameCounters.misses.increment();
+        var gen = generation.get();
+        var loaded = dentryRepository.findByParentNoAndName(dir, name);
+        loaded.ifPresent(dentry -> keepDentry(dentry, gen));
+        return loaded.map(dentry -> CachedInode.of(dentry.getInode()));
+    }
+
+    /* Generation to pass to fill, taken before the entries are loaded */
+    public long generation() {
+        return generation.get();
+    }
+
+    /* Keeps entries loaded some other way, with their inodes, so later lookups find them */
+    public void fill(List<Dentry> dentries, long gen) {
+        dentries.forEach(dentry -> keepDentry(dentry, gen));
+    }
+
+    /* Call after changing the inode's type or size */
+    public void changedInode(Long no) {
+        changed(() -> inodes.remove(no));
+    }
+
+    /* Call after adding or removing the name in dir */
+    public void changedName(Long dir, String name) {
+        changed(() -> {
+            var dirNames = names.get(dir);
+            if (dirNames != null && dirNames.remove(name) != null) {
+                nameCount.decrementAndGet();
+            }
+        });
+    }
+
+    public String stats() {
+        return inodeCounters.format("inode") + nameCounters.format("name") +
+                String.format("inodes %d%nnames %d%n", inodes.size(), nameCount.get());
+    }
+
+    private void keepInode(CachedInode inode, long gen) {
+        if (bypass()) {
+            return;
+        }
+        if (inodes.size() >= maxEntries) {
+            inodes.clear();
+        }
+        inodes.put(inode.no(), inode);
+        // a change completed since the load, it may have dropped this before we put it in
+        if (generation.get() != gen) {
+            inodes.remove(inode.no(), inode);
+        }
+    }
+
+    private void keepDentry(Dentry dentry, long gen) {
+        if (bypass()) {
+            return;
+        }
+        keepInode(CachedInode.of(dentry.getInode()), gen);
+        if (nameCount.get() >= maxEntries) {
+            names.clear();
+            nameCount.set(0);
+        }
+        var dirNames = names.computeIfAbsent(dentry.getParentNo(), dir -> new ConcurrentHashMap<>());
+        var no = dentry.getInode().getNo();
+        if (dirNames.put(dentry.getName(), no) == null) {
+            nameCount.incrementAndGet();
+        }
+        if (generation.get() != gen && dirNames.remove(dentry.getName(), no)) {
+            nameCount.decrementAndGet();
+        }
+    }
+
+    /* Drops now, so the changing transaction does not see the old value, and drops again once
+       it completes, whichever way, in case a load that started before put it back */
+    private void changed(Runnable drop) {
+        drop.run();
+        if (!TransactionSynchronizationManager.isSynchronizationActive()) {
+            generation.incrementAndGet();
+            drop.run();
+            return;
+        }
+        @SuppressWarnings("unchecked")
+        var drops = (List<Runnable>) TransactionSynchronizationManager.getResource(this);
+        if (drops == null) {
+            var pending = new ArrayList<Runnable>();
+            TransactionSynchronizationManager.bindResource(this, pending);
+            TransactionSynchronizationManager.registerSynchronization(new TransactionSynchronization() {
+                @Override
+                public void afterCompletion(int status) {
+                    TransactionSynchronizationManager.unbindResource(MetaCache.this);
+                    generation.incrementAndGet();
+                    pending.forEach(Runnable::run);
+                }
+            });
+            drops = pending;
+        }
+        drops.add(drop);
+    }
+}
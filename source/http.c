@@ -1,207 +1,954 @@
 #include "http.h"
 
-const char* SERVER_IP = "127.0.0.1";
-const int SERVER_PORT = 8080;
-
-// callee should call free_request on received buffer
-int fill_request(
-    struct kvec* vec, const char* token, const char* method, size_t arg_size, va_list args
-) {
-  // 2048 bytes for URL and 64 bytes for anything else
-  char* request_buffer = kzalloc(2048 + 64, GFP_KERNEL);
-  if (request_buffer == 0) {
+#include <asm/unaligned.h>
+#include <linux/mempool.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+#include <linux/tcp.h>
+#include <net/sock.h>
+#include <net/tcp_states.h>
+
+// 2048 bytes for URL and 64 bytes for anything else
+#define SNFS_HTTP_REQUEST_SZ (2048 + 64 + 128)
+
+// longest op in a batch, method and arguments
+#define SNFS_HTTP_BATCH_OP_SZ 512
+
+static struct kmem_cache* snfs_http_head_cachep;
+static mempool_t* snfs_http_heads;
+
+int snfs_http_caches_init(void) {
+  snfs_http_head_cachep = kmem_cache_create("snfs_http_head", SNFS_HTTP_REQUEST_SZ, 0, 0, NULL);
+  if (snfs_http_head_cachep == NULL) {
+    return -ENOMEM;
+  }
+  snfs_http_heads = mempool_create_slab_pool(SNFS_HTTP_MIN_HEADS, snfs_http_head_cachep);
+  if (snfs_http_heads == NULL) {
+    kmem_cache_destroy(snfs_http_head_cachep);
     return -ENOMEM;
   }
+  return 0;
+}
 
-  strcpy(request_buffer, "GET /");
-  strcat(request_buffer, method);
+void snfs_http_caches_destroy(void) {
+  mempool_destroy(snfs_http_heads);
+  kmem_cache_destroy(snfs_http_head_cachep);
+}
 
-  strcat(request_buffer, "?token=");
-  strcat(request_buffer, token);
+// The buffer of the returned vec comes from the head pool, this waits for one rather than
+// fail. It goes back to the pool once the request completes.
+int fill_request(
+    struct kvec* vec,
+    const char* verb,
+    const char* token,
+    const char* method,
+    size_t body_size,
+    size_t arg_size,
+    va_list args
+) {
+  char* request_buffer = mempool_alloc(snfs_http_heads, GFP_KERNEL);
 
+  size_t len = scnprintf(
+      request_buffer, SNFS_HTTP_REQUEST_SZ, "%s /%s?token=%s", verb, method, token
+  );
   for (int i = 0; i < arg_size; i++) {
-    strcat(request_buffer, "&");
-    strcat(request_buffer, va_arg(args, char*));
-    strcat(request_buffer, "=");
-    strcat(request_buffer, va_arg(args, char*));
+    const char* key = va_arg(args, char*);
+    const char* value = va_arg(args, char*);
+    len += scnprintf(
+        request_buffer + len, SNFS_HTTP_REQUEST_SZ - len, "&%s=%s", key, value
+    );
+  }
+  // heads are built before they are given a pool, and the server routes on the path alone
+  len += scnprintf(request_buffer + len, SNFS_HTTP_REQUEST_SZ - len, " HTTP/1.1\r\nHost: snfs\r\n");
+  if (body_size != 0) {
+    len += scnprintf(
+        request_buffer + len,
+        SNFS_HTTP_REQUEST_SZ - len,
+        "Content-Type: application/octet-stream\r\nContent-Length: %zu\r\n",
+        body_size
+    );
+  }
+  len += scnprintf(request_buffer + len, SNFS_HTTP_REQUEST_SZ - len, "\r\n");
+  // scnprintf stops one short of the end, a full buffer means the request was cut
+  if (len >= SNFS_HTTP_REQUEST_SZ - 1) {
+    mempool_free(request_buffer, snfs_http_heads);
+    return -E2BIG;
   }
-
-  strcat(request_buffer, " HTTP/1.1\r\nHost:");
-  strcat(request_buffer, SERVER_IP);
-  strcat(request_buffer, "\r\nConnection: close\r\n\r\n");
 
   memset(vec, 0, sizeof(struct kvec));
   vec->iov_base = request_buffer;
-  vec->iov_len = strlen(request_buffer);
+  vec->iov_len = len;
 
   return 0;
 }
 
-int receive_all(struct socket* sock, char* buffer, size_t buffer_size) {
+static int snfs_http_recv(struct socket* sock, char* buffer, size_t len, int flags) {
   struct msghdr hdr;
-  struct kvec vec;
+  struct kvec vec = {.iov_base = buffer, .iov_len = len};
+  memset(&hdr, 0, sizeof(struct msghdr));
+  return kernel_recvmsg(sock, &hdr, &vec, 1, len, flags);
+}
 
-  int read = 0;
+// longest status, header or chunk size line kept, the rest of a longer one is dropped
+#define SNFS_HTTP_LINE_SZ 256
+
+enum snfs_http_state {
+  SNFS_HTTP_STATUS,
+  SNFS_HTTP_HEADER,
+  SNFS_HTTP_BODY, /* Content-Length bytes, or everything up to the close */
+  SNFS_HTTP_CHUNK_SIZE,
+  SNFS_HTTP_CHUNK_DATA,
+  SNFS_HTTP_CHUNK_END, /* CRLF after the data of a chunk */
+  SNFS_HTTP_TRAILER,
+  SNFS_HTTP_DONE,
+};
+
+/* One response parsed as it comes off the socket, in pieces of any size. The body is
+ * the server's int64 length, then what goes to buffer, then what goes to body. */
+struct snfs_http_parser {
+  enum snfs_http_state state;
+  int code;
+  bool chunked;
+  bool keep_alive;
+  bool until_close; /* neither Content-Length nor chunked, the close ends the body */
+  u64 left;         /* of the body or the current chunk */
+  size_t line_len;
+  char line[SNFS_HTTP_LINE_SZ];
+  char prefix[sizeof(int64_t)];
+  char* buffer;
+  size_t buffer_size;
+  struct iov_iter* body; /* may be NULL */
+  size_t got;            /* body bytes so far */
+  bool overflow;         /* more body than there was room for, the rest was dropped */
+};
+
+static void snfs_http_parser_init(
+    struct snfs_http_parser* p, char* buffer, size_t buffer_size, struct iov_iter* body
+) {
+  memset(p, 0, sizeof(*p));
+  p->state = SNFS_HTTP_STATUS;
+  p->keep_alive = true;
+  p->buffer = buffer;
+  p->buffer_size = buffer_size;
+  p->body = body;
+}
 
-  while (read < buffer_size) {
-    memset(&hdr, 0, sizeof(struct msghdr));
-    memset(&vec, 0, sizeof(struct kvec));
-    vec.iov_base = buffer + read;
-    vec.iov_len = buffer_size - read;
-    int ret = kernel_recvmsg(sock, &hdr, &vec, 1, vec.iov_len, 0);
-    if (ret == 0) {
-      break;
-    } else if (ret < 0) {
-      return -4;
+// body bytes that go through the parser, past buffer they are copied into body
+static void snfs_http_deliver(struct snfs_http_parser* p, const char* data, size_t len) {
+  // error pages are read only to keep the stream in sync
+  if (p->code != 200) {
+    p->got += len;
+    return;
+  }
+  while (len != 0) {
+    size_t n;
+    if (p->got < sizeof(p->prefix)) {
+      n = min(len, sizeof(p->prefix) - p->got);
+      memcpy(p->prefix + p->got, data, n);
+    } else if (p->got < sizeof(p->prefix) + p->buffer_size) {
+      size_t at = p->got - sizeof(p->prefix);
+      n = min(len, p->buffer_size - at);
+      memcpy(p->buffer + at, data, n);
+    } else {
+      n = p->body != NULL ? copy_to_iter(data, len, p->body) : 0;
+      if (n == 0) {
+        p->overflow = true;
+        n = len;
+      }
     }
-    read += ret;
+    p->got += n;
+    data += n;
+    len -= n;
   }
+}
 
-  return read;
+// the body or chunk data ran out
+static void snfs_http_data_done(struct snfs_http_parser* p) {
+  p->state = p->chunked ? SNFS_HTTP_CHUNK_END : SNFS_HTTP_DONE;
 }
 
-int64_t parse_http_response(
-    char* raw_response, size_t raw_response_size, char* response, size_t response_size
-) {
-  char* buffer = raw_response;
+// what the blank line after the headers leads to
+static void snfs_http_headers_done(struct snfs_http_parser* p) {
+  if (p->code == 204 || p->code == 304) {
+    p->state = SNFS_HTTP_DONE;
+  } else if (p->chunked) {
+    p->state = SNFS_HTTP_CHUNK_SIZE;
+  } else if (p->until_close) {
+    p->keep_alive = false;
+    p->left = U64_MAX;
+    p->state = SNFS_HTTP_BODY;
+  } else {
+    p->state = p->left == 0 ? SNFS_HTTP_DONE : SNFS_HTTP_BODY;
+  }
+}
 
-  // Read Response Line
-  {
-    char* status_line = strsep(&buffer, "\r");
-    strsep(&status_line, " ");
-    if (status_line == 0) {
+static int snfs_http_parse_line(struct snfs_http_parser* p) {
+  char* line = p->line;
+
+  switch (p->state) {
+    case SNFS_HTTP_STATUS:
+      if (sscanf(line, "HTTP/1.%*d %d", &p->code) != 1) {
+        return -6;
+      }
+      p->until_close = true;
+      p->state = SNFS_HTTP_HEADER;
+      return 0;
+    case SNFS_HTTP_HEADER:
+      if (*line == '\0') {
+        snfs_http_headers_done(p);
+      } else if (strncasecmp(line, "Content-Length:", 15) == 0) {
+        if (kstrtou64(skip_spaces(line + 15), 10, &p->left) != 0) {
+          return -6;
+        }
+        p->until_close = false;
+      } else if (strncasecmp(line, "Transfer-Encoding:", 18) == 0) {
+        // chunked is always the last coding, it is the only one the server applies
+        if (strstr(line + 18, "chunked") == NULL) {
+          return -6;
+        }
+        p->chunked = true;
+        p->until_close = false;
+      } else if (strncasecmp(line, "Connection:", 11) == 0) {
+        if (strcasecmp(skip_spaces(line + 11), "close") == 0) {
+          p->keep_alive = false;
+        }
+      }
+      return 0;
+    case SNFS_HTTP_CHUNK_SIZE:
+      // extensions after ';' are of no interest
+      strreplace(line, ';', '\0');
+      if (kstrtou64(strim(line), 16, &p->left) != 0) {
+        return -6;
+      }
+      p->state = p->left == 0 ? SNFS_HTTP_TRAILER : SNFS_HTTP_CHUNK_DATA;
+      return 0;
+    case SNFS_HTTP_CHUNK_END:
+      if (*line != '\0') {
+        return -6;
+      }
+      p->state = SNFS_HTTP_CHUNK_SIZE;
+      return 0;
+    case SNFS_HTTP_TRAILER:
+      if (*line == '\0') {
+        p->state = SNFS_HTTP_DONE;
+      }
+      return 0;
+    default:
       return -6;
+  }
+}
+
+// Takes as much of data as belongs to the response and returns how much that was,
+// it stops once the response is complete.
+static ssize_t snfs_http_parse(struct snfs_http_parser* p, const char* data, size_t len) {
+  size_t took = 0;
+
+  while (took < len && p->state != SNFS_HTTP_DONE) {
+    if (p->state == SNFS_HTTP_BODY || p->state == SNFS_HTTP_CHUNK_DATA) {
+      size_t n = min_t(u64, len - took, p->left);
+      snfs_http_deliver(p, data + took, n);
+      took += n;
+      p->left -= n;
+      if (p->left == 0) {
+        snfs_http_data_done(p);
+      }
+      continue;
     }
-    char* status_code = strsep(&status_line, " ");
-    printk(KERN_INFO "Received response with status code %s\n", status_code);
-    if (strcmp(status_code, "200") != 0) {
-      return -5;
+
+    char c = data[took++];
+    if (c != '\n') {
+      if (p->line_len < SNFS_HTTP_LINE_SZ - 1) {
+        p->line[p->line_len++] = c;
+      }
+      continue;
+    }
+    if (p->line_len != 0 && p->line[p->line_len - 1] == '\r') {
+      p->line_len--;
+    }
+    p->line[p->line_len] = '\0';
+    p->line_len = 0;
+    int error = snfs_http_parse_line(p);
+    if (error < 0) {
+      return error;
     }
   }
+  return took;
+}
 
-  int length = -1;
+// Where the next body bytes can be received without a copy, NULL while they still go to
+// the prefix or buffer. max is how many of them belong to the response.
+static struct iov_iter* snfs_http_direct(struct snfs_http_parser* p, size_t* max) {
+  if (p->state != SNFS_HTTP_BODY && p->state != SNFS_HTTP_CHUNK_DATA) {
+    return NULL;
+  }
+  if (p->code != 200 || p->body == NULL || iov_iter_count(p->body) == 0 ||
+      p->got < sizeof(p->prefix) + p->buffer_size) {
+    return NULL;
+  }
+  *max = min_t(u64, iov_iter_count(p->body), p->left);
+  return p->body;
+}
 
-  while (true) {
-    if (buffer == 0) {
-      return -6;
-    }
-    char* header = strsep(&buffer, "\r");
-    ++header;  // skip \n
-    if (strcmp(header, "") == 0) {
-      // end of headers
-      break;
+// n bytes went straight into the iterator snfs_http_direct returned
+static void snfs_http_advance(struct snfs_http_parser* p, size_t n) {
+  iov_iter_advance(p->body, n);
+  p->got += n;
+  p->left -= n;
+  if (p->left == 0) {
+    snfs_http_data_done(p);
+  }
+}
+
+// Feeds p from conn until its response is complete. What follows it stays in conn's
+// buffer for the response pipelined next.
+static int snfs_http_read_response(struct snfs_http_conn* conn, struct snfs_http_parser* p) {
+  while (p->state != SNFS_HTTP_DONE) {
+    if (conn->rpos < conn->rlen) {
+      ssize_t took = snfs_http_parse(p, conn->rbuf + conn->rpos, conn->rlen - conn->rpos);
+      if (took < 0) {
+        return took;
+      }
+      conn->rpos += took;
+      continue;
     }
 
-    if (strncmp(header, "Content-Length: ", 16) == 0) {
-      int error = kstrtoint(header + 16, 0, &length);
-      if (error != 0) {
-        return -6;
+    conn->rpos = 0;
+    conn->rlen = 0;
+    size_t max;
+    int ret;
+    struct iov_iter* dst = snfs_http_direct(p, &max);
+    if (dst != NULL) {
+      // bulk data goes where it belongs, the receive buffer only sees the framing
+      struct msghdr hdr;
+      memset(&hdr, 0, sizeof(struct msghdr));
+      hdr.msg_iter = *dst;
+      iov_iter_truncate(&hdr.msg_iter, max);
+      ret = sock_recvmsg(conn->sock, &hdr, 0);
+      if (ret > 0) {
+        snfs_http_advance(p, ret);
+      }
+    } else {
+      ret = snfs_http_recv(conn->sock, conn->rbuf, SNFS_HTTP_RBUF_SZ, 0);
+      if (ret > 0) {
+        conn->rlen = ret;
       }
-      printk(KERN_INFO "Received response with content length %d\n", length);
+    }
+    if (ret == 0 && p->until_close && p->state == SNFS_HTTP_BODY) {
+      p->state = SNFS_HTTP_DONE;
+    } else if (ret <= 0) {
+      // peer closed or failed before the response was complete
+      return -4;
     }
   }
-  ++buffer;  // skip last '\n'
+  return 0;
+}
 
-  if (length == -1) {
+// what snfs_http_call returns for a complete response
+static int64_t snfs_http_result(struct snfs_http_parser* p) {
+  if (p->code != 200) {
+    return -5;
+  }
+  if (p->got < sizeof(p->prefix)) {
+    return -7;
+  }
+  if (p->overflow) {
+    return -ENOSPC;
+  }
+  int64_t length = get_unaligned_le64(p->prefix);
+  if (length != p->got - sizeof(p->prefix)) {
     return -6;
   }
+  return length;
+}
 
-  if (buffer + length > raw_response + raw_response_size) {
-    return -6;
+static int snfs_http_connect(struct snfs_http_pool* pool, struct snfs_http_conn** out) {
+  struct snfs_http_conn* conn = kzalloc(sizeof(*conn), GFP_KERNEL);
+  if (conn == NULL) {
+    return -ENOMEM;
   }
 
-  if (length < sizeof(int64_t)) {
-    return -7;
+  int error = sock_create_kern(&init_net, AF_INET, SOCK_STREAM, IPPROTO_TCP, &conn->sock);
+  if (error < 0) {
+    kfree(conn);
+    return -1;
   }
+  conn->sock->sk->sk_rcvtimeo = SNFS_HTTP_IO_TIMEOUT;
+  conn->sock->sk->sk_sndtimeo = SNFS_HTTP_IO_TIMEOUT;
 
-  length -= sizeof(int64_t);
+  error = kernel_connect(
+      conn->sock, (struct sockaddr*)&pool->addr, sizeof(struct sockaddr_in), 0
+  );
+  if (error != 0) {
+    sock_release(conn->sock);
+    kfree(conn);
+    return -2;
+  }
+  // requests are small and strictly request/response, Nagle only adds latency
+  tcp_sock_set_nodelay(conn->sock->sk);
 
-  if (length > response_size) {
-    return -ENOSPC;
+  *out = conn;
+  return 0;
+}
+
+static void snfs_http_conn_close(struct snfs_http_conn* conn) {
+  kernel_sock_shutdown(conn->sock, SHUT_RDWR);
+  sock_release(conn->sock);
+  kfree(conn);
+}
+
+static bool snfs_http_conn_alive(struct snfs_http_conn* conn) {
+  struct sock* sk = conn->sock->sk;
+
+  if (time_after(jiffies, conn->last_used + SNFS_HTTP_IDLE_TIMEOUT)) {
+    return false;
   }
+  // server-side close moves the socket to CLOSE_WAIT
+  if (READ_ONCE(sk->sk_state) != TCP_ESTABLISHED) {
+    return false;
+  }
+  // anything queued on an idle connection means we are out of sync with the server
+  return conn->rpos == conn->rlen && skb_queue_empty_lockless(&sk->sk_receive_queue);
+}
 
-  int64_t return_value;
-  memcpy(&return_value, buffer, sizeof(int64_t));
+static int snfs_http_get(struct snfs_http_pool* pool, struct snfs_http_conn** out, bool* reused) {
+  struct snfs_http_conn* conn;
 
-  buffer += sizeof(int64_t);
-  memcpy(response, buffer, length);
+  if (down_interruptible(&pool->slots)) {
+    return -EINTR;
+  }
 
-  return return_value;
+  spin_lock(&pool->lock);
+  while (!list_empty(&pool->idle)) {
+    conn = list_first_entry(&pool->idle, struct snfs_http_conn, node);
+    list_del(&conn->node);
+    spin_unlock(&pool->lock);
+    if (snfs_http_conn_alive(conn)) {
+      *out = conn;
+      *reused = true;
+      return 0;
+    }
+    snfs_http_conn_close(conn);
+    spin_lock(&pool->lock);
+  }
+  spin_unlock(&pool->lock);
+
+  int error = snfs_http_connect(pool, out);
+  if (error < 0) {
+    up(&pool->slots);
+    return error;
+  }
+  *reused = false;
+  return 0;
 }
 
-int64_t snfs_http_call(
+static void snfs_http_put(struct snfs_http_pool* pool, struct snfs_http_conn* conn, bool reusable) {
+  if (reusable) {
+    conn->last_used = jiffies;
+    spin_lock(&pool->lock);
+    // most recently used first, so surplus connections age out
+    list_add(&conn->node, &pool->idle);
+    spin_unlock(&pool->lock);
+  } else {
+    snfs_http_conn_close(conn);
+  }
+  up(&pool->slots);
+}
+
+static void snfs_http_pipe_work(struct work_struct* work);
+
+int snfs_http_pool_init(
+    struct snfs_http_pool* pool, unsigned int size, const struct sockaddr_in* addr
+) {
+  if (size == 0) {
+    return -EINVAL;
+  }
+  *pool = (struct snfs_http_pool){
+      .addr = *addr,
+      .idle = LIST_HEAD_INIT(pool->idle),
+      .queue = LIST_HEAD_INIT(pool->queue),
+      .size = size,
+  };
+  spin_lock_init(&pool->lock);
+  sema_init(&pool->slots, size);
+
+  // write-back flushes go through here, so it has to make progress under memory pressure
+  pool->wq = alloc_workqueue("snfs_rpc", WQ_UNBOUND | WQ_MEM_RECLAIM, size);
+  if (pool->wq == NULL) {
+    return -ENOMEM;
+  }
+  pool->pipes = kcalloc(size, sizeof(*pool->pipes), GFP_KERNEL);
+  if (pool->pipes == NULL) {
+    destroy_workqueue(pool->wq);
+    return -ENOMEM;
+  }
+  for (unsigned int i = 0; i < size; i++) {
+    pool->pipes[i].pool = pool;
+    INIT_WORK(&pool->pipes[i].work, snfs_http_pipe_work);
+  }
+  return 0;
+}
+
+// callers must have waited for all their requests
+void snfs_http_pool_destroy(struct snfs_http_pool* pool) {
+  struct snfs_http_conn* conn;
+  struct snfs_http_conn* tmp;
+
+  destroy_workqueue(pool->wq);
+  kfree(pool->pipes);
+  list_for_each_entry_safe(conn, tmp, &pool->idle, node) {
+    list_del(&conn->node);
+    snfs_http_conn_close(conn);
+  }
+}
+
+// completes req with result, it leaves whatever list it is on
+static void snfs_http_complete(struct snfs_http_req* req, int64_t result) {
+  list_del(&req->node);
+  mempool_free(req->head.iov_base, snfs_http_heads);
+  req->result = result;
+  // counted first, req may be gone once it is completed
+  if (req->metrics != NULL) {
+    size_t received = result > 0 ? result : 0;
+    snfs_metrics_record(
+        req->metrics, req->op, req->start, result, req->request_size + received
+    );
+  }
+  if (req->done != NULL) {
+    req->done(req);
+  } else {
+    complete(&req->completion);
+  }
+}
+
+static void snfs_http_fail(struct list_head* batch, int64_t error) {
+  struct snfs_http_req* req;
+  struct snfs_http_req* tmp;
+  list_for_each_entry_safe(req, tmp, batch, node) {
+    snfs_http_complete(req, error);
+  }
+}
+
+// Takes the response to req off conn. Transport failures leave req alone and return false,
+// the stream is out of sync then. Anything else completes req.
+static bool snfs_http_receive(
+    struct snfs_http_conn* conn, struct snfs_http_req* req, bool* keep_alive, int* error
+) {
+  struct snfs_http_parser parser;
+
+  // a retry starts filling body over again
+  struct iov_iter iter = req->body;
+  snfs_http_parser_init(
+      &parser, req->response_buffer, req->buffer_size, req->has_body ? &iter : NULL
+  );
+  int status = snfs_http_read_response(conn, &parser);
+  *keep_alive = parser.keep_alive;
+  if (status < 0) {
+    *error = status;
+    return false;
+  }
+  snfs_http_complete(req, snfs_http_result(&parser));
+  return true;
+}
+
+// sets req->sent once any of it went out
+static int snfs_http_send(
+    struct socket* sock,
+    struct snfs_http_req* req,
+    const struct kvec* vecs,
+    size_t nvecs,
+    size_t len,
+    int flags
+) {
+  struct msghdr msg;
+  if (len == 0) {
+    return 0;
+  }
+  memset(&msg, 0, sizeof(struct msghdr));
+  msg.msg_flags = flags;
+  iov_iter_kvec(&msg.msg_iter, ITER_SOURCE, vecs, nvecs, len);
+  int ret = sock_sendmsg(sock, &msg);
+  if (ret > 0) {
+    req->sent = true;
+  }
+  return ret == len ? 0 : -3;
+}
+
+// Sends every request of batch back to back, then takes the responses in order.
+// Answered requests are completed and leave batch, returns how many did. error is left
+// alone if the server only closed the connection after its last answer.
+static int snfs_http_pipeline(
+    struct snfs_http_conn* conn, struct list_head* batch, bool* reusable, int* error
+) {
+  struct snfs_http_req* req;
+  struct snfs_http_req* tmp;
+  size_t sent = 0;
+  int done = 0;
+  bool keep_alive = true;
+
+  list_for_each_entry(req, batch, node) {
+    size_t head_size = req->head.iov_len;
+    // a head with a body to follow waits for it instead of going out in a segment of its own
+    int flags = req->npayload != 0 ? MSG_MORE : 0;
+    if (snfs_http_send(conn->sock, req, &req->head, 1, head_size, flags) < 0 ||
+        snfs_http_send(
+            conn->sock, req, req->payload, req->npayload, req->request_size - head_size, 0
+        ) < 0) {
+      *error = -3;
+      break;
+    }
+    sent++;
+  }
+
+  list_for_each_entry_safe(req, tmp, batch, node) {
+    // the server answers nothing past a Connection: close
+    if (sent == 0 || !keep_alive) {
+      break;
+    }
+    sent--;
+    if (!snfs_http_receive(conn, req, &keep_alive, error)) {
+      keep_alive = false;
+      break;
+    }
+    done++;
+  }
+
+  *reusable = keep_alive && list_empty(batch);
+  return done;
+}
+
+// An unanswered request that changes things may have been applied all the same, so once
+// any of it went out it fails rather than going again
+static void snfs_http_fail_sent(struct list_head* batch, int64_t error) {
+  struct snfs_http_req* req;
+  struct snfs_http_req* tmp;
+  list_for_each_entry_safe(req, tmp, batch, node) {
+    if (!req->idempotent && req->sent) {
+      snfs_http_complete(req, error);
+    }
+  }
+}
+
+// Runs batch to completion on one connection at a time. What the server did not answer
+// before closing the connection goes on the next one. A connection that fails may have
+// been closed by the server while idle, that is worth exactly one retry on a fresh one,
+// unless a fresh one already failed without an answer.
+static void snfs_http_run(struct snfs_http_pool* pool, struct list_head* batch) {
+  bool retried = false;
+
+  while (!list_empty(batch)) {
+    struct snfs_http_conn* conn;
+    bool reused;
+    bool reusable;
+    int error = 0;
+
+    int status = snfs_http_get(pool, &conn, &reused);
+    if (status < 0) {
+      snfs_http_fail(batch, status);
+      return;
+    }
+    int done = snfs_http_pipeline(conn, batch, &reusable, &error);
+    snfs_http_put(pool, conn, reusable);
+
+    snfs_http_fail_sent(batch, error < 0 ? error : -4);
+    if (error < 0 && !list_empty(batch)) {
+      if (retried || (!reused && done == 0)) {
+        snfs_http_fail(batch, error);
+        return;
+      }
+      retried = true;
+    }
+  }
+}
+
+// requests that change nothing on the server, the rest may not run twice
+static bool snfs_http_idempotent(enum snfs_op op) {
+  switch (op) {
+    case SNFS_OP_RPC_SNAPSHOT:
+    case SNFS_OP_RPC_LOOKUP:
+    case SNFS_OP_RPC_GETATTR:
+    case SNFS_OP_RPC_CHILDREN:
+    case SNFS_OP_RPC_READ:
+      return true;
+    default:
+      return false;
+  }
+}
+
+// Drains the pool queue, up to SNFS_HTTP_PIPELINE_DEPTH requests per connection at a time.
+// A request that is not idempotent makes a batch of its own.
+static void snfs_http_pipe_work(struct work_struct* work) {
+  struct snfs_http_pipe* pipe = container_of(work, struct snfs_http_pipe, work);
+  struct snfs_http_pool* pool = pipe->pool;
+
+  for (;;) {
+    LIST_HEAD(batch);
+    spin_lock(&pool->lock);
+    for (int n = 0; n < SNFS_HTTP_PIPELINE_DEPTH && !list_empty(&pool->queue); n++) {
+      struct snfs_http_req* req = list_first_entry(&pool->queue, struct snfs_http_req, node);
+      if (!req->idempotent && n != 0) {
+        break;
+      }
+      list_move_tail(&req->node, &batch);
+      if (!req->idempotent) {
+        break;
+      }
+    }
+    spin_unlock(&pool->lock);
+    if (list_empty(&batch)) {
+      return;
+    }
+    snfs_http_run(pool, &batch);
+  }
+}
+
+void snfs_http_submit(struct snfs_http_pool* pool, struct snfs_http_req* req) {
+  init_completion(&req->completion);
+  req->metrics = pool->metrics;
+  req->start = ktime_get_ns();
+  spin_lock(&pool->lock);
+  list_add_tail(&req->node, &pool->queue);
+  spin_unlock(&pool->lock);
+  // a busy worker gets to it after its batch, spreading the kicks lets idle ones help
+  unsigned int next = atomic_inc_return(&pool->next_pipe) % pool->size;
+  queue_work(pool->wq, &pool->pipes[next].work);
+}
+
+int64_t snfs_http_wait(struct snfs_http_req* req) {
+  wait_for_completion(&req->completion);
+  return req->result;
+}
+
+static int snfs_http_req_vbuild(
+    struct snfs_http_req* req,
+    const char* verb,
     const char* token,
     const char* method,
+    const struct kvec* body,
+    size_t nbody,
     char* response_buffer,
     size_t buffer_size,
     size_t arg_size,
-    ...
+    va_list args
 ) {
-  struct socket* sock;
-  int64_t error;
-
-  error = sock_create_kern(&init_net, AF_INET, SOCK_STREAM, IPPROTO_TCP, &sock);
-  if (error < 0) {
-    return -1;
+  size_t body_size = 0;
+  for (size_t i = 0; i < nbody; i++) {
+    body_size += body[i].iov_len;
   }
 
-  struct sockaddr_in s_addr = {
-      .sin_family = AF_INET,
-      .sin_addr = {.s_addr = in_aton(SERVER_IP)},
-      .sin_port = htons(SERVER_PORT)
-  };
-
-  error = kernel_connect(sock, (struct sockaddr*)&s_addr, sizeof(struct sockaddr_in), 0);
+  int error = fill_request(&req->head, verb, token, method, body_size, arg_size, args);
   if (error != 0) {
-    sock_release(sock);
-    return -2;
+    return error;
   }
 
-  struct kvec kvec;
+  // the body goes out straight from the caller's memory
+  req->payload = body;
+  req->npayload = nbody;
+  req->request_size = req->head.iov_len + body_size;
+  req->response_buffer = response_buffer;
+  req->buffer_size = buffer_size;
+  req->has_body = false;
+  req->done = NULL;
+  req->op = snfs_metrics_rpc(method);
+  req->idempotent = snfs_http_idempotent(req->op);
+  req->sent = false;
+  return 0;
+}
+
+int snfs_http_req_get(
+    struct snfs_http_req* req,
+    const char* token,
+    const char* method,
+    char* response_buffer,
+    size_t buffer_size,
+    size_t arg_size,
+    ...
+) {
   va_list args;
   va_start(args, arg_size);
-  error = fill_request(&kvec, token, method, arg_size, args);
+  int error = snfs_http_req_vbuild(
+      req, "GET", token, method, NULL, 0, response_buffer, buffer_size, arg_size, args
+  );
   va_end(args);
+  return error;
+}
 
+int snfs_http_req_post(
+    struct snfs_http_req* req,
+    const char* token,
+    const char* method,
+    const struct kvec* body,
+    size_t nbody,
+    char* response_buffer,
+    size_t buffer_size,
+    size_t arg_size,
+    ...
+) {
+  va_list args;
+  va_start(args, arg_size);
+  int error = snfs_http_req_vbuild(
+      req, "POST", token, method, body, nbody, response_buffer, buffer_size, arg_size, args
+  );
+  va_end(args);
+  return error;
+}
+
+void snfs_http_req_into(struct snfs_http_req* req, const struct iov_iter* dst) {
+  req->body = *dst;
+  req->has_body = true;
+}
+
+int64_t snfs_http_call(
+    struct snfs_http_pool* pool,
+    const char* token,
+    const char* method,
+    char* response_buffer,
+    size_t buffer_size,
+    size_t arg_size,
+    ...
+) {
+  struct snfs_http_req req;
+  va_list args;
+  va_start(args, arg_size);
+  int error = snfs_http_req_vbuild(
+      &req, "GET", token, method, NULL, 0, response_buffer, buffer_size, arg_size, args
+  );
+  va_end(args);
   if (error != 0) {
-    kernel_sock_shutdown(sock, SHUT_RDWR);
-    sock_release(sock);
     return error;
   }
 
-  struct msghdr msg;
-  memset(&msg, 0, sizeof(struct msghdr));
+  snfs_http_submit(pool, &req);
+  return snfs_http_wait(&req);
+}
 
-  error = kernel_sendmsg(sock, &msg, &kvec, 1, kvec.iov_len);
-  kfree(kvec.iov_base);
+int64_t snfs_http_call_into(
+    struct snfs_http_pool* pool,
+    const char* token,
+    const char* method,
+    char* response_buffer,
+    size_t buffer_size,
+    const struct kvec* dst,
+    size_t ndst,
+    size_t arg_size,
+    ...
+) {
+  struct snfs_http_req req;
+  va_list args;
+  va_start(args, arg_size);
+  int error = snfs_http_req_vbuild(
+      &req, "GET", token, method, NULL, 0, response_buffer, buffer_size, arg_size, args
+  );
+  va_end(args);
+  if (error != 0) {
+    return error;
+  }
 
-  if (error < 0) {
-    kernel_sock_shutdown(sock, SHUT_RDWR);
-    sock_release(sock);
-    return -3;
+  size_t dst_size = 0;
+  for (size_t i = 0; i < ndst; i++) {
+    dst_size += dst[i].iov_len;
   }
+  struct iov_iter body;
+  iov_iter_kvec(&body, ITER_DEST, dst, ndst, dst_size);
+  snfs_http_req_into(&req, &body);
+  snfs_http_submit(pool, &req);
+  return snfs_http_wait(&req);
+}
 
-  size_t raw_buffer_size = buffer_size + 1024;  // add 1KB for HTTP headers
-  char* raw_response_buffer = kmalloc(raw_buffer_size, GFP_KERNEL);
-  if (raw_response_buffer == 0) {
-    kernel_sock_shutdown(sock, SHUT_RDWR);
-    sock_release(sock);
-    return -ENOMEM;
+int64_t snfs_http_post(
+    struct snfs_http_pool* pool,
+    const char* token,
+    const char* method,
+    const struct kvec* body,
+    size_t nbody,
+    char* response_buffer,
+    size_t buffer_size,
+    size_t arg_size,
+    ...
+) {
+  struct snfs_http_req req;
+  va_list args;
+  va_start(args, arg_size);
+  int error = snfs_http_req_vbuild(
+      &req, "POST", token, method, body, nbody, response_buffer, buffer_size, arg_size, args
+  );
+  va_end(args);
+  if (error != 0) {
+    return error;
   }
-  int read_bytes = receive_all(sock, raw_response_buffer, raw_buffer_size);
 
-  kernel_sock_shutdown(sock, SHUT_RDWR);
-  sock_release(sock);
+  snfs_http_submit(pool, &req);
+  return snfs_http_wait(&req);
+}
+
+void snfs_http_batch_init(struct snfs_http_batch* batch, bool atomic) {
+  memset(batch, 0, sizeof(*batch));
+  batch->atomic = atomic;
+}
 
-  if (read_bytes < 0) {
-    kfree(raw_response_buffer);
-    return -4;
+void snfs_http_batch_reset(struct snfs_http_batch* batch) {
+  batch->size = 0;
+  batch->count = 0;
+}
+
+void snfs_http_batch_destroy(struct snfs_http_batch* batch) {
+  kfree(batch->body);
+  snfs_http_batch_init(batch, batch->atomic);
+}
+
+int snfs_http_batch_add(struct snfs_http_batch* batch, const char* method, size_t arg_size, ...) {
+  size_t need = batch->size + sizeof(__le32) + SNFS_HTTP_BATCH_OP_SZ;
+  if (need > batch->capacity) {
+    size_t capacity = max(need, 2 * batch->capacity);
+    char* body = krealloc(batch->body, capacity, GFP_KERNEL);
+    if (body == NULL) {
+      return -ENOMEM;
+    }
+    batch->body = body;
+    batch->capacity = capacity;
+  }
+
+  char* op = batch->body + batch->size + sizeof(__le32);
+  size_t len = scnprintf(op, SNFS_HTTP_BATCH_OP_SZ, "%s", method);
+  va_list args;
+  va_start(args, arg_size);
+  for (size_t i = 0; i < arg_size; i++) {
+    const char* key = va_arg(args, char*);
+    const char* value = va_arg(args, char*);
+    len += scnprintf(
+        op + len, SNFS_HTTP_BATCH_OP_SZ - len, "%c%s=%s", i == 0 ? '?' : '&', key, value
+    );
+  }
+  va_end(args);
+  if (len >= SNFS_HTTP_BATCH_OP_SZ - 1) {
+    return -E2BIG;
   }
 
-  error = parse_http_response(raw_response_buffer, read_bytes, response_buffer, buffer_size);
+  put_unaligned_le32(len, batch->body + batch->size);
+  batch->size += sizeof(__le32) + len;
+  batch->count++;
+  return 0;
+}
 
-  kfree(raw_response_buffer);
-  return error;
+int64_t snfs_http_batch_call(
+    struct snfs_http_pool* pool,
+    const char* token,
+    const struct snfs_http_batch* batch,
+    char* response_buffer,
+    size_t buffer_size
+) {
+  struct kvec body = {.iov_base = batch->body, .iov_len = batch->size};
+  return snfs_http_post(
+      pool,
+      token,
+      "batch",
+      &body,
+      1,
+      response_buffer,
+      buffer_size,
+      1,
+      "atomic",
+      batch->atomic ? "true" : "false"
+  );
 }
 
 void encode(const char* src, char* dst) {
@@ -1,10 +1,127 @@
 #ifndef SNFS_HTTP_H
 #define SNFS_HTTP_H
 
+#include <linux/completion.h>
 #include <linux/inet.h>
+#include <linux/list.h>
 #include <linux/net.h>
+#include <linux/semaphore.h>
+#include <linux/spinlock.h>
+#include <linux/uio.h>
+#include <linux/workqueue.h>
+
+#include "metrics.h"
+
+#define SNFS_HTTP_POOL_DEFAULT_SZ 4
+
+/* Idle connections older than this are closed instead of reused, so we never
+ * race the server's own keep-alive timeout (20s for Tomcat). */
+#define SNFS_HTTP_IDLE_TIMEOUT (15 * HZ)
+#define SNFS_HTTP_IO_TIMEOUT (30 * HZ)
+
+/* Socket reads that are not received straight into the caller's memory land here */
+#define SNFS_HTTP_RBUF_SZ 4096
+
+struct snfs_http_conn {
+  struct list_head node; /* in snfs_http_pool.idle */
+  struct socket* sock;
+  unsigned long last_used;
+  size_t rpos; /* rbuf up to rpos is parsed, up to rlen it is what the next response starts with */
+  size_t rlen;
+  char rbuf[SNFS_HTTP_RBUF_SZ];
+};
+
+/* Requests a connection carries before the first response is read. Only those that change
+ * nothing on the server are pipelined, any other one goes on a connection by itself. */
+#define SNFS_HTTP_PIPELINE_DEPTH 8
+
+struct snfs_http_pool;
+
+/* Worker that drains the pool queue over one connection at a time */
+struct snfs_http_pipe {
+  struct work_struct work;
+  struct snfs_http_pool* pool;
+};
+
+/* Per-mount pool of HTTP/1.1 keep-alive connections to the server */
+struct snfs_http_pool {
+  struct sockaddr_in addr;
+  struct list_head idle;  /* list of snfs_http_conn */
+  struct list_head queue; /* submitted snfs_http_req, oldest first */
+  spinlock_t lock;
+  struct semaphore slots; /* bounds the number of open connections */
+  unsigned int size;
+  struct workqueue_struct* wq;
+  struct snfs_http_pipe* pipes; /* one per connection */
+  atomic_t next_pipe;
+  struct snfs_metrics* metrics; /* where RPCs are counted, may be NULL */
+};
+
+struct snfs_http_req;
+typedef void (*snfs_http_done_t)(struct snfs_http_req* req);
+
+/* One request in flight, the memory it points at is the caller's until it completes */
+struct snfs_http_req {
+  struct list_head node;      /* in snfs_http_pool.queue or a pipe's batch */
+  struct kvec head;           /* request line and headers, from the head pool */
+  const struct kvec* payload; /* sent as they are after head */
+  size_t npayload;
+  size_t request_size;
+  char* response_buffer;
+  size_t buffer_size;
+  struct iov_iter body; /* where the response past buffer_size goes, if has_body */
+  bool has_body;
+  int64_t result; /* what snfs_http_call would have returned */
+  enum snfs_op op; /* the method as metrics know it */
+  bool idempotent; /* safe to pipeline and to send again */
+  bool sent;       /* some of it may have reached the server */
+  struct snfs_metrics* metrics;
+  u64 start; /* ktime_get_ns at submission */
+  /* called from the RPC workqueue once result is set, so it must not wait on other
+   * requests itself; without it use snfs_http_wait */
+  snfs_http_done_t done;
+  struct completion completion;
+};
+
+/* Request heads kept in reserve, so RPCs go on when memory is short */
+#define SNFS_HTTP_MIN_HEADS (2 * SNFS_HTTP_PIPELINE_DEPTH)
+
+int snfs_http_caches_init(void);
+void snfs_http_caches_destroy(void);
+
+int snfs_http_pool_init(
+    struct snfs_http_pool* pool, unsigned int size, const struct sockaddr_in* addr
+);
+void snfs_http_pool_destroy(struct snfs_http_pool* pool);
+
+int snfs_http_req_get(
+    struct snfs_http_req* req,
+    const char* token,
+    const char* method,
+    char* response_buffer,
+    size_t buffer_size,
+    size_t arg_size,
+    ...
+);
+/* The kvecs of body are not copied, they have to stay put until completion as well */
+int snfs_http_req_post(
+    struct snfs_http_req* req,
+    const char* token,
+    const char* method,
+    const struct kvec* body,
+    size_t nbody,
+    char* response_buffer,
+    size_t buffer_size,
+    size_t arg_size,
+    ...
+);
+/* dst is an ITER_DEST iterator over memory that stays put until completion */
+void snfs_http_req_into(struct snfs_http_req* req, const struct iov_iter* dst);
+void snfs_http_submit(struct snfs_http_pool* pool, struct snfs_http_req* req);
+int64_t snfs_http_wait(struct snfs_http_req* req);
 
 int64_t snfs_http_call(
+    struct snfs_http_pool* pool,
     const char* token,
     const char* method,
     char* response_buffer,
@@ -13,6 +130,60 @@ int64_t snfs_http_call(
     ...
 );
 
+/* Like snfs_http_call, but the response past its first buffer_size bytes is received
+ * straight into dst. Returns the full response length, dst gets the difference. */
+int64_t snfs_http_call_into(
+    struct snfs_http_pool* pool,
+    const char* token,
+    const char* method,
+    char* response_buffer,
+    size_t buffer_size,
+    const struct kvec* dst,
+    size_t ndst,
+    size_t arg_size,
+    ...
+);
+
+/* Sends the kvecs of body as an application/octet-stream POST without copying them */
+int64_t snfs_http_post(
+    struct snfs_http_pool* pool,
+    const char* token,
+    const char* method,
+    const struct kvec* body,
+    size_t nbody,
+    char* response_buffer,
+    size_t buffer_size,
+    size_t arg_size,
+    ...
+);
+
+/* Metadata ops collected for one POST /batch. Each goes into the body as a le32 length and
+ * the method with its arguments the way a GET carries them, "remove?dir=2&name=a". The
+ * response is a Msg, the le32 count of ops that ran, then the response of each behind its
+ * le32 length. Atomic batches run in one transaction that the first failing op rolls back,
+ * the Msg is that op's status then. */
+struct snfs_http_batch {
+  char* body;
+  size_t size;
+  size_t capacity;
+  size_t count;
+  bool atomic;
+};
+
+void snfs_http_batch_init(struct snfs_http_batch* batch, bool atomic);
+void snfs_http_batch_reset(struct snfs_http_batch* batch);
+void snfs_http_batch_destroy(struct snfs_http_batch* batch);
+/* Arguments are key and already encoded value pairs, like for snfs_http_call */
+int snfs_http_batch_add(struct snfs_http_batch* batch, const char* method, size_t arg_size, ...);
+/* Sends every op added so far in one round trip, the batch keeps them until reset */
+int64_t snfs_http_batch_call(
+    struct snfs_http_pool* pool,
+    const char* token,
+    const struct snfs_http_batch* batch,
+    char* response_buffer,
+    size_t buffer_size
+);
+
 void encode(const char*, char*);
 
 #endif  // SNFS_HTTP_H
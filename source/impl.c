@@ -1,49 +1,171 @@
 #include "impl.h"
 
+#include <linux/jiffies.h>
 #include <linux/slab.h>
 
 #include "util.h"
 
-static struct snfs_superblock sb;
+static struct kmem_cache* snfs_inode_cachep;
+static struct kmem_cache* snfs_dentry_cachep;
+static struct kmem_cache* snfs_block_cachep;
 
-int snfs_init_sb(void) {
-  sb = (struct snfs_superblock){
-      .inodes = LIST_HEAD_INIT(sb.inodes),
-      .dentries = LIST_HEAD_INIT(sb.dentries),
-      .next_ino = 1,
-  };
-  spin_lock_init(&sb.lock);
-  struct snfs_inode* inode = kzalloc(sizeof(*inode), GFP_KERNEL);
-  if (inode == NULL) {
+static const struct rhashtable_params snfs_names_params = {
+    .key_len = SNFS_NAME_SZ,
+    .key_offset = offsetof(struct snfs_dentry, name),
+    .head_offset = offsetof(struct snfs_dentry, hash),
+    .automatic_shrinking = true,
+};
+
+int snfs_impl_caches_init(void) {
+  snfs_inode_cachep = KMEM_CACHE(snfs_inode, SLAB_RECLAIM_ACCOUNT);
+  snfs_dentry_cachep = KMEM_CACHE(snfs_dentry, SLAB_RECLAIM_ACCOUNT);
+  // blocks are copied to and from whole pages, page alignment keeps them within one
+  snfs_block_cachep = kmem_cache_create("snfs_block", SNFS_BLOCK_SZ, SNFS_BLOCK_SZ, 0, NULL);
+  if (snfs_inode_cachep == NULL || snfs_dentry_cachep == NULL || snfs_block_cachep == NULL) {
+    snfs_impl_caches_destroy();
     return -ENOMEM;
   }
-  inode->refs = 1;
-  inode->no = SNFS_ROOT_NO;
-  inode->type = S_IFDIR;
-  mutex_init(&inode->lock);
-  INIT_LIST_HEAD(&inode->children);
-  list_add(&inode->node, &sb.inodes);
-  sb.root = inode;
   return 0;
 }
 
-int snfs_create_file(struct snfs_dentry* dentry, int type) {
-  struct snfs_inode* inode = kzalloc(sizeof(*inode), GFP_KERNEL);
+void snfs_impl_caches_destroy(void) {
+  // whatever went through call_rcu has to be back first
+  rcu_barrier();
+  kmem_cache_destroy(snfs_block_cachep);
+  kmem_cache_destroy(snfs_dentry_cachep);
+  kmem_cache_destroy(snfs_inode_cachep);
+}
+
+struct snfs_dentry* snfs_alloc_dentry(void) {
+  return kmem_cache_zalloc(snfs_dentry_cachep, GFP_KERNEL);
+}
+
+// only for entries that never made it into a directory, the others go through RCU
+void snfs_free_dentry(struct snfs_dentry* dentry) {
+  kmem_cache_free(snfs_dentry_cachep, dentry);
+}
+
+static void snfs_dentry_free_rcu(struct rcu_head* head) {
+  snfs_free_dentry(container_of(head, struct snfs_dentry, rcu));
+}
+
+static void snfs_inode_free_rcu(struct rcu_head* head) {
+  kmem_cache_free(snfs_inode_cachep, container_of(head, struct snfs_inode, rcu));
+}
+
+// a new inode with one link, in the table of sb
+static struct snfs_inode* snfs_new_inode(struct snfs_superblock* sb, ino_t no, int type) {
+  struct snfs_inode* inode = kmem_cache_zalloc(snfs_inode_cachep, GFP_KERNEL);
   if (inode == NULL) {
-    return -ENOMEM;
+    return ERR_PTR(-ENOMEM);
   }
+  inode->sb = sb;
+  refcount_set(&inode->count, 1);
   inode->refs = 1;
-  inode->no = sb.next_ino++;
+  inode->no = no;
   inode->type = type;
   mutex_init(&inode->lock);
-  INIT_LIST_HEAD(&inode->children);
-  spin_lock(&sb.lock);
-  list_add(&inode->node, &sb.inodes);
-  spin_unlock(&sb.lock);
+  init_rwsem(&inode->data_lock);
+  INIT_LIST_HEAD(&inode->dirty);
+  xa_init(&inode->blocks);
+  if (S_ISDIR(type)) {
+    xa_init_flags(&inode->cookies, XA_FLAGS_ALLOC);
+    int status = rhashtable_init(&inode->names, &snfs_names_params);
+    if (status < 0) {
+      kmem_cache_free(snfs_inode_cachep, inode);
+      return ERR_PTR(status);
+    }
+  }
+  int status = xa_err(xa_store(&sb->inodes, inode->no, inode, GFP_KERNEL));
+  if (status < 0) {
+    if (S_ISDIR(type)) {
+      rhashtable_destroy(&inode->names);
+    }
+    kmem_cache_free(snfs_inode_cachep, inode);
+    return ERR_PTR(status);
+  }
+  return inode;
+}
+
+int snfs_init_sb(struct snfs_superblock* sb) {
+  *sb = (struct snfs_superblock){
+      .next_ino = SNFS_ROOT_NO + 1,
+  };
+  xa_init(&sb->inodes);
+  struct snfs_inode* root = snfs_new_inode(sb, SNFS_ROOT_NO, S_IFDIR);
+  if (IS_ERR(root)) {
+    xa_destroy(&sb->inodes);
+    return PTR_ERR(root);
+  }
+  sb->root = root;
+  return 0;
+}
+
+// The VFS has let go of every inode by now, so the table holds the last references.
+// Entries are freed through their directories, inodes through the table.
+void snfs_destroy_sb(struct snfs_superblock* sb) {
+  unsigned long no;
+  struct snfs_inode* inode;
+  xa_for_each(&sb->inodes, no, inode) {
+    if (S_ISDIR(inode->type)) {
+      unsigned long cookie;
+      struct snfs_dentry* entry;
+      xa_for_each(&inode->cookies, cookie, entry) {
+        snfs_free_dentry(entry);
+      }
+    }
+  }
+  xa_for_each(&sb->inodes, no, inode) {
+    xa_erase(&sb->inodes, no);
+    snfs_inode_put(inode);
+  }
+  xa_destroy(&sb->inodes);
+  sb->root = NULL;
+}
+
+int snfs_create_file(struct snfs_superblock* sb, struct snfs_dentry* dentry, int type) {
+  struct snfs_inode* inode = snfs_new_inode(sb, sb->next_ino++, type);
+  if (IS_ERR(inode)) {
+    return PTR_ERR(inode);
+  }
   dentry->inode = inode;
   return 0;
 }
 
+// frees every block starting with index first
+static void snfs_free_blocks(struct snfs_inode* file, unsigned long first) {
+  unsigned long index;
+  char* block;
+  xa_for_each_start(&file->blocks, index, block, first) {
+    xa_erase(&file->blocks, index);
+    kmem_cache_free(snfs_block_cachep, block);
+  }
+}
+
+void snfs_inode_get(struct snfs_inode* inode) {
+  refcount_inc(&inode->count);
+}
+
+void snfs_inode_put(struct snfs_inode* inode) {
+  if (refcount_dec_and_test(&inode->count)) {
+    if (S_ISDIR(inode->type)) {
+      rhashtable_destroy(&inode->names);
+      xa_destroy(&inode->cookies);
+    }
+    snfs_free_blocks(inode, 0);
+    xa_destroy(&inode->blocks);
+    call_rcu(&inode->rcu, snfs_inode_free_rcu);
+  }
+}
+
+// drops the table reference once the last link is gone
+void snfs_drop_link(struct snfs_inode* inode) {
+  if (--inode->refs == 0) {
+    xa_erase(&inode->sb->inodes, inode->no);
+    snfs_inode_put(inode);
+  }
+}
+
 int snfs_hard_link(struct snfs_inode* inode, struct snfs_dentry* new) {
   if (S_ISDIR(inode->type)) {
     return -EISDIR;
@@ -58,106 +180,276 @@ int snfs_remove_file(struct snfs_dentry* file, struct snfs_inode* from) {
     return -EISDIR;
   }
   struct snfs_inode* snfsi = file->inode;
-  snfsi->refs--;
-  if (snfsi == 0) {
-    spin_lock(&sb.lock);
-    list_del(&snfsi->node);
-    spin_unlock(&sb.lock);
-    kfree(snfsi);
-  }
   mutex_lock(&from->lock);
-  list_del(&file->node);
+  rhashtable_remove_fast(&from->names, &file->hash, snfs_names_params);
+  xa_erase(&from->cookies, file->cookie);
   mutex_unlock(&from->lock);
-  kfree(file);
+  call_rcu(&file->rcu, snfs_dentry_free_rcu);
+  snfs_drop_link(snfsi);
   return 0;
 }
 
-int snfs_remove_dir(struct snfs_dentry* dir, struct snfs_inode* from) {
-  if (!S_ISDIR(dir->inode->type)) {
+int snfs_check_rmdir(struct snfs_inode* dir) {
+  if (!S_ISDIR(dir->type)) {
     return -ENOTDIR;
   }
-  struct snfs_inode* snfsi = dir->inode;
-  mutex_lock(&snfsi->lock);
-  if (!list_empty(&snfsi->children)) {
-    mutex_unlock(&snfsi->lock);
-    return -ENOTEMPTY;
-  }
-  mutex_unlock(&snfsi->lock);
+  mutex_lock(&dir->lock);
+  bool empty = xa_empty(&dir->cookies);
+  mutex_unlock(&dir->lock);
+  return empty ? 0 : -ENOTEMPTY;
+}
 
-  snfsi->refs--;
-  if (snfsi == 0) {
-    spin_lock(&sb.lock);
-    list_del(&snfsi->node);
-    spin_unlock(&sb.lock);
-    kfree(snfsi);
+int snfs_remove_dir(struct snfs_dentry* dir, struct snfs_inode* from) {
+  int status = snfs_check_rmdir(dir->inode);
+  if (status < 0) {
+    return status;
   }
+  struct snfs_inode* snfsi = dir->inode;
+
   mutex_lock(&from->lock);
-  list_del(&dir->node);
+  rhashtable_remove_fast(&from->names, &dir->hash, snfs_names_params);
+  xa_erase(&from->cookies, dir->cookie);
   mutex_unlock(&from->lock);
-  kfree(dir);
+  call_rcu(&dir->rcu, snfs_dentry_free_rcu);
+  snfs_drop_link(snfsi);
   return 0;
 }
 
-struct snfs_inode* snfs_inode_by_ino(ino_t ino) {
+// returned inode is referenced, release it with snfs_inode_put
+struct snfs_inode* snfs_inode_by_ino(struct snfs_superblock* sb, ino_t ino) {
   struct snfs_inode* inode;
-  spin_lock(&sb.lock);
-  list_for_each_entry(inode, &sb.inodes, node) {
-    if (inode->no == ino) {
-      spin_unlock(&sb.lock);
-      return inode;
-    }
+  rcu_read_lock();
+  inode = xa_load(&sb->inodes, ino);
+  // a concurrent unlink may be dropping the last reference
+  if (inode != NULL && !refcount_inc_not_zero(&inode->count)) {
+    inode = NULL;
   }
-  spin_unlock(&sb.lock);
-  return NULL;
+  rcu_read_unlock();
+  return inode;
 }
 
+// Lock-free, the entry stays valid under rcu_read_lock or while the caller
+// holds the directory's i_rwsem, which excludes removal
 struct snfs_dentry* snfs_find_child(struct snfs_inode* inode, const char* name) {
-  struct snfs_dentry* dentry;
-  mutex_lock(&inode->lock);
-  list_for_each_entry(dentry, &inode->children, node) {
-    if (strcmp(dentry->name, name) == 0) {
-      mutex_unlock(&inode->lock);
-      return dentry;
-    }
-  }
-  mutex_unlock(&inode->lock);
-  return NULL;
+  char key[SNFS_NAME_SZ] = {0};
+  strscpy(key, name, SNFS_NAME_SZ);
+  return rhashtable_lookup_fast(&inode->names, key, snfs_names_params);
 }
 
-void snfs_add_child(struct snfs_inode* dir, struct snfs_dentry* entry) {
+// -EEXIST if the name is taken. Cookies are handed out cyclically, so one freed by an
+// unlink is not reused right away and a readdir in progress never sees an entry twice.
+int snfs_add_child(struct snfs_inode* dir, struct snfs_dentry* entry) {
   mutex_lock(&dir->lock);
-  list_add(&entry->node, &dir->children);
+  int status = rhashtable_lookup_insert_fast(&dir->names, &entry->hash, snfs_names_params);
+  if (status == 0) {
+    status = xa_alloc_cyclic(
+        &dir->cookies,
+        &entry->cookie,
+        entry,
+        XA_LIMIT(SNFS_FIRST_COOKIE, INT_MAX),
+        &dir->next_cookie,
+        GFP_KERNEL
+    );
+    if (status < 0) {
+      rhashtable_remove_fast(&dir->names, &entry->hash, snfs_names_params);
+    } else {
+      status = 0;  // 1 only says the cookies wrapped
+    }
+  }
   mutex_unlock(&dir->lock);
+  return status;
+}
+
+// Makes a local entry for one the server has, its data is fetched on demand
+struct snfs_dentry* snfs_add_remote_child(
+    struct snfs_inode* dir, const char* name, int type, ino_t remote, loff_t size
+) {
+  struct snfs_dentry* entry = snfs_alloc_dentry();
+  if (entry == NULL) {
+    return ERR_PTR(-ENOMEM);
+  }
+  strscpy(entry->name, name, SNFS_NAME_SZ);
+  int status = snfs_create_file(dir->sb, entry, type);
+  if (status < 0) {
+    snfs_free_dentry(entry);
+    return ERR_PTR(status);
+  }
+  entry->inode->remote = remote;
+  entry->inode->size = size;
+  entry->inode->fetch_size = size;
+  entry->inode->attr_time = jiffies;
+  status = snfs_add_child(dir, entry);
+  if (status < 0) {
+    snfs_drop_link(entry->inode);
+    snfs_free_dentry(entry);
+    return ERR_PTR(status);
+  }
+  return entry;
 }
 
-int snfs_set_buf_sz(struct snfs_inode* file, size_t newsz) {
+// caller holds file->data_lock for writing
+int snfs_set_size(struct snfs_inode* file, loff_t newsz) {
   if (S_ISDIR(file->type)) {
     return -EISDIR;
   }
-  char* new_buf = kzalloc(newsz, GFP_KERNEL);  // GFP_KERNEL isn't the right choice here probably
-  if (new_buf == NULL) {
-    return -ENOMEM;
-  }
 
-  if (file->buf != NULL) {
-    memcpy(new_buf, file->buf, min(newsz, file->bufsz));
+  if (newsz < file->size) {
+    unsigned long last = newsz >> SNFS_BLOCK_SHIFT;
+    size_t tail = newsz & (SNFS_BLOCK_SZ - 1);
+    char* block = xa_load(&file->blocks, last);
+    // a later extension must read zeroes, not the truncated bytes
+    if (block != NULL && tail != 0) {
+      memset(block + tail, 0, SNFS_BLOCK_SZ - tail);
+    }
+    snfs_free_blocks(file, tail != 0 ? last + 1 : last);
+    // the server still has the old tail, it must not come back on extension
+    file->fetch_size = min(file->fetch_size, newsz);
   }
-  kfree(file->buf);
-  file->buf = new_buf;
-  file->bufsz = newsz;
+  file->size = newsz;
   return 0;
 }
 
-static void snfs_dump_recursion(struct snfs_inode* f) {
-  struct snfs_dentry* dentry;
-  list_for_each_entry(dentry, &f->children, node) {
-    LOG("Inode %d name: %s isdir %d", dentry->inode->no, dentry->name, S_ISDIR(dentry->inode->type)
-    );
-    if (dentry->inode->type == S_IFDIR)
-      snfs_dump_recursion(dentry->inode);
+// Caller holds file->data_lock for writing and has nothing dirty, the server has the file
+// at newsz.
+// Growing drops the old last block too, it only has zeroes where the server has data.
+void snfs_set_remote_size(struct snfs_inode* file, loff_t newsz) {
+  if (newsz < file->size) {
+    snfs_set_size(file, newsz);
+  } else {
+    snfs_free_blocks(file, file->size >> SNFS_BLOCK_SHIFT);
+    file->size = newsz;
+  }
+  file->fetch_size = newsz;
+}
+
+// Caller holds file->data_lock for writing. Remembers that the server has to be cut to
+// newsz before it gets any data written after it.
+void snfs_mark_resized(struct snfs_inode* file, loff_t newsz) {
+  file->resized_to = file->resized ? min(file->resized_to, newsz) : newsz;
+  file->resized = true;
+}
+
+// snfs_set_size for a size set here, writeback takes it to the server
+int snfs_truncate(struct snfs_inode* file, loff_t newsz) {
+  int status = snfs_set_size(file, newsz);
+  if (status == 0 && file->remote != 0) {
+    snfs_mark_resized(file, newsz);
+  }
+  return status;
+}
+
+// How many of len bytes at pos have to come from the server instead of reading as a hole,
+// 0 if the block is held here. The server may still have bytes past a local truncation,
+// those read as zeroes.
+size_t snfs_block_remote(struct snfs_inode* file, loff_t pos, size_t len) {
+  size_t remote = 0;
+  down_read(&file->data_lock);
+  if (pos < file->fetch_size && xa_load(&file->blocks, pos >> SNFS_BLOCK_SHIFT) == NULL) {
+    remote = min_t(loff_t, len, file->fetch_size - pos);
+  }
+  up_read(&file->data_lock);
+  return remote;
+}
+
+// returns how many of len bytes at pos are within the file, holes read as zeroes
+size_t snfs_read_data(struct snfs_inode* file, char* dst, loff_t pos, size_t len) {
+  size_t toread = 0;
+  down_read(&file->data_lock);
+  loff_t size = READ_ONCE(file->size);
+  if (pos < size) {
+    toread = min_t(loff_t, size - pos, len);
+  }
+  for (size_t done = 0; done < toread;) {
+    size_t off = (pos + done) & (SNFS_BLOCK_SZ - 1);
+    size_t chunk = min(toread - done, SNFS_BLOCK_SZ - off);
+    char* block = xa_load(&file->blocks, (pos + done) >> SNFS_BLOCK_SHIFT);
+    if (block != NULL) {
+      memcpy(dst + done, block + off, chunk);
+    } else {
+      memset(dst + done, 0, chunk);
+    }
+    done += chunk;
+  }
+  up_read(&file->data_lock);
+  return toread;
+}
+
+// writers share data_lock, so the size only ever moves up to the furthest end written
+static void snfs_grow_size(struct snfs_inode* file, loff_t end) {
+  loff_t size = READ_ONCE(file->size);
+  while (size < end && !try_cmpxchg(&file->size, &size, end)) {
+  }
+}
+
+// Only the blocks in the range are touched, missing ones are allocated. Writers to other
+// ranges go on at the same time, a block two of them miss is allocated by the first one.
+int snfs_write_data(struct snfs_inode* file, const char* src, loff_t pos, size_t len) {
+  int status = 0;
+  size_t done = 0;
+  down_read(&file->data_lock);
+  while (done < len) {
+    unsigned long index = (pos + done) >> SNFS_BLOCK_SHIFT;
+    size_t off = (pos + done) & (SNFS_BLOCK_SZ - 1);
+    size_t chunk = min(len - done, SNFS_BLOCK_SZ - off);
+    char* block = xa_load(&file->blocks, index);
+    if (block == NULL) {
+      block = kmem_cache_zalloc(snfs_block_cachep, GFP_KERNEL);
+      if (block == NULL) {
+        status = -ENOMEM;
+        break;
+      }
+      status = xa_insert(&file->blocks, index, block, GFP_KERNEL);
+      if (status == -EBUSY) {
+        kmem_cache_free(snfs_block_cachep, block);
+        block = xa_load(&file->blocks, index);
+        status = 0;
+      } else if (status < 0) {
+        kmem_cache_free(snfs_block_cachep, block);
+        break;
+      }
+    }
+    memcpy(block + off, src + done, chunk);
+    done += chunk;
+    // A flush that took the block before the copy sends it again once it is marked, and
+    // the size has to cover the copy by then.
+    snfs_grow_size(file, pos + done);
+    xa_set_mark(&file->blocks, index, SNFS_BLOCK_DIRTY);
   }
+  up_read(&file->data_lock);
+  return status;
 }
 
-void snfs_dump(void) {
-  snfs_dump_recursion(sb.root);
+// Caller holds file->data_lock, which keeps the blocks in place while vecs point at them.
+// Takes up to max consecutive dirty blocks starting with the first one at or after
+// *index, clears their marks and returns how many there are.
+size_t snfs_dirty_run(
+    struct snfs_inode* file, unsigned long* index, struct kvec* vecs, size_t max
+) {
+  char* block = xa_find(&file->blocks, index, ULONG_MAX, SNFS_BLOCK_DIRTY);
+  size_t n = 0;
+  while (block != NULL && n < max) {
+    loff_t pos = (loff_t)(*index + n) << SNFS_BLOCK_SHIFT;
+    if (pos >= READ_ONCE(file->size)) {
+      break;
+    }
+    xa_clear_mark(&file->blocks, *index + n, SNFS_BLOCK_DIRTY);
+    // taken once the mark is gone, writers grow the size before they mark
+    loff_t size = READ_ONCE(file->size);
+    vecs[n].iov_base = block;
+    vecs[n].iov_len = min_t(loff_t, SNFS_BLOCK_SZ, size - pos);
+    n++;
+    block = xa_get_mark(&file->blocks, *index + n, SNFS_BLOCK_DIRTY)
+                ? xa_load(&file->blocks, *index + n)
+                : NULL;
+  }
+  return n;
+}
+
+// puts back the marks of a run that did not make it to the server, caller holds file->data_lock
+void snfs_redirty_run(struct snfs_inode* file, unsigned long index, size_t n) {
+  for (size_t i = 0; i < n; i++) {
+    if (xa_load(&file->blocks, index + i) != NULL) {
+      xa_set_mark(&file->blocks, index + i, SNFS_BLOCK_DIRTY);
+    }
+  }
 }
@@ -3,43 +3,100 @@
 
 #include <linux/fs.h>
 #include <linux/list.h>
+#include <linux/rcupdate.h>
+#include <linux/refcount.h>
+#include <linux/rhashtable.h>
+#include <linux/rwsem.h>
+#include <linux/uio.h>
+#include <linux/xarray.h>
 
 #define SNFS_ROOT_NO 0
 #define SNFS_NAME_SZ 16
+/* Readdir cookies, 0 and 1 are taken by the dots */
+#define SNFS_FIRST_COOKIE 2
+
+/* File data is kept in blocks of this size, holes are never allocated */
+#define SNFS_BLOCK_SHIFT PAGE_SHIFT
+#define SNFS_BLOCK_SZ (1UL << SNFS_BLOCK_SHIFT)
+/* Set on blocks the server has not seen yet */
+#define SNFS_BLOCK_DIRTY XA_MARK_0
+
+struct snfs_superblock;
 
 struct snfs_inode {
-  struct list_head node; /* list of snfs_inode */
-  _Atomic size_t refs;
+  struct snfs_superblock* sb; /* the mount it belongs to */
+  refcount_t count; /* pins the memory: one for the inode table plus one per snfs_inode_by_ino */
+  struct rcu_head rcu;
+  _Atomic size_t refs; /* links */
   ino_t no;
+  ino_t remote; /* inode number on the server, 0 while the inode is local only */
   int type;
-  struct list_head children; /* list of snfs_dentry */
-  char* buf;
-  size_t bufsz;
-  struct mutex lock;
+  struct rhashtable names;   /* snfs_dentry by name, directories only */
+  struct xarray cookies;     /* snfs_dentry by readdir cookie, directories only */
+  u32 next_cookie;
+  bool listed; /* has every entry the server has, a name missing here needs no lookup */
+  unsigned long listed_time; /* jiffies when listed was set, it expires like a negative dentry */
+  /* Guards blocks, size and fetch_size of a file. Reading and writing blocks share it, the
+   * page cache keeps them to disjoint ranges, and only truncation takes it exclusively. */
+  struct rw_semaphore data_lock;
+  struct xarray blocks; /* file data by block index */
+  loff_t size;          /* grows without the exclusive lock, see snfs_grow_size */
+  loff_t fetch_size; /* below this, blocks not held here are read from the server */
+  unsigned long attr_time; /* jiffies when size was last taken from the server */
+  bool resized;            /* size was set here and the server has not been told yet */
+  loff_t resized_to;       /* smallest size set since then, the server is cut to it first */
+  unsigned int pushes;     /* odd while writeback sends the file, moves with every push */
+  struct mutex lock;       /* entries of a directory */
+  struct list_head dirty; /* in snfs_wb.dirty */
+  unsigned long dirtied;  /* jiffies when it got on the dirty list */
+  size_t dirty_bytes;
 };
 
 struct snfs_dentry {
-  struct list_head node;
-  char name[SNFS_NAME_SZ];
+  struct rhash_head hash;
+  u32 cookie; /* readdir position, stays put while the entry exists */
+  struct rcu_head rcu;
+  char name[SNFS_NAME_SZ]; /* zero padded, used as the hash key */
   struct snfs_inode* inode;
 };
 
+/* Local tree of one mount, lives in snfs_sb_info */
 struct snfs_superblock {
-  struct list_head inodes;
-  struct list_head dentries;
+  struct xarray inodes; /* snfs_inode by no, looked up under RCU */
   struct snfs_inode* root;
-  spinlock_t lock;
   _Atomic ino_t next_ino;
 };
 
-int snfs_init_sb(void);
-int snfs_create_file(struct snfs_dentry* dentry, int type);
-struct snfs_inode* snfs_inode_by_ino(ino_t ino);
+int snfs_impl_caches_init(void);
+void snfs_impl_caches_destroy(void);
+int snfs_init_sb(struct snfs_superblock* sb);
+/* Frees the whole tree, nothing else may use it any more */
+void snfs_destroy_sb(struct snfs_superblock* sb);
+struct snfs_dentry* snfs_alloc_dentry(void);
+void snfs_free_dentry(struct snfs_dentry* dentry);
+int snfs_create_file(struct snfs_superblock* sb, struct snfs_dentry* dentry, int type);
+struct snfs_inode* snfs_inode_by_ino(struct snfs_superblock* sb, ino_t ino);
+void snfs_inode_get(struct snfs_inode* inode);
+void snfs_inode_put(struct snfs_inode* inode);
+void snfs_drop_link(struct snfs_inode* inode);
 struct snfs_dentry* snfs_find_child(struct snfs_inode* inode, const char* name);
-void snfs_add_child(struct snfs_inode* dir, struct snfs_dentry* entry);
+int snfs_add_child(struct snfs_inode* dir, struct snfs_dentry* entry);
+struct snfs_dentry* snfs_add_remote_child(
+    struct snfs_inode* dir, const char* name, int type, ino_t remote, loff_t size
+);
 int snfs_remove_file(struct snfs_dentry* file, struct snfs_inode* from);
+int snfs_check_rmdir(struct snfs_inode* dir);
 int snfs_remove_dir(struct snfs_dentry* dir, struct snfs_inode* from);
-int snfs_set_buf_sz(struct snfs_inode* file, size_t newsz);
-void snfs_dump(void);
+int snfs_set_size(struct snfs_inode* file, loff_t newsz);
+void snfs_set_remote_size(struct snfs_inode* file, loff_t newsz);
+int snfs_truncate(struct snfs_inode* file, loff_t newsz);
+void snfs_mark_resized(struct snfs_inode* file, loff_t newsz);
+size_t snfs_block_remote(struct snfs_inode* file, loff_t pos, size_t len);
+size_t snfs_read_data(struct snfs_inode* file, char* dst, loff_t pos, size_t len);
+int snfs_write_data(struct snfs_inode* file, const char* src, loff_t pos, size_t len);
+size_t snfs_dirty_run(
+    struct snfs_inode* file, unsigned long* index, struct kvec* vecs, size_t max
+);
+void snfs_redirty_run(struct snfs_inode* file, unsigned long index, size_t n);
 int snfs_hard_link(struct snfs_inode* inode, struct snfs_dentry* new);
 #endif  // __FSMOD_SOURCE_IMPL_H_s
\ No newline at end of file
@@ -0,0 +1,142 @@
+#include "metrics.h"
+
+#include <linux/debugfs.h>
+#include <linux/math64.h>
+#include <linux/seq_file.h>
+#include <linux/string.h>
+
+#include "util.h"
+
+#define CREATE_TRACE_POINTS
+#include "snfs_trace.h"
+
+static const char* const snfs_op_names[SNFS_OP_NR] = {
+    [SNFS_OP_LOOKUP] = "lookup",
+    [SNFS_OP_CREATE] = "create",
+    [SNFS_OP_MKDIR] = "mkdir",
+    [SNFS_OP_UNLINK] = "unlink",
+    [SNFS_OP_RMDIR] = "rmdir",
+    [SNFS_OP_READDIR] = "readdir",
+    [SNFS_OP_GETATTR] = "getattr",
+    [SNFS_OP_SETATTR] = "setattr",
+    [SNFS_OP_FSYNC] = "fsync",
+    [SNFS_OP_READ] = "read",
+    [SNFS_OP_WRITE] = "write",
+    [SNFS_OP_READ_FOLIO] = "read_folio",
+    [SNFS_OP_READAHEAD] = "readahead",
+    [SNFS_OP_WRITEPAGES] = "writepages",
+    [SNFS_OP_RPC_MOUNT] = "rpc_mount",
+    [SNFS_OP_RPC_SNAPSHOT] = "rpc_snapshot",
+    [SNFS_OP_RPC_LOOKUP] = "rpc_lookup",
+    [SNFS_OP_RPC_GETATTR] = "rpc_getattr",
+    [SNFS_OP_RPC_CREATE] = "rpc_create",
+    [SNFS_OP_RPC_REMOVE] = "rpc_remove",
+    [SNFS_OP_RPC_CHILDREN] = "rpc_children",
+    [SNFS_OP_RPC_READ] = "rpc_read",
+    [SNFS_OP_RPC_WRITE] = "rpc_write",
+    [SNFS_OP_RPC_TRUNCATE] = "rpc_truncate",
+    [SNFS_OP_RPC_BATCH] = "rpc_batch",
+    [SNFS_OP_RPC_OTHER] = "rpc_other",
+};
+
+static struct dentry* snfs_debugfs_root;
+
+// debugfs being off or failing is not worth failing the module for
+void snfs_metrics_module_init(void) {
+  snfs_debugfs_root = debugfs_create_dir(MODULE_NAME, NULL);
+}
+
+void snfs_metrics_module_exit(void) {
+  debugfs_remove(snfs_debugfs_root);
+}
+
+// one line per op that ran, the histogram columns are upper bounds in microseconds
+static int snfs_metrics_show(struct seq_file* m, void* v) {
+  struct snfs_metrics* metrics = m->private;
+
+  seq_printf(m, "%-13s %10s %8s %14s %14s", "op", "count", "errors", "bytes", "total_us");
+  for (int i = 0; i < SNFS_METRICS_BUCKETS - 1; i++) {
+    seq_printf(m, " <%llu", 1ULL << i);
+  }
+  seq_puts(m, " more\n");
+
+  for (int op = 0; op < SNFS_OP_NR; op++) {
+    struct snfs_op_stats sum = {0};
+    int cpu;
+    for_each_possible_cpu(cpu) {
+      struct snfs_op_stats* stats = per_cpu_ptr(metrics->ops, cpu) + op;
+      sum.count += stats->count;
+      sum.errors += stats->errors;
+      sum.bytes += stats->bytes;
+      sum.ns += stats->ns;
+      for (int i = 0; i < SNFS_METRICS_BUCKETS; i++) {
+        sum.hist[i] += stats->hist[i];
+      }
+    }
+    if (sum.count == 0) {
+      continue;
+    }
+    seq_printf(
+        m,
+        "%-13s %10llu %8llu %14llu %14llu",
+        snfs_op_names[op],
+        sum.count,
+        sum.errors,
+        sum.bytes,
+        div_u64(sum.ns, NSEC_PER_USEC)
+    );
+    for (int i = 0; i < SNFS_METRICS_BUCKETS; i++) {
+      seq_printf(m, " %llu", sum.hist[i]);
+    }
+    seq_putc(m, '\n');
+  }
+  return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(snfs_metrics);
+
+int snfs_metrics_init(struct snfs_metrics* metrics, dev_t dev) {
+  char name[24];
+
+  metrics->ops = __alloc_percpu(
+      SNFS_OP_NR * sizeof(struct snfs_op_stats), __alignof__(struct snfs_op_stats)
+  );
+  if (metrics->ops == NULL) {
+    return -ENOMEM;
+  }
+  snprintf(name, sizeof(name), "%u:%u", MAJOR(dev), MINOR(dev));
+  metrics->dir = debugfs_create_dir(name, snfs_debugfs_root);
+  debugfs_create_file("stats", 0444, metrics->dir, metrics, &snfs_metrics_fops);
+  return 0;
+}
+
+void snfs_metrics_destroy(struct snfs_metrics* metrics) {
+  // readers of stats are waited for here, the counters go after
+  debugfs_remove(metrics->dir);
+  free_percpu(metrics->ops);
+}
+
+enum snfs_op snfs_metrics_rpc(const char* method) {
+  for (int op = SNFS_OP_RPC_MOUNT; op < SNFS_OP_RPC_OTHER; op++) {
+    if (strcmp(snfs_op_names[op] + 4, method) == 0) {
+      return op;
+    }
+  }
+  return SNFS_OP_RPC_OTHER;
+}
+
+void snfs_metrics_record(
+    struct snfs_metrics* metrics, enum snfs_op op, u64 start, long status, size_t bytes
+) {
+  u64 ns = ktime_get_ns() - start;
+  u64 us = div_u64(ns, NSEC_PER_USEC);
+  int bucket = us == 0 ? 0 : min(fls64(us), SNFS_METRICS_BUCKETS - 1);
+
+  trace_snfs_op_done(snfs_op_names[op], status, bytes, ns);
+  this_cpu_inc(metrics->ops[op].count);
+  if (status < 0) {
+    this_cpu_inc(metrics->ops[op].errors);
+  }
+  this_cpu_add(metrics->ops[op].bytes, bytes);
+  this_cpu_add(metrics->ops[op].ns, ns);
+  this_cpu_inc(metrics->ops[op].hist[bucket]);
+}
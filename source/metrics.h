@@ -0,0 +1,67 @@
+#ifndef __FSMOD_SOURCE_METRICS_H_
+#define __FSMOD_SOURCE_METRICS_H_
+
+#include <linux/dcache.h>
+#include <linux/ktime.h>
+#include <linux/percpu.h>
+#include <linux/types.h>
+
+/* What gets counted: VFS ops first, then one per RPC method */
+enum snfs_op {
+  SNFS_OP_LOOKUP,
+  SNFS_OP_CREATE,
+  SNFS_OP_MKDIR,
+  SNFS_OP_UNLINK,
+  SNFS_OP_RMDIR,
+  SNFS_OP_READDIR,
+  SNFS_OP_GETATTR,
+  SNFS_OP_SETATTR,
+  SNFS_OP_FSYNC,
+  SNFS_OP_READ,
+  SNFS_OP_WRITE,
+  SNFS_OP_READ_FOLIO,
+  SNFS_OP_READAHEAD,
+  SNFS_OP_WRITEPAGES,
+  SNFS_OP_RPC_MOUNT,
+  SNFS_OP_RPC_SNAPSHOT,
+  SNFS_OP_RPC_LOOKUP,
+  SNFS_OP_RPC_GETATTR,
+  SNFS_OP_RPC_CREATE,
+  SNFS_OP_RPC_REMOVE,
+  SNFS_OP_RPC_CHILDREN,
+  SNFS_OP_RPC_READ,
+  SNFS_OP_RPC_WRITE,
+  SNFS_OP_RPC_TRUNCATE,
+  SNFS_OP_RPC_BATCH,
+  SNFS_OP_RPC_OTHER,
+  SNFS_OP_NR,
+};
+
+/* Bucket i counts latencies under 2^i microseconds, the last one everything above */
+#define SNFS_METRICS_BUCKETS 24
+
+struct snfs_op_stats {
+  u64 count;
+  u64 errors;
+  u64 bytes;
+  u64 ns;
+  u64 hist[SNFS_METRICS_BUCKETS];
+};
+
+/* Per-mount counters, summed over CPUs only when debugfs is read */
+struct snfs_metrics {
+  struct snfs_op_stats __percpu* ops; /* SNFS_OP_NR of them */
+  struct dentry* dir;                 /* snfs/<dev> in debugfs */
+};
+
+void snfs_metrics_module_init(void);
+void snfs_metrics_module_exit(void);
+int snfs_metrics_init(struct snfs_metrics* metrics, dev_t dev);
+void snfs_metrics_destroy(struct snfs_metrics* metrics);
+enum snfs_op snfs_metrics_rpc(const char* method);
+/* status below 0 counts as an error, start is ktime_get_ns at the beginning of the op */
+void snfs_metrics_record(
+    struct snfs_metrics* metrics, enum snfs_op op, u64 start, long status, size_t bytes
+);
+
+#endif  // __FSMOD_SOURCE_METRICS_H_
@@ -2,6 +2,10 @@
 #include <linux/module.h>
 #include <linux/printk.h>
 
+#include "http.h"
+#include "impl.h"
+#include "metrics.h"
+#include "ops.h"
 #include "util.h"
 #include "vfs.h"
 
@@ -17,14 +21,43 @@ static struct file_system_type snfs_fs_type = {
 
 static int __init snfs_init(void) {
   LOG("SNFS joined the kernel\n");
-  register_filesystem(&snfs_fs_type);
+  int status = snfs_impl_caches_init();
+  if (status < 0) {
+    return status;
+  }
+  status = snfs_ops_caches_init();
+  if (status < 0) {
+    goto destroy_impl;
+  }
+  status = snfs_http_caches_init();
+  if (status < 0) {
+    goto destroy_ops;
+  }
+  snfs_metrics_module_init();
+  status = register_filesystem(&snfs_fs_type);
+  if (status < 0) {
+    goto destroy_metrics;
+  }
   LOG("Registered fs\n");
   return 0;
+
+destroy_metrics:
+  snfs_metrics_module_exit();
+  snfs_http_caches_destroy();
+destroy_ops:
+  snfs_ops_caches_destroy();
+destroy_impl:
+  snfs_impl_caches_destroy();
+  return status;
 }
 
 static void __exit snfs_exit(void) {
   unregister_filesystem(&snfs_fs_type);
   LOG("Unregistered fs\n");
+  snfs_metrics_module_exit();
+  snfs_http_caches_destroy();
+  snfs_ops_caches_destroy();
+  snfs_impl_caches_destroy();
   LOG("SNFS left the kernel\n");
 }
 
@@ -1,6 +1,16 @@
 #include "ops.h"
 
+#include <linux/bvec.h>
+#include <linux/highmem.h>
+#include <linux/jiffies.h>
+#include <linux/moduleparam.h>
+#include <linux/pagemap.h>
+#include <linux/slab.h>
+#include <linux/splice.h>
+#include <linux/writeback.h>
+
 #include "impl.h"
+#include "remote.h"
 #include "util.h"
 #include "vfs.h"
 
@@ -21,10 +31,55 @@ int snfs_rmdir(struct inode* parent_inode, struct dentry* child_dentry);
 int snfs_mkdir(
     struct mnt_idmap* map, struct inode* parent_inode, struct dentry* child_dentry, umode_t mode
 );
+int snfs_setattr(struct mnt_idmap* map, struct dentry* dentry, struct iattr* attr);
+int snfs_getattr(
+    struct mnt_idmap* map,
+    const struct path* path,
+    struct kstat* stat,
+    u32 request_mask,
+    unsigned int flags
+);
+static int snfs_d_revalidate(struct dentry* dentry, unsigned int flags);
 
-ssize_t snfs_read(struct file* filp, char* __user buffer, size_t len, loff_t* offset);
-ssize_t snfs_write(struct file* filp, const char* __user buffer, size_t len, loff_t* offset);
 int snfs_fsync(struct file*, loff_t, loff_t, int);
+static int snfs_dir_fsync(struct file*, loff_t, loff_t, int);
+int snfs_file_open(struct inode* inode, struct file* filp);
+ssize_t snfs_read_iter(struct kiocb* iocb, struct iov_iter* to);
+ssize_t snfs_write_iter(struct kiocb* iocb, struct iov_iter* from);
+ssize_t snfs_splice_read(
+    struct file* in, loff_t* ppos, struct pipe_inode_info* pipe, size_t len, unsigned int flags
+);
+
+int snfs_read_folio(struct file* filp, struct folio* folio);
+void snfs_readahead(struct readahead_control* rac);
+int snfs_write_begin(
+    struct file* filp,
+    struct address_space* mapping,
+    loff_t pos,
+    unsigned len,
+    struct page** pagep,
+    void** fsdata
+);
+int snfs_write_end(
+    struct file* filp,
+    struct address_space* mapping,
+    loff_t pos,
+    unsigned len,
+    unsigned copied,
+    struct page* page,
+    void* fsdata
+);
+int snfs_writepages(struct address_space* mapping, struct writeback_control* wbc);
+
+static unsigned int dentry_ttl_ms = 3000;
+module_param(dentry_ttl_ms, uint, 0644);
+MODULE_PARM_DESC(
+    dentry_ttl_ms, "How long a name missing on the server, or a listed directory, is trusted"
+);
+
+static unsigned int attr_ttl_ms = 3000;
+module_param(attr_ttl_ms, uint, 0644);
+MODULE_PARM_DESC(attr_ttl_ms, "How long a file size taken from the server is trusted");
 
 const struct inode_operations snfs_inode_ops = {
     .lookup = snfs_lookup,
@@ -32,70 +87,204 @@ const struct inode_operations snfs_inode_ops = {
     .unlink = snfs_unlink,
     .mkdir = snfs_mkdir,
     .rmdir = snfs_rmdir,
+    .setattr = snfs_setattr,
+    .getattr = snfs_getattr,
+};
+
+const struct dentry_operations snfs_dentry_ops = {
+    .d_revalidate = snfs_d_revalidate,
 };
 
 const struct file_operations snfs_file_ops = {
-    .iterate_shared = snfs_iterate_shared,
-    .write = snfs_write,
-    .read = snfs_read,
+    .open = snfs_file_open,
+    .llseek = generic_file_llseek,
+    .read_iter = snfs_read_iter,
+    .write_iter = snfs_write_iter,
+    .splice_read = snfs_splice_read,
+    .splice_write = iter_file_splice_write,  // lands in snfs_write_iter
+    .mmap = generic_file_mmap,               // faults go through snfs_aops
     .fsync = snfs_fsync
 };
 
+const struct file_operations snfs_dir_ops = {
+    .llseek = generic_file_llseek,
+    .read = generic_read_dir,
+    .iterate_shared = snfs_iterate_shared,
+    .fsync = snfs_dir_fsync,  // creates are written through, removes are queued
+};
+
+/* snfs_inode contents are the backing store, the page cache sits in front of it */
+const struct address_space_operations snfs_aops = {
+    .read_folio = snfs_read_folio,
+    .readahead = snfs_readahead,
+    .write_begin = snfs_write_begin,
+    .write_end = snfs_write_end,
+    .writepages = snfs_writepages,
+    .dirty_folio = filemap_dirty_folio,
+    .migrate_folio = filemap_migrate_folio,
+};
+
+// start is ktime_get_ns from when the op was entered
+static void snfs_op_done(
+    struct super_block* sb, enum snfs_op op, u64 start, long status, size_t bytes
+) {
+  snfs_metrics_record(&snfs_sb(sb)->metrics, op, start, status, bytes);
+}
+
+/* Dentry ops */
+
+// Entries in the local tree stay valid, only a negative dentry for a name the server did not
+// have goes stale. d_time holds jiffies of that lookup, so this works in RCU walk as well.
+static int snfs_d_revalidate(struct dentry* dentry, unsigned int flags) {
+  if (d_really_is_positive(dentry)) {
+    return 1;
+  }
+  return time_before(jiffies, dentry->d_time + msecs_to_jiffies(dentry_ttl_ms));
+}
+
 /* Inode ops */
-struct dentry* snfs_lookup(
-    struct inode* parent_inode, struct dentry* child_dentry, unsigned int flag
+
+// A listing only says what the server had then, other clients may have added names since
+static bool snfs_listed(struct snfs_inode* diri) {
+  return diri->listed && time_before(jiffies, diri->listed_time + msecs_to_jiffies(dentry_ttl_ms));
+}
+
+// Returns NULL if the server does not have name either. Any other failure is returned, a
+// negative dentry for it would hide a name the server has until it expires.
+static struct snfs_dentry* snfs_lookup_remote(
+    struct super_block* sb, struct snfs_inode* diri, const char* name
 ) {
+  struct snfs_sb_info* info = snfs_sb(sb);
+  struct snfs_remote_inode remote;
+  // a remove of this very name may still be queued
+  int status = snfs_wb_flush_removes(info);
+  if (status == 0) {
+    status = snfs_remote_lookup(info, diri->remote, name, &remote);
+  }
+  if (status == -ENOENT) {
+    return NULL;
+  }
+  if (status < 0) {
+    LOG("Remote lookup of %s failed: %d\n", name, status);
+    return ERR_PTR(status);
+  }
+  return snfs_add_remote_child(diri, name, remote.type, remote.no, remote.size);
+}
+
+static struct dentry* snfs_do_lookup(struct inode* parent_inode, struct dentry* child_dentry) {
   ino_t dirno = parent_inode->i_ino;
   const char* name = child_dentry->d_name.name;
 
-  struct snfs_inode* snfsi = snfs_inode_by_ino(dirno);
+  struct snfs_inode* snfsi = snfs_inode_by_ino(&snfs_sb(parent_inode->i_sb)->fs, dirno);
   if (snfsi == NULL) {
     d_add(child_dentry, NULL);
     return NULL;
   }
   struct snfs_dentry* snfsd = snfs_find_child(snfsi, name);
+  // names too long to keep locally cannot have been created through us either
+  if (snfsd == NULL && snfsi->remote != 0 && !snfs_listed(snfsi) &&
+      child_dentry->d_name.len < SNFS_NAME_SZ) {
+    snfsd = snfs_lookup_remote(parent_inode->i_sb, snfsi, name);
+    if (IS_ERR(snfsd)) {
+      snfs_inode_put(snfsi);
+      return ERR_CAST(snfsd);
+    }
+  }
+  child_dentry->d_time = jiffies;
   if (snfsd == NULL) {
+    snfs_inode_put(snfsi);
     d_add(child_dentry, NULL);
     return NULL;
   }
   struct snfs_inode* found = snfsd->inode;
   struct inode* inode = snfs_get_vfs_inode(parent_inode->i_sb, NULL, found->type, found->no);
-  atomic_inc(&inode->i_count);
+  snfs_inode_put(snfsi);
   d_add(child_dentry, inode);
   return NULL;
 }
 
+struct dentry* snfs_lookup(
+    struct inode* parent_inode, struct dentry* child_dentry, unsigned int flag
+) {
+  u64 start = ktime_get_ns();
+  struct dentry* ret = snfs_do_lookup(parent_inode, child_dentry);
+  snfs_op_done(parent_inode->i_sb, SNFS_OP_LOOKUP, start, PTR_ERR_OR_ZERO(ret), 0);
+  return ret;
+}
+
 static int snfs_create_dentry(struct inode* parent_inode, struct dentry* child_dentry, int ftype) {
   ino_t dirino = parent_inode->i_ino;
   const char* name = child_dentry->d_name.name;
 
-  if (strlen(name) > SNFS_NAME_SZ) {
-    return -ENOANO;
+  if (strlen(name) >= SNFS_NAME_SZ) {
+    return -ENAMETOOLONG;
   }
-  LOG("Searching for inode %lu\n", dirino);
-  struct snfs_inode* diri = snfs_inode_by_ino(dirino);
+  struct snfs_inode* diri = snfs_inode_by_ino(&snfs_sb(parent_inode->i_sb)->fs, dirino);
   if (diri == NULL) {
     return -ENODATA;
   }
-  LOG("Found inode %lu\n", dirino);
-  struct snfs_dentry* snfsentry = kzalloc(sizeof(*snfsentry), GFP_KERNEL);
-  strscpy(snfsentry->name, name, SNFS_NAME_SZ);
+  struct snfs_sb_info* info = snfs_sb(parent_inode->i_sb);
+  ino_t dirremote = diri->remote;
+  struct snfs_remote_inode remote = {0};
+  int status;
+  if (dirremote != 0) {
+    status = snfs_wb_flush_removes(info);
+    if (status == 0) {
+      status = snfs_remote_create(info, dirremote, name, ftype, &remote);
+    }
+    if (status < 0) {
+      snfs_inode_put(diri);
+      return status;
+    }
+  }
+  struct snfs_dentry* snfsentry = snfs_alloc_dentry();
   if (snfsentry == NULL) {
-    return -ENOMEM;
+    snfs_inode_put(diri);
+    status = -ENOMEM;
+    goto undo_remote;
   }
-  LOG("Allocated entry %s\n", snfsentry->name);
-  int status = snfs_create_file(snfsentry, ftype);
+  strscpy(snfsentry->name, name, SNFS_NAME_SZ);
+  status = snfs_create_file(&info->fs, snfsentry, ftype);
   if (status < 0) {
-    kfree(snfsentry);
-    return status;
+    snfs_inode_put(diri);
+    snfs_free_dentry(snfsentry);
+    goto undo_remote;
+  }
+  snfsentry->inode->remote = remote.no;
+  snfsentry->inode->attr_time = jiffies;
+  // nobody could have put anything into it on the server yet
+  snfsentry->inode->listed = S_ISDIR(ftype);
+  snfsentry->inode->listed_time = jiffies;
+  status = snfs_add_child(diri, snfsentry);
+  if (status < 0) {
+    snfs_inode_put(diri);
+    snfs_drop_link(snfsentry->inode);
+    snfs_free_dentry(snfsentry);
+    goto undo_remote;
   }
-  LOG("Created file with entry %s\n", snfsentry->name);
-  snfs_add_child(diri, snfsentry);
-  LOG("Added entry %s as child\n", snfsentry->name);
   struct inode* inode = snfs_get_vfs_inode(parent_inode->i_sb, NULL, ftype, snfsentry->inode->no);
+  if (inode == NULL) {
+    // the name is not instantiated yet, nobody can have looked it up or created under it
+    if (S_ISDIR(ftype)) {
+      snfs_remove_dir(snfsentry, diri);
+    } else {
+      snfs_remove_file(snfsentry, diri);
+    }
+    if (remote.no != 0) {
+      snfs_wb_remove(info, dirremote, name);
+    }
+    snfs_inode_put(diri);
+    return -ENOMEM;
+  }
+  snfs_inode_put(diri);
   d_instantiate(child_dentry, inode);
-  LOG("Added inode to childentry \n");
   return 0;
+
+undo_remote:
+  if (remote.no != 0) {
+    snfs_remote_remove(info, dirremote, name);
+  }
+  return status;
 }
 
 int snfs_create(
@@ -105,145 +294,639 @@ int snfs_create(
     umode_t mode,
     bool b
 ) {
-  LOG("[snfs_create]");
-  return snfs_create_dentry(parent_inode, child_dentry, S_IFREG);
+  u64 start = ktime_get_ns();
+  int status = snfs_create_dentry(parent_inode, child_dentry, S_IFREG);
+  snfs_op_done(parent_inode->i_sb, SNFS_OP_CREATE, start, status, 0);
+  return status;
 }
 
 int snfs_mkdir(
     struct mnt_idmap* map, struct inode* parent_inode, struct dentry* child_dentry, umode_t mode
 ) {
-  LOG("[snfs_mkdir]");
-  return snfs_create_dentry(parent_inode, child_dentry, S_IFDIR);
+  u64 start = ktime_get_ns();
+  int status = snfs_create_dentry(parent_inode, child_dentry, S_IFDIR);
+  snfs_op_done(parent_inode->i_sb, SNFS_OP_MKDIR, start, status, 0);
+  return status;
 }
 
-int snfs_unlink(struct inode* parent_inode, struct dentry* child_dentry) {
+static int snfs_remove_remote(struct super_block* sb, struct snfs_inode* diri, const char* name) {
+  if (diri->remote == 0) {
+    return 0;
+  }
+  // rm -rf costs a round trip per batch rather than per entry
+  return snfs_wb_remove(snfs_sb(sb), diri->remote, name);
+}
+
+static int snfs_do_unlink(struct inode* parent_inode, struct dentry* child_dentry) {
   const char* name = child_dentry->d_name.name;
   ino_t dirino = parent_inode->i_ino;
-  LOG("[snfs_unlink]");
-  LOG("Searching for inode %lu\n", dirino);
-  struct snfs_inode* diri = snfs_inode_by_ino(dirino);
+  struct snfs_inode* diri = snfs_inode_by_ino(&snfs_sb(parent_inode->i_sb)->fs, dirino);
   if (diri == NULL) {
     return -ENODATA;
   }
-  LOG("Found inode %lu\n", dirino);
-  LOG("Searching %s \n", name);
   struct snfs_dentry* snfsd = snfs_find_child(diri, name);
   if (snfsd == NULL) {
+    snfs_inode_put(diri);
     return -ENODATA;
   }
-  return snfs_remove_file(snfsd, diri);
+  if (S_ISDIR(snfsd->inode->type)) {
+    snfs_inode_put(diri);
+    return -EISDIR;
+  }
+  int status = snfs_remove_remote(parent_inode->i_sb, diri, name);
+  if (status < 0) {
+    snfs_inode_put(diri);
+    return status;
+  }
+  status = snfs_remove_file(snfsd, diri);
+  snfs_inode_put(diri);
+  if (status == 0) {
+    // lets the inode and its page cache go once the last user is done
+    drop_nlink(d_inode(child_dentry));
+  }
+  return status;
 }
 
-int snfs_rmdir(struct inode* parent_inode, struct dentry* child_dentry) {
+int snfs_unlink(struct inode* parent_inode, struct dentry* child_dentry) {
+  u64 start = ktime_get_ns();
+  int status = snfs_do_unlink(parent_inode, child_dentry);
+  snfs_op_done(parent_inode->i_sb, SNFS_OP_UNLINK, start, status, 0);
+  return status;
+}
+
+static int snfs_do_rmdir(struct inode* parent_inode, struct dentry* child_dentry) {
   const char* name = child_dentry->d_name.name;
   ino_t dirino = parent_inode->i_ino;
-  LOG("[snfs_rmdir]");
-  LOG("Searching for inode %lu\n", dirino);
-  struct snfs_inode* diri = snfs_inode_by_ino(dirino);
+  struct snfs_inode* diri = snfs_inode_by_ino(&snfs_sb(parent_inode->i_sb)->fs, dirino);
   if (diri == NULL) {
     return -ENODATA;
   }
-  LOG("Found inode %lu\n", dirino);
-  LOG("Searching %s \n", name);
   struct snfs_dentry* snfsd = snfs_find_child(diri, name);
   if (snfsd == NULL) {
+    snfs_inode_put(diri);
     return -ENODATA;
   }
-  return snfs_remove_dir(snfsd, diri);
+  // the server does not check for children, so that is done here first
+  int status = snfs_check_rmdir(snfsd->inode);
+  if (status == 0) {
+    status = snfs_remove_remote(parent_inode->i_sb, diri, name);
+  }
+  if (status < 0) {
+    snfs_inode_put(diri);
+    return status;
+  }
+  status = snfs_remove_dir(snfsd, diri);
+  snfs_inode_put(diri);
+  if (status == 0) {
+    clear_nlink(d_inode(child_dentry));
+  }
+  return status;
 }
 
-int snfs_iterate_shared(struct file* filp, struct dir_context* ctx) {
-  snfs_dump();
+int snfs_rmdir(struct inode* parent_inode, struct dentry* child_dentry) {
+  u64 start = ktime_get_ns();
+  int status = snfs_do_rmdir(parent_inode, child_dentry);
+  snfs_op_done(parent_inode->i_sb, SNFS_OP_RMDIR, start, status, 0);
+  return status;
+}
 
-  struct dentry* dentry = filp->f_path.dentry;
-  struct inode* inode = dentry->d_inode;
-  ino_t dirino = inode->i_ino;
-  int cur = 0;
+// Pages through the server's entries of diri into the local index, those it has already
+// stay as they are. Once all pages are in the directory is listed until dentry_ttl_ms passes.
+static int snfs_list_remote(struct super_block* sb, struct snfs_inode* diri) {
+  struct snfs_sb_info* info = snfs_sb(sb);
+  struct snfs_remote_inode remote;
+  char name[SNFS_NAME_SZ];
+  u64 after = 0;
 
-  LOG("[snfs_iterate]");
-  LOG("Searching for inode %lu\n", dirino);
-  struct snfs_inode* diri = snfs_inode_by_ino(dirino);
-  if (diri == NULL) {
-    return -ENODATA;
+  // removed names must not come back from the server
+  int status = snfs_wb_flush_removes(info);
+  if (status < 0) {
+    return status;
   }
-  LOG("Found inode %lu\n", dirino);
-  if (!S_ISDIR(inode->i_mode)) {
-    return -ENOTDIR;
+  struct snfs_remote_children* page = kmalloc(sizeof(*page), GFP_KERNEL);
+  if (page == NULL) {
+    return -ENOMEM;
   }
-  LOG("Emitting nodes\n");
+  do {
+    status = snfs_remote_children(info, diri->remote, after, page);
+    if (status < 0) {
+      break;
+    }
+    after = page->next;
+    while ((status = snfs_remote_children_entry(page, name, &remote)) > 0) {
+      if (snfs_find_child(diri, name) != NULL) {
+        continue;
+      }
+      struct snfs_dentry* entry =
+          snfs_add_remote_child(diri, name, remote.type, remote.no, remote.size);
+      // a lookup may have just added it
+      if (IS_ERR(entry) && PTR_ERR(entry) != -EEXIST) {
+        status = PTR_ERR(entry);
+        break;
+      }
+    }
+  } while (status == 0 && after != 0);
+  kfree(page);
+  if (status == 0) {
+    diri->listed = true;
+    diri->listed_time = jiffies;
+  }
+  return status;
+}
+
+// ctx->pos is the cookie to resume from, so every call picks up where the last one stopped
+static int snfs_do_iterate(struct file* filp, struct dir_context* ctx) {
+  struct inode* inode = file_inode(filp);
+  struct snfs_inode* diri = inode->i_private;
+  unsigned long cookie;
+  struct snfs_dentry* snfsd;
+
   if (!dir_emit_dots(filp, ctx)) {
     return 0;
   }
-  cur = 2;
-  LOG("Emitted node");
-  struct snfs_dentry* snfsd;
+  // entries only the server knows of are brought in before any is emitted
+  if (diri->remote != 0 && !snfs_listed(diri)) {
+    int status = snfs_list_remote(inode->i_sb, diri);
+    if (status < 0) {
+      return status;
+    }
+  }
+  // entries cannot go away while the lock is held, unlink takes it too
   mutex_lock(&diri->lock);
-  list_for_each_entry(snfsd, &diri->children, node) {
-    LOG("Cur: %d Pos: %lld", cur, ctx->pos);
-    if (cur == ctx->pos) {
-      ctx->pos++;
-      LOG("Emitting %s", snfsd->name);
-      dir_emit(ctx, snfsd->name, SNFS_NAME_SZ, snfsd->inode->no, snfsd->inode->type);
+  xa_for_each_start(&diri->cookies, cookie, snfsd, ctx->pos) {
+    struct snfs_inode* child = snfsd->inode;
+    size_t len = strnlen(snfsd->name, SNFS_NAME_SZ);
+    if (!dir_emit(ctx, snfsd->name, len, child->no, fs_umode_to_dtype(child->type))) {
+      break;
     }
-    cur++;
+    ctx->pos = cookie + 1;
   }
   mutex_unlock(&diri->lock);
   return 0;
 }
 
-ssize_t snfs_read(struct file* filp, char* buffer, size_t len, loff_t* offset) {
-  ino_t fino = filp->f_inode->i_ino;
-  LOG("[snfs_read]");
-  LOG("Searching for inode %lu\n", fino);
-  struct snfs_inode* filei = snfs_inode_by_ino(fino);
-  if (filei == NULL) {
-    return -ENODATA;
+int snfs_iterate_shared(struct file* filp, struct dir_context* ctx) {
+  u64 start = ktime_get_ns();
+  int status = snfs_do_iterate(filp, ctx);
+  snfs_op_done(file_inode(filp)->i_sb, SNFS_OP_READDIR, start, status, 0);
+  return status;
+}
+
+static int snfs_do_setattr(struct mnt_idmap* map, struct dentry* dentry, struct iattr* attr) {
+  struct inode* inode = d_inode(dentry);
+  int status = setattr_prepare(map, dentry, attr);
+  if (status < 0) {
+    return status;
   }
-  LOG("It's not null type is %d", filei->type);
-  if (filei->type == S_IFDIR) {
-    return -EISDIR;
+
+  if ((attr->ia_valid & ATTR_SIZE) && S_ISREG(inode->i_mode)) {
+    struct snfs_inode* filei = inode->i_private;
+    truncate_setsize(inode, attr->ia_size);
+    down_write(&filei->data_lock);
+    status = snfs_truncate(filei, attr->ia_size);
+    up_write(&filei->data_lock);
+    if (status < 0) {
+      return status;
+    }
+    // the new size goes out with the data, fsync and sync_fs wait for it
+    if (filei->remote != 0) {
+      snfs_wb_dirty(snfs_sb(inode->i_sb), filei, 0);
+    }
   }
+  setattr_copy(map, inode, attr);
+  return 0;
+}
+
+int snfs_setattr(struct mnt_idmap* map, struct dentry* dentry, struct iattr* attr) {
+  u64 start = ktime_get_ns();
+  int status = snfs_do_setattr(map, dentry, attr);
+  snfs_op_done(dentry->d_sb, SNFS_OP_SETATTR, start, status, 0);
+  return status;
+}
 
-  if (offset == NULL) {
-    return -1;
+// Takes the size from the server, unless there is a local change it has not seen yet. A
+// push that overlapped the getattr may have landed on either side of it, so its answer
+// is only used if none did.
+static void snfs_refresh_attr(struct inode* inode) {
+  struct snfs_inode* filei = inode->i_private;
+  struct snfs_remote_inode remote;
+  unsigned int pushes = READ_ONCE(filei->pushes);
+
+  // while the server is away what we have is the best there is
+  if (snfs_remote_getattr(snfs_sb(inode->i_sb), filei->remote, &remote) < 0) {
+    return;
+  }
+  inode_lock(inode);
+  down_write(&filei->data_lock);
+  filei->attr_time = jiffies;
+  bool clean = pushes % 2 == 0 && filei->pushes == pushes && !filei->resized &&
+               !xa_marked(&filei->blocks, SNFS_BLOCK_DIRTY) &&
+               !mapping_tagged(inode->i_mapping, PAGECACHE_TAG_DIRTY);
+  loff_t old = filei->size;
+  if (clean && remote.size != old) {
+    snfs_set_remote_size(filei, remote.size);
   }
-  mutex_lock(&filei->lock);
-  size_t toread = min(filei->bufsz - *offset, len);
-  if (copy_to_user((void __user*)buffer, filei->buf + *offset, toread)) {
-    mutex_unlock(&filei->lock);
-    return -EFAULT;
+  up_write(&filei->data_lock);
+  if (clean && remote.size != old) {
+    // the cached last page has zeroes where the server now has data
+    truncate_pagecache(inode, min(old, remote.size) & PAGE_MASK);
+    i_size_write(inode, remote.size);
   }
-  *offset += toread;
-  mutex_unlock(&filei->lock);
-  return toread;
+  inode_unlock(inode);
 }
 
-ssize_t snfs_write(struct file* filp, const char* buffer, size_t len, loff_t* offset) {
-  ino_t dirino = filp->f_inode->i_ino;
-  LOG("[snfs_write]");
-  LOG("Searching for inode %lu\n", dirino);
-  struct snfs_inode* filei = snfs_inode_by_ino(dirino);
-  if (filei == NULL) {
-    return -ENODATA;
+int snfs_getattr(
+    struct mnt_idmap* map,
+    const struct path* path,
+    struct kstat* stat,
+    u32 request_mask,
+    unsigned int flags
+) {
+  struct inode* inode = d_inode(path->dentry);
+  struct snfs_inode* snfsi = inode->i_private;
+  u64 start = ktime_get_ns();
+
+  if (S_ISREG(inode->i_mode) && snfsi->remote != 0 && !(flags & AT_STATX_DONT_SYNC)) {
+    bool expired = time_after(jiffies, snfsi->attr_time + msecs_to_jiffies(attr_ttl_ms));
+    if (expired || (flags & AT_STATX_FORCE_SYNC)) {
+      snfs_refresh_attr(inode);
+    }
   }
-  LOG("Checking for dir %lu\n", dirino);
-  if (S_ISDIR(filei->type))
-    return -EISDIR;
-  LOG("Not dir %lu\n", dirino);
-  mutex_lock(&filei->lock);
+  generic_fillattr(map, request_mask, inode, stat);
+  snfs_op_done(inode->i_sb, SNFS_OP_GETATTR, start, 0, 0);
+  return 0;
+}
+
+static int snfs_do_fsync(struct file* file, loff_t start, loff_t end) {
+  struct inode* inode = file_inode(file);
+  struct snfs_inode* filei = inode->i_private;
 
-  size_t newsz = *offset + len;
-  snfs_set_buf_sz(filei, newsz);
-  int status = copy_from_user(filei->buf + *offset, buffer, len);
-  LOG("Copied from user offset: %d len %d status %d\n", *offset, len, status);
-  mutex_unlock(&filei->lock);
-  filp->f_inode->i_size = newsz;
-  filp->f_inode->i_blkbits = 8;
-  filp->f_inode->i_blocks = newsz;
-  *offset += len;
-  return len;
+  // page cache to blocks, then blocks to the server
+  int status = file_write_and_wait_range(file, start, end);
+  if (status < 0 || filei->remote == 0) {
+    return status;
+  }
+  return snfs_wb_flush_inode(snfs_sb(inode->i_sb), filei);
 }
 
 int snfs_fsync(struct file* file, loff_t start, loff_t end, int datasync) {
+  u64 began = ktime_get_ns();
+  int status = snfs_do_fsync(file, start, end);
+  snfs_op_done(file_inode(file)->i_sb, SNFS_OP_FSYNC, began, status, 0);
+  return status;
+}
+
+// removes are queued for the whole mount, not per directory, so all of them go out
+static int snfs_dir_fsync(struct file* file, loff_t start, loff_t end, int datasync) {
+  struct inode* inode = file_inode(file);
+  struct snfs_inode* diri = inode->i_private;
+  u64 began = ktime_get_ns();
+  int status = 0;
+  if (diri->remote != 0) {
+    status = snfs_wb_flush_removes(snfs_sb(inode->i_sb));
+  }
+  snfs_op_done(inode->i_sb, SNFS_OP_FSYNC, began, status, 0);
+  return status;
+}
+
+// IOCB_NOWAIT I/O is handled in the iter ops, so io_uring and RWF_NOWAIT try it inline first
+int snfs_file_open(struct inode* inode, struct file* filp) {
+  filp->f_mode |= FMODE_NOWAIT;
+  return generic_file_open(inode, filp);
+}
+
+ssize_t snfs_read_iter(struct kiocb* iocb, struct iov_iter* to) {
+  struct inode* inode = file_inode(iocb->ki_filp);
+  struct snfs_inode* filei = inode->i_private;
+  u64 start = ktime_get_ns();
+
+  // a miss would wait for the server, so NOWAIT readers only get what is cached and the
+  // caller retries from a context that may block, which also starts readahead
+  if ((iocb->ki_flags & IOCB_NOWAIT) && filei->remote != 0) {
+    iocb->ki_flags |= IOCB_NOIO;
+  }
+  ssize_t ret = generic_file_read_iter(iocb, to);
+  snfs_op_done(inode->i_sb, SNFS_OP_READ, start, ret, max_t(ssize_t, ret, 0));
+  return ret;
+}
+
+// Whether a write of len bytes at pos has to fetch from the server first. Only folios it
+// covers in part are filled in snfs_write_begin, which are the first and the last one.
+static bool snfs_write_needs_fetch(struct inode* inode, loff_t pos, size_t len) {
+  struct snfs_inode* filei = inode->i_private;
+  loff_t edges[] = {pos, pos + len};
+
+  if (filei->remote == 0) {
+    return false;
+  }
+  for (size_t i = 0; i < ARRAY_SIZE(edges); i++) {
+    if (offset_in_page(edges[i]) == 0) {
+      continue;
+    }
+    struct folio* folio = filemap_get_folio(inode->i_mapping, edges[i] >> PAGE_SHIFT);
+    bool cached = !IS_ERR(folio) && folio_test_uptodate(folio);
+    if (!IS_ERR(folio)) {
+      folio_put(folio);
+    }
+    if (!cached && snfs_block_remote(filei, edges[i] & PAGE_MASK, PAGE_SIZE) != 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// generic_file_write_iter with the NOWAIT checks it leaves to the file system
+static ssize_t snfs_do_write_iter(struct kiocb* iocb, struct iov_iter* from) {
+  struct inode* inode = file_inode(iocb->ki_filp);
+  bool nowait = iocb->ki_flags & IOCB_NOWAIT;
+
+  // a synchronous write ends in a flush to the server
+  if (nowait && (iocb->ki_flags & IOCB_DSYNC)) {
+    return -EAGAIN;
+  }
+  if (nowait) {
+    if (!inode_trylock(inode)) {
+      return -EAGAIN;
+    }
+  } else {
+    inode_lock(inode);
+  }
+  ssize_t ret = generic_write_checks(iocb, from);
+  if (ret > 0 && nowait && snfs_write_needs_fetch(inode, iocb->ki_pos, ret)) {
+    ret = -EAGAIN;
+  }
+  if (ret > 0) {
+    ret = __generic_file_write_iter(iocb, from);
+  }
+  inode_unlock(inode);
+  if (ret > 0) {
+    ret = generic_write_sync(iocb, ret);
+  }
+  return ret;
+}
+
+ssize_t snfs_write_iter(struct kiocb* iocb, struct iov_iter* from) {
+  u64 start = ktime_get_ns();
+  ssize_t ret = snfs_do_write_iter(iocb, from);
+  snfs_op_done(file_inode(iocb->ki_filp)->i_sb, SNFS_OP_WRITE, start, ret, max_t(ssize_t, ret, 0));
+  return ret;
+}
+
+// sendfile and splice out of a file come here, the folios go into the pipe without a copy
+ssize_t snfs_splice_read(
+    struct file* in, loff_t* ppos, struct pipe_inode_info* pipe, size_t len, unsigned int flags
+) {
+  u64 start = ktime_get_ns();
+  ssize_t ret = filemap_splice_read(in, ppos, pipe, len, flags);
+  snfs_op_done(file_inode(in)->i_sb, SNFS_OP_READ, start, ret, max_t(ssize_t, ret, 0));
+  return ret;
+}
+
+/* Address space ops */
+
+// fills the folio from the backing store or the server, zeroes what is past its end
+static int snfs_fill_folio(struct inode* inode, struct folio* folio) {
+  struct snfs_inode* filei = inode->i_private;
+  loff_t pos = folio_pos(folio);
+
+  for (size_t off = 0; off < folio_size(folio); off += PAGE_SIZE) {
+    char* dst = kmap_local_folio(folio, off);
+    ssize_t read;
+    size_t remote = filei->remote != 0 ? snfs_block_remote(filei, pos + off, PAGE_SIZE) : 0;
+    if (remote != 0) {
+      struct kvec vec = {.iov_base = dst, .iov_len = remote};
+      read = snfs_remote_read(snfs_sb(inode->i_sb), filei->remote, pos + off, &vec, 1);
+    } else {
+      read = snfs_read_data(filei, dst, pos + off, PAGE_SIZE);
+    }
+    if (read >= 0) {
+      memset(dst + read, 0, PAGE_SIZE - read);
+    }
+    kunmap_local(dst);
+    if (read < 0) {
+      return read;
+    }
+  }
+  return 0;
+}
+
+int snfs_read_folio(struct file* filp, struct folio* folio) {
+  struct inode* inode = folio->mapping->host;
+  size_t size = folio_size(folio);
+  u64 start = ktime_get_ns();
+  int status = snfs_fill_folio(inode, folio);
+  if (status == 0) {
+    folio_mark_uptodate(folio);
+  }
+  folio_unlock(folio);
+  snfs_op_done(inode->i_sb, SNFS_OP_READ_FOLIO, start, status, status == 0 ? size : 0);
+  return status;
+}
+
+/* Folios per ranged read, 128 KiB with 4 KiB pages */
+#define SNFS_RA_MAX_FOLIOS 32
+
+/* A run of readahead folios that one ranged /read fills in the background */
+struct snfs_ra {
+  struct snfs_remote_read read;
+  unsigned int nfolios;
+  struct folio* folios[SNFS_RA_MAX_FOLIOS];
+  struct bio_vec bvecs[SNFS_RA_MAX_FOLIOS];
+};
+
+static struct kmem_cache* snfs_ra_cachep;
+
+int snfs_ops_caches_init(void) {
+  snfs_ra_cachep = KMEM_CACHE(snfs_ra, 0);
+  return snfs_ra_cachep == NULL ? -ENOMEM : 0;
+}
+
+void snfs_ops_caches_destroy(void) {
+  kmem_cache_destroy(snfs_ra_cachep);
+}
+
+// runs on the RPC workqueue, a folio left not uptodate is retried through read_folio
+static void snfs_ra_done(struct snfs_remote_read* read, ssize_t got) {
+  struct snfs_ra* ra = container_of(read, struct snfs_ra, read);
+  size_t pos = 0;
+
+  for (unsigned int i = 0; i < ra->nfolios; i++) {
+    struct folio* folio = ra->folios[i];
+    size_t size = folio_size(folio);
+    if (got >= 0) {
+      // the server stops at its end of file or the read at fetch_size, the rest reads as zeroes
+      if (got < pos + size) {
+        folio_zero_segment(folio, got > pos ? got - pos : 0, size);
+      }
+      folio_mark_uptodate(folio);
+    }
+    folio_unlock(folio);
+    pos += size;
+  }
+  kmem_cache_free(snfs_ra_cachep, ra);
+}
+
+// only what the server has below fetch_size is read, snfs_ra_done zeroes the rest
+static void snfs_ra_submit(struct inode* inode, struct snfs_ra* ra) {
+  struct snfs_inode* filei = inode->i_private;
+  loff_t pos = folio_pos(ra->folios[0]);
+  struct iov_iter iter;
+  size_t len = 0;
+
+  for (unsigned int i = 0; i < ra->nfolios; i++) {
+    len += ra->bvecs[i].bv_len;
+  }
+  len = snfs_block_remote(filei, pos, len);
+  if (len == 0) {
+    snfs_ra_done(&ra->read, 0);
+    return;
+  }
+  iov_iter_bvec(&iter, ITER_DEST, ra->bvecs, ra->nfolios, len);
+  ra->read.done = snfs_ra_done;
+  int status = snfs_remote_read_submit(snfs_sb(inode->i_sb), &ra->read, filei->remote, pos, &iter);
+  if (status < 0) {
+    snfs_ra_done(&ra->read, status);
+  }
+}
+
+// The kernel tracks sequential access per open file and sizes the window. Folios the
+// server has to provide go out as ranged reads that complete in the background, so the
+// reader only waits on the ones it has caught up with.
+void snfs_readahead(struct readahead_control* rac) {
+  struct inode* inode = rac->mapping->host;
+  struct snfs_inode* filei = inode->i_private;
+  struct snfs_ra* ra = NULL;
+  struct folio* folio;
+  size_t bytes = readahead_length(rac);
+  u64 start = ktime_get_ns();
+
+  while ((folio = readahead_folio(rac)) != NULL) {
+    bool remote = filei->remote != 0 &&
+                  snfs_block_remote(filei, folio_pos(folio), folio_size(folio)) != 0;
+    // folios come in order, a local one ends the run
+    if (!remote && ra != NULL) {
+      snfs_ra_submit(inode, ra);
+      ra = NULL;
+    }
+    if (remote && ra == NULL) {
+      // without one the folios are filled one by one, which needs no memory
+      ra = kmem_cache_zalloc(snfs_ra_cachep, GFP_KERNEL);
+    }
+    if (!remote || ra == NULL) {
+      if (snfs_fill_folio(inode, folio) == 0) {
+        folio_mark_uptodate(folio);
+      }
+      folio_unlock(folio);
+      continue;
+    }
+    ra->folios[ra->nfolios] = folio;
+    bvec_set_folio(&ra->bvecs[ra->nfolios], folio, folio_size(folio), 0);
+    if (++ra->nfolios == SNFS_RA_MAX_FOLIOS) {
+      snfs_ra_submit(inode, ra);
+      ra = NULL;
+    }
+  }
+  if (ra != NULL) {
+    snfs_ra_submit(inode, ra);
+  }
+  // the ranged reads are still in flight, they show up as rpc_read
+  snfs_op_done(inode->i_sb, SNFS_OP_READAHEAD, start, 0, bytes);
+}
+
+int snfs_write_begin(
+    struct file* filp,
+    struct address_space* mapping,
+    loff_t pos,
+    unsigned len,
+    struct page** pagep,
+    void** fsdata
+) {
+  struct folio* folio = __filemap_get_folio(
+      mapping, pos >> PAGE_SHIFT, FGP_WRITEBEGIN, mapping_gfp_mask(mapping)
+  );
+  if (IS_ERR(folio)) {
+    return PTR_ERR(folio);
+  }
+
+  // a partial write has to keep the rest of the folio, so bring it in first
+  if (!folio_test_uptodate(folio) && len != folio_size(folio)) {
+    int status = snfs_fill_folio(mapping->host, folio);
+    if (status < 0) {
+      folio_unlock(folio);
+      folio_put(folio);
+      return status;
+    }
+    folio_mark_uptodate(folio);
+  }
+  *pagep = &folio->page;
   return 0;
 }
+
+int snfs_write_end(
+    struct file* filp,
+    struct address_space* mapping,
+    loff_t pos,
+    unsigned len,
+    unsigned copied,
+    struct page* page,
+    void* fsdata
+) {
+  struct folio* folio = page_folio(page);
+  struct inode* inode = mapping->host;
+
+  if (!folio_test_uptodate(folio)) {
+    // short copy into a folio that was never read in, generic_perform_write retries
+    if (copied < len) {
+      copied = 0;
+      goto out;
+    }
+    folio_mark_uptodate(folio);
+  }
+  if (pos + copied > inode->i_size) {
+    i_size_write(inode, pos + copied);
+  }
+  folio_mark_dirty(folio);
+out:
+  folio_unlock(folio);
+  folio_put(folio);
+  return copied;
+}
+
+static int snfs_writepage(struct folio* folio, struct writeback_control* wbc, void* data) {
+  struct inode* inode = folio->mapping->host;
+  struct snfs_inode* filei = inode->i_private;
+  loff_t size = i_size_read(inode);
+  loff_t pos = folio_pos(folio);
+
+  if (pos >= size) {
+    // truncated while waiting for writeback
+    folio_unlock(folio);
+    return 0;
+  }
+  size_t len = min_t(loff_t, folio_size(folio), size - pos);
+
+  folio_start_writeback(folio);
+  folio_unlock(folio);
+  int status = 0;
+  for (size_t off = 0; off < len && status == 0; off += PAGE_SIZE) {
+    char* src = kmap_local_folio(folio, off);
+    status = snfs_write_data(filei, src, pos + off, min_t(size_t, len - off, PAGE_SIZE));
+    kunmap_local(src);
+  }
+  if (status < 0) {
+    mapping_set_error(folio->mapping, status);
+  } else if (filei->remote != 0) {
+    snfs_wb_dirty(snfs_sb(inode->i_sb), filei, len);
+  }
+  folio_end_writeback(folio);
+  return status;
+}
+
+int snfs_writepages(struct address_space* mapping, struct writeback_control* wbc) {
+  long pages = wbc->nr_to_write;
+  u64 start = ktime_get_ns();
+  int status = write_cache_pages(mapping, wbc, snfs_writepage, NULL);
+  pages -= wbc->nr_to_write;
+  snfs_op_done(mapping->host->i_sb, SNFS_OP_WRITEPAGES, start, status, pages * PAGE_SIZE);
+  return status;
+}
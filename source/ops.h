@@ -6,5 +6,11 @@
 
 extern const struct inode_operations snfs_inode_ops;
 extern const struct file_operations snfs_file_ops;
+extern const struct file_operations snfs_dir_ops;
+extern const struct address_space_operations snfs_aops;
+extern const struct dentry_operations snfs_dentry_ops;
+
+int snfs_ops_caches_init(void);
+void snfs_ops_caches_destroy(void);
 
 #endif  // __FSMOD_SOURCE_OPS_H_
\ No newline at end of file
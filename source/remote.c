@@ -0,0 +1,507 @@
+#include "remote.h"
+
+#include <asm/unaligned.h>
+#include <linux/fs.h>
+#include <linux/slab.h>
+
+#include "http.h"
+#include "impl.h"
+#include "vfs.h"
+
+// maps a response to an errno by its leading MsgDto
+static int snfs_remote_status(int64_t len, const char* resp) {
+  if (len < 0) {
+    // transport failures come as small negative codes, not errnos
+    return len == -ENOMEM ? -ENOMEM : -EIO;
+  }
+  if (len < sizeof(int32_t)) {
+    return -EIO;
+  }
+  switch (get_unaligned_le32(resp)) {
+    case SNFS_REMOTE_OK:
+      return 0;
+    case SNFS_REMOTE_MISSING:
+      return -ENOENT;
+    case SNFS_REMOTE_NOTDIR:
+      return -ENOTDIR;
+    case SNFS_REMOTE_ISDIR:
+      return -EISDIR;
+    case SNFS_REMOTE_EMPTY:
+      return -ENODATA;
+    case SNFS_REMOTE_DUPLICATE:
+      return -EEXIST;
+    default:
+      return -EIO;
+  }
+}
+
+// an InodeDto, SNFS_REMOTE_INODE_SZ bytes of it
+static void snfs_remote_parse_inode(const char* dto, struct snfs_remote_inode* out) {
+  out->no = get_unaligned_le32(dto);
+  out->type = get_unaligned_le32(dto + 4) == SNFS_REMOTE_DIR ? S_IFDIR : S_IFREG;
+  out->size = get_unaligned_le64(dto + 8);
+}
+
+// InodeDto that follows the status
+static int snfs_remote_inode(int64_t len, const char* resp, struct snfs_remote_inode* out) {
+  if (len < sizeof(int32_t) + SNFS_REMOTE_INODE_SZ) {
+    return -EIO;
+  }
+  snfs_remote_parse_inode(resp + sizeof(int32_t), out);
+  return 0;
+}
+
+// a server from before versions answers without one, one that is newer with UNKNOWN
+int snfs_remote_mount(struct snfs_sb_info* info, struct snfs_remote_inode* root) {
+  char resp[SNFS_REMOTE_MSG_SZ];
+  char version[16];
+
+  snprintf(version, sizeof(version), "%d", SNFS_REMOTE_VERSION);
+  int64_t len = snfs_http_call(
+      &info->pool, info->token, "mount", resp, sizeof(resp), 1, "version", version
+  );
+  int status = snfs_remote_status(len, resp);
+  if (status < 0) {
+    return status == -EIO && len >= 0 ? -EPROTONOSUPPORT : status;
+  }
+  // the VersionDto follows the InodeDto
+  size_t at = sizeof(int32_t) + SNFS_REMOTE_INODE_SZ;
+  if (len < at + sizeof(int32_t) || get_unaligned_le32(resp + at) != SNFS_REMOTE_VERSION) {
+    return -EPROTONOSUPPORT;
+  }
+  return snfs_remote_inode(len, resp, root);
+}
+
+// Takes up to limit bytes of the tree under the token's root, depth directories deep.
+// Only the counts land in the response buffer, the rest streams into snap->buf.
+int snfs_remote_snapshot_get(
+    struct snfs_sb_info* info, unsigned int depth, size_t limit, struct snfs_remote_snapshot* snap
+) {
+  char resp[2 * sizeof(int32_t)];
+  char depthno[16];
+  char limitno[24];
+
+  memset(snap, 0, sizeof(*snap));
+  snap->buf = kvmalloc(limit, GFP_KERNEL);
+  if (snap->buf == NULL) {
+    return -ENOMEM;
+  }
+  snprintf(depthno, sizeof(depthno), "%u", depth);
+  snprintf(limitno, sizeof(limitno), "%zu", limit);
+  struct kvec dst = {.iov_base = snap->buf, .iov_len = limit};
+  int64_t len = snfs_http_call_into(
+      &info->pool,
+      info->token,
+      "snapshot",
+      resp,
+      sizeof(resp),
+      &dst,
+      1,
+      2,
+      "depth",
+      depthno,
+      "limit",
+      limitno
+  );
+  int status = snfs_remote_status(len, resp);
+  if (status == 0 && len < sizeof(resp)) {
+    status = -EIO;
+  }
+  if (status < 0) {
+    snfs_remote_snapshot_put(snap);
+    return status;
+  }
+  snap->len = len - sizeof(resp);
+  snap->dirs = get_unaligned_le32(resp + 4);
+  return 0;
+}
+
+// Moves on to the next directory, whatever is left of the current one is skipped.
+// Returns 1 with snap->dir set, 0 past the last one.
+int snfs_remote_snapshot_dir(struct snfs_remote_snapshot* snap) {
+  struct snfs_remote_inode skip;
+  char name[SNFS_NAME_SZ];
+  int status;
+  while ((status = snfs_remote_snapshot_entry(snap, name, &skip)) > 0) {
+  }
+  if (status < 0) {
+    return status;
+  }
+  if (snap->dirs == 0) {
+    return 0;
+  }
+  if (snap->len - snap->pos < 2 * sizeof(int32_t)) {
+    return -EIO;
+  }
+  snap->dir = get_unaligned_le32(snap->buf + snap->pos);
+  snap->entries = get_unaligned_le32(snap->buf + snap->pos + 4);
+  snap->pos += 2 * sizeof(int32_t);
+  snap->dirs--;
+  return 1;
+}
+
+// Returns 1 with the next entry of the current directory, 0 past its last one. Names that
+// do not fit SNFS_NAME_SZ are passed over, they could not be looked up locally anyway.
+int snfs_remote_snapshot_entry(
+    struct snfs_remote_snapshot* snap, char* name, struct snfs_remote_inode* out
+) {
+  const size_t head = SNFS_REMOTE_INODE_SZ + sizeof(int32_t);
+  while (snap->entries != 0) {
+    // an InodeDto and the length of the name
+    if (snap->len - snap->pos < head) {
+      return -EIO;
+    }
+    const char* entry = snap->buf + snap->pos;
+    size_t name_len = get_unaligned_le32(entry + SNFS_REMOTE_INODE_SZ);
+    if (name_len > snap->len - snap->pos - head) {
+      return -EIO;
+    }
+    snap->pos += head + name_len;
+    snap->entries--;
+    if (name_len == 0 || name_len >= SNFS_NAME_SZ) {
+      continue;
+    }
+    snfs_remote_parse_inode(entry, out);
+    memcpy(name, entry + head, name_len);
+    name[name_len] = '\0';
+    return 1;
+  }
+  return 0;
+}
+
+void snfs_remote_snapshot_put(struct snfs_remote_snapshot* snap) {
+  kvfree(snap->buf);
+  snap->buf = NULL;
+}
+
+int snfs_remote_children(
+    struct snfs_sb_info* info, ino_t dir, u64 after, struct snfs_remote_children* page
+) {
+  char dirno[24];
+  char afterno[24];
+
+  snprintf(dirno, sizeof(dirno), "%lu", dir);
+  snprintf(afterno, sizeof(afterno), "%llu", after);
+  int64_t len = snfs_http_call(
+      &info->pool,
+      info->token,
+      "children",
+      page->buf,
+      sizeof(page->buf),
+      2,
+      "dir",
+      dirno,
+      "after",
+      afterno
+  );
+  int status = snfs_remote_status(len, page->buf);
+  if (status < 0) {
+    return status;
+  }
+  // the status, the count of entries and the next cursor
+  if (len < 2 * sizeof(int32_t) + sizeof(int64_t)) {
+    return -EIO;
+  }
+  page->len = len;
+  page->entries = get_unaligned_le32(page->buf + 4);
+  page->next = get_unaligned_le64(page->buf + 8);
+  page->pos = 2 * sizeof(int32_t) + sizeof(int64_t);
+  return 0;
+}
+
+int snfs_remote_children_entry(
+    struct snfs_remote_children* page, char* name, struct snfs_remote_inode* out
+) {
+  const size_t size = SNFS_REMOTE_DENTRY_NAME_SZ + SNFS_REMOTE_INODE_SZ;
+  while (page->entries != 0) {
+    if (page->len - page->pos < size) {
+      return -EIO;
+    }
+    const char* entry = page->buf + page->pos;
+    size_t name_len = strnlen(entry, SNFS_REMOTE_DENTRY_NAME_SZ);
+    page->pos += size;
+    page->entries--;
+    if (name_len == 0 || name_len >= SNFS_NAME_SZ) {
+      continue;
+    }
+    snfs_remote_parse_inode(entry + SNFS_REMOTE_DENTRY_NAME_SZ, out);
+    memcpy(name, entry, name_len);
+    name[name_len] = '\0';
+    return 1;
+  }
+  return 0;
+}
+
+int snfs_remote_create(
+    struct snfs_sb_info* info, ino_t dir, const char* name, int type, struct snfs_remote_inode* out
+) {
+  char resp[SNFS_REMOTE_MSG_SZ];
+  char dirno[24];
+  char encoded[3 * SNFS_NAME_SZ + 1];
+
+  snprintf(dirno, sizeof(dirno), "%lu", dir);
+  encode(name, encoded);
+  int64_t len = snfs_http_call(
+      &info->pool,
+      info->token,
+      "create",
+      resp,
+      sizeof(resp),
+      3,
+      "dir",
+      dirno,
+      "name",
+      encoded,
+      "type",
+      S_ISDIR(type) ? "DIR" : "REG"
+  );
+  int status = snfs_remote_status(len, resp);
+  if (status < 0) {
+    return status;
+  }
+  return snfs_remote_inode(len, resp, out);
+}
+
+int snfs_remote_lookup(
+    struct snfs_sb_info* info, ino_t dir, const char* name, struct snfs_remote_inode* out
+) {
+  char resp[SNFS_REMOTE_MSG_SZ];
+  char dirno[24];
+  char encoded[3 * SNFS_NAME_SZ + 1];
+
+  snprintf(dirno, sizeof(dirno), "%lu", dir);
+  encode(name, encoded);
+  int64_t len = snfs_http_call(
+      &info->pool, info->token, "lookup", resp, sizeof(resp), 2, "dir", dirno, "name", encoded
+  );
+  int status = snfs_remote_status(len, resp);
+  if (status < 0) {
+    return status;
+  }
+  return snfs_remote_inode(len, resp, out);
+}
+
+int snfs_remote_getattr(struct snfs_sb_info* info, ino_t ino, struct snfs_remote_inode* out) {
+  char resp[SNFS_REMOTE_MSG_SZ];
+  char inono[24];
+
+  snprintf(inono, sizeof(inono), "%lu", ino);
+  int64_t len = snfs_http_call(
+      &info->pool, info->token, "getattr", resp, sizeof(resp), 1, "ino", inono
+  );
+  int status = snfs_remote_status(len, resp);
+  if (status < 0) {
+    return status;
+  }
+  return snfs_remote_inode(len, resp, out);
+}
+
+int snfs_remote_remove(struct snfs_sb_info* info, ino_t dir, const char* name) {
+  char resp[SNFS_REMOTE_MSG_SZ];
+  char dirno[24];
+  char encoded[3 * SNFS_NAME_SZ + 1];
+
+  snprintf(dirno, sizeof(dirno), "%lu", dir);
+  encode(name, encoded);
+  int64_t len = snfs_http_call(
+      &info->pool, info->token, "remove", resp, sizeof(resp), 2, "dir", dirno, "name", encoded
+  );
+  return snfs_remote_status(len, resp);
+}
+
+int snfs_remote_batch_remove(struct snfs_http_batch* batch, ino_t dir, const char* name) {
+  char dirno[24];
+  char encoded[3 * SNFS_NAME_SZ + 1];
+
+  snprintf(dirno, sizeof(dirno), "%lu", dir);
+  encode(name, encoded);
+  return snfs_http_batch_add(batch, "remove", 2, "dir", dirno, "name", encoded);
+}
+
+int snfs_remote_batch_send(struct snfs_sb_info* info, struct snfs_http_batch* batch, int* results) {
+  // a Msg and an InodeDto is the most any batched op answers with
+  size_t size = 2 * sizeof(int32_t) + batch->count * (sizeof(int32_t) + SNFS_REMOTE_MSG_SZ);
+  char* resp = kmalloc(size, GFP_KERNEL);
+  if (resp == NULL) {
+    return -ENOMEM;
+  }
+
+  int64_t len = snfs_http_batch_call(&info->pool, info->token, batch, resp, size);
+  int status = snfs_remote_status(len, resp);
+  if (len < 0) {
+    goto out;
+  }
+  size_t ran = len >= 2 * sizeof(int32_t) ? get_unaligned_le32(resp + 4) : SIZE_MAX;
+  if (ran > batch->count) {
+    status = -EIO;
+    goto out;
+  }
+  size_t pos = 2 * sizeof(int32_t);
+  for (size_t i = 0; i < batch->count; i++) {
+    if (i >= ran) {
+      results[i] = -ECANCELED;
+      continue;
+    }
+    size_t item = pos + sizeof(int32_t) <= len ? get_unaligned_le32(resp + pos) : SIZE_MAX;
+    pos += sizeof(int32_t);
+    if (item > len - pos) {
+      status = -EIO;
+      goto out;
+    }
+    results[i] = snfs_remote_status(item, resp + pos);
+    pos += item;
+  }
+
+out:
+  kfree(resp);
+  return status;
+}
+
+int snfs_remote_truncate(struct snfs_sb_info* info, ino_t ino, loff_t size) {
+  char resp[SNFS_REMOTE_MSG_SZ];
+  char inono[24];
+  char sizeno[24];
+
+  snprintf(inono, sizeof(inono), "%lu", ino);
+  snprintf(sizeno, sizeof(sizeno), "%lld", size);
+  int64_t len = snfs_http_call(
+      &info->pool, info->token, "truncate", resp, sizeof(resp), 2, "ino", inono, "size", sizeno
+  );
+  return snfs_remote_status(len, resp);
+}
+
+// vecs[0] is left for the header, the data to write is in the rest of them
+int snfs_remote_write_submit(
+    struct snfs_sb_info* info,
+    struct snfs_remote_write* req,
+    ino_t ino,
+    loff_t offset,
+    struct kvec* vecs,
+    size_t nvecs
+) {
+  size_t len = 0;
+  for (size_t i = 1; i < nvecs; i++) {
+    len += vecs[i].iov_len;
+  }
+
+  req->hdr = (struct snfs_write_hdr){
+      .ino = cpu_to_le64(ino),
+      .offset = cpu_to_le64(offset),
+      .length = cpu_to_le64(len),
+  };
+  vecs[0].iov_base = &req->hdr;
+  vecs[0].iov_len = sizeof(req->hdr);
+  int status = snfs_http_req_post(
+      &req->http, info->token, "write", vecs, nvecs, req->resp, sizeof(req->resp), 0
+  );
+  if (status < 0) {
+    return status;
+  }
+  snfs_http_submit(&info->pool, &req->http);
+  return 0;
+}
+
+int snfs_remote_write_wait(struct snfs_remote_write* req) {
+  int64_t rlen = snfs_http_wait(&req->http);
+  return snfs_remote_status(rlen, req->resp);
+}
+
+int snfs_remote_write(
+    struct snfs_sb_info* info, ino_t ino, loff_t offset, struct kvec* vecs, size_t nvecs
+) {
+  struct snfs_remote_write req;
+  int status = snfs_remote_write_submit(info, &req, ino, offset, vecs, nvecs);
+  if (status < 0) {
+    return status;
+  }
+  return snfs_remote_write_wait(&req);
+}
+
+// what a /read response amounts to, the bytes read or an errno
+static ssize_t snfs_remote_read_result(struct snfs_remote_read* req, int64_t rlen) {
+  int status = snfs_remote_status(rlen, req->resp);
+  if (status == -ENODATA) {
+    return 0;  // nothing at or past offset
+  }
+  if (status < 0) {
+    return status;
+  }
+  if (rlen < sizeof(req->resp)) {
+    return -EIO;
+  }
+  size_t got = get_unaligned_le32(req->resp + 4);
+  if (got > req->len || rlen != sizeof(req->resp) + got) {
+    return -EIO;
+  }
+  return got;
+}
+
+static void snfs_remote_read_done(struct snfs_http_req* http) {
+  struct snfs_remote_read* req = container_of(http, struct snfs_remote_read, http);
+  req->done(req, snfs_remote_read_result(req, http->result));
+}
+
+// Reads up to the length of dst at offset straight into it. Only a Msg and the TextDto
+// length land in the response buffer. Without req->done wait with snfs_remote_read_wait.
+int snfs_remote_read_submit(
+    struct snfs_sb_info* info,
+    struct snfs_remote_read* req,
+    ino_t ino,
+    loff_t offset,
+    const struct iov_iter* dst
+) {
+  char inono[24];
+  char offsetno[24];
+  char lengthno[24];
+
+  req->len = iov_iter_count(dst);
+  snprintf(inono, sizeof(inono), "%lu", ino);
+  snprintf(offsetno, sizeof(offsetno), "%lld", offset);
+  snprintf(lengthno, sizeof(lengthno), "%zu", req->len);
+  int status = snfs_http_req_get(
+      &req->http,
+      info->token,
+      "read",
+      req->resp,
+      sizeof(req->resp),
+      3,
+      "ino",
+      inono,
+      "offset",
+      offsetno,
+      "length",
+      lengthno
+  );
+  if (status < 0) {
+    return status;
+  }
+  snfs_http_req_into(&req->http, dst);
+  if (req->done != NULL) {
+    req->http.done = snfs_remote_read_done;
+  }
+  snfs_http_submit(&info->pool, &req->http);
+  return 0;
+}
+
+ssize_t snfs_remote_read_wait(struct snfs_remote_read* req) {
+  return snfs_remote_read_result(req, snfs_http_wait(&req->http));
+}
+
+// returns how many bytes there were
+ssize_t snfs_remote_read(
+    struct snfs_sb_info* info, ino_t ino, loff_t offset, const struct kvec* dst, size_t ndst
+) {
+  struct snfs_remote_read req = {.done = NULL};
+  struct iov_iter iter;
+  size_t len = 0;
+  for (size_t i = 0; i < ndst; i++) {
+    len += dst[i].iov_len;
+  }
+
+  iov_iter_kvec(&iter, ITER_DEST, dst, ndst, len);
+  int status = snfs_remote_read_submit(info, &req, ino, offset, &iter);
+  if (status < 0) {
+    return status;
+  }
+  return snfs_remote_read_wait(&req);
+}
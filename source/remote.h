@@ -0,0 +1,143 @@
+#ifndef __FSMOD_SOURCE_REMOTE_H_
+#define __FSMOD_SOURCE_REMOTE_H_
+
+#include <linux/types.h>
+#include <linux/uio.h>
+
+#include "http.h"
+
+struct snfs_sb_info;
+
+/* Room for a Msg plus the DTO that follows it */
+#define SNFS_REMOTE_MSG_SZ 64
+/* Revision of the protocol, mount sends it and the server has to answer with the same */
+#define SNFS_REMOTE_VERSION 2
+/* InodeDto on the wire, no and type are int32, size is int64 */
+#define SNFS_REMOTE_INODE_SZ (2 * sizeof(int32_t) + sizeof(int64_t))
+/* DentryDto names are zero padded to this */
+#define SNFS_REMOTE_DENTRY_NAME_SZ 128
+/* Room for a Msg plus a full page of /children */
+#define SNFS_REMOTE_PAGE_SZ 4096
+
+/* ErrStatus of the server, every response starts with it */
+enum snfs_remote_status {
+  SNFS_REMOTE_OK,
+  SNFS_REMOTE_MISSING,
+  SNFS_REMOTE_NOTDIR,
+  SNFS_REMOTE_ISDIR,
+  SNFS_REMOTE_EMPTY,
+  SNFS_REMOTE_UNKNOWN,
+  SNFS_REMOTE_DUPLICATE,
+};
+
+/* InodeDto.type */
+enum snfs_remote_type {
+  SNFS_REMOTE_REG,
+  SNFS_REMOTE_DIR,
+};
+
+struct snfs_remote_inode {
+  ino_t no;
+  int type; /* S_IFREG or S_IFDIR */
+  loff_t size;
+};
+
+/* Body of POST /write, the data follows it */
+struct snfs_write_hdr {
+  __le64 ino;
+  __le64 offset;
+  __le64 length;
+} __packed;
+
+/* A write in flight, its memory has to stay put until snfs_remote_write_wait */
+struct snfs_remote_write {
+  struct snfs_http_req http;
+  struct snfs_write_hdr hdr;
+  char resp[SNFS_REMOTE_MSG_SZ];
+};
+
+/* A read in flight. With done set it runs on the RPC workqueue with the bytes read or an
+ * errno, otherwise wait with snfs_remote_read_wait */
+struct snfs_remote_read {
+  struct snfs_http_req http;
+  char resp[2 * sizeof(int32_t)]; /* Msg and TextDto length, the data goes past it */
+  size_t len;
+  void (*done)(struct snfs_remote_read* req, ssize_t result);
+};
+
+/* A /snapshot response: directories breadth first, each with every entry it has */
+struct snfs_remote_snapshot {
+  char* buf;
+  size_t len;
+  size_t pos;
+  size_t dirs;    /* left to start */
+  size_t entries; /* left in the current directory */
+  ino_t dir;      /* server inode number of the current directory */
+};
+
+/* A /children response */
+struct snfs_remote_children {
+  char buf[SNFS_REMOTE_PAGE_SZ];
+  size_t len;
+  size_t pos;
+  size_t entries; /* left in the page */
+  u64 next;       /* cursor of the page after it, 0 past the last */
+};
+
+int snfs_remote_mount(struct snfs_sb_info* info, struct snfs_remote_inode* root);
+int snfs_remote_snapshot_get(
+    struct snfs_sb_info* info, unsigned int depth, size_t limit, struct snfs_remote_snapshot* snap
+);
+int snfs_remote_snapshot_dir(struct snfs_remote_snapshot* snap);
+int snfs_remote_snapshot_entry(
+    struct snfs_remote_snapshot* snap, char* name, struct snfs_remote_inode* out
+);
+void snfs_remote_snapshot_put(struct snfs_remote_snapshot* snap);
+/* Takes the page of dir's entries that follows cursor after, 0 for the first one */
+int snfs_remote_children(
+    struct snfs_sb_info* info, ino_t dir, u64 after, struct snfs_remote_children* page
+);
+/* Like snfs_remote_snapshot_entry, for the entries of a page */
+int snfs_remote_children_entry(
+    struct snfs_remote_children* page, char* name, struct snfs_remote_inode* out
+);
+int snfs_remote_create(
+    struct snfs_sb_info* info, ino_t dir, const char* name, int type, struct snfs_remote_inode* out
+);
+int snfs_remote_lookup(
+    struct snfs_sb_info* info, ino_t dir, const char* name, struct snfs_remote_inode* out
+);
+int snfs_remote_getattr(struct snfs_sb_info* info, ino_t ino, struct snfs_remote_inode* out);
+int snfs_remote_remove(struct snfs_sb_info* info, ino_t dir, const char* name);
+/* Queues a /remove into batch */
+int snfs_remote_batch_remove(struct snfs_http_batch* batch, ino_t dir, const char* name);
+/* Sends batch, results gets an errno for each op in it, -ECANCELED for those that did not
+ * run. Returns the status of the batch, for an atomic one nothing was applied unless 0. */
+int snfs_remote_batch_send(struct snfs_sb_info* info, struct snfs_http_batch* batch, int* results);
+/* Sets the size of a file on the server, blocks past it are dropped */
+int snfs_remote_truncate(struct snfs_sb_info* info, ino_t ino, loff_t size);
+int snfs_remote_write_submit(
+    struct snfs_sb_info* info,
+    struct snfs_remote_write* req,
+    ino_t ino,
+    loff_t offset,
+    struct kvec* vecs,
+    size_t nvecs
+);
+int snfs_remote_write_wait(struct snfs_remote_write* req);
+int snfs_remote_write(
+    struct snfs_sb_info* info, ino_t ino, loff_t offset, struct kvec* vecs, size_t nvecs
+);
+int snfs_remote_read_submit(
+    struct snfs_sb_info* info,
+    struct snfs_remote_read* req,
+    ino_t ino,
+    loff_t offset,
+    const struct iov_iter* dst
+);
+ssize_t snfs_remote_read_wait(struct snfs_remote_read* req);
+ssize_t snfs_remote_read(
+    struct snfs_sb_info* info, ino_t ino, loff_t offset, const struct kvec* dst, size_t ndst
+);
+
+#endif  // __FSMOD_SOURCE_REMOTE_H_
@@ -0,0 +1,42 @@
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM snfs
+
+#if !defined(__FSMOD_SOURCE_SNFS_TRACE_H_) || defined(TRACE_HEADER_MULTI_READ)
+#define __FSMOD_SOURCE_SNFS_TRACE_H_
+
+#include <linux/tracepoint.h>
+
+/* Fires once per VFS op and RPC, in place of logging every one of them */
+TRACE_EVENT(
+    snfs_op_done,
+    TP_PROTO(const char* op, long status, size_t bytes, u64 ns),
+    TP_ARGS(op, status, bytes, ns),
+    TP_STRUCT__entry(
+        __string(op, op)
+        __field(long, status)
+        __field(size_t, bytes)
+        __field(u64, ns)
+    ),
+    TP_fast_assign(
+        __assign_str(op, op);
+        __entry->status = status;
+        __entry->bytes = bytes;
+        __entry->ns = ns;
+    ),
+    TP_printk(
+        "op=%s status=%ld bytes=%zu ns=%llu",
+        __get_str(op),
+        __entry->status,
+        __entry->bytes,
+        __entry->ns
+    )
+);
+
+#endif  // __FSMOD_SOURCE_SNFS_TRACE_H_
+
+/* Found through the -I for source in the Makefile */
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE snfs_trace
+#include <trace/define_trace.h>
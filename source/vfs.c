@@ -1,31 +1,237 @@
 
 #include "vfs.h"
 
+#include <linux/backing-dev.h>
+#include <linux/ctype.h>
 #include <linux/dcache.h>
+#include <linux/inet.h>
+#include <linux/moduleparam.h>
+#include <linux/pagemap.h>
+#include <linux/slab.h>
+#include <linux/statfs.h>
 
 #include "http.h"
 #include "impl.h"
 #include "ops.h"
+#include "remote.h"
 #include "util.h"
 
+static unsigned int pool_size = SNFS_HTTP_POOL_DEFAULT_SZ;
+module_param(pool_size, uint, 0444);
+MODULE_PARM_DESC(pool_size, "Keep-alive connections to the server per mount");
+
+static unsigned int readahead_kb = 1024;
+module_param(readahead_kb, uint, 0444);
+MODULE_PARM_DESC(readahead_kb, "Largest window fetched from the server ahead of readers");
+
+static unsigned int snapshot_depth = 8;
+module_param(snapshot_depth, uint, 0644);
+MODULE_PARM_DESC(snapshot_depth, "Directory levels loaded from the server at mount, 0 for none");
+
+static unsigned int snapshot_kb = 1024;
+module_param(snapshot_kb, uint, 0644);
+MODULE_PARM_DESC(snapshot_kb, "Largest tree snapshot taken from the server at mount");
+
+#define SNFS_MAGIC 0x736e6673 /* "snfs" */
+
+static void snfs_evict_inode(struct inode* inode) {
+  truncate_inode_pages_final(&inode->i_data);
+  clear_inode(inode);
+  if (inode->i_private != NULL) {
+    snfs_inode_put(inode->i_private);
+  }
+}
+
+// dirty pages are already in the blocks by now, this pushes them to the server
+static int snfs_sync_fs(struct super_block* sb, int wait) {
+  struct snfs_sb_info* info = snfs_sb(sb);
+  if (!wait) {
+    mod_delayed_work(system_unbound_wq, &info->wb.work, 0);
+    return 0;
+  }
+  return snfs_wb_flush(info, true);
+}
+
+static const struct super_operations snfs_super_ops = {
+    .statfs = simple_statfs,
+    .evict_inode = snfs_evict_inode,
+    .sync_fs = snfs_sync_fs,
+};
+
+// Brings in the top of the server's tree in one transfer. Directories it lists in full are
+// marked listed, so lookups of names they lack do not go to the server.
+static int snfs_load_snapshot(struct snfs_sb_info* info, struct snfs_inode* rooti) {
+  struct snfs_remote_snapshot snap;
+  struct snfs_remote_inode remote;
+  char name[SNFS_NAME_SZ];
+  struct xarray dirs; /* snfs_inode by server inode number */
+
+  if (snapshot_depth == 0) {
+    return 0;
+  }
+  int status = snfs_remote_snapshot_get(info, snapshot_depth, (size_t)snapshot_kb * 1024, &snap);
+  if (status < 0) {
+    return status;
+  }
+  xa_init(&dirs);
+  status = xa_err(xa_store(&dirs, rooti->remote, rooti, GFP_KERNEL));
+  size_t loaded = 0;
+  while (status == 0 && (status = snfs_remote_snapshot_dir(&snap)) > 0) {
+    // parents come before their children, so every directory is known by now
+    struct snfs_inode* dir = xa_load(&dirs, snap.dir);
+    if (dir == NULL) {
+      status = -EIO;
+      break;
+    }
+    while ((status = snfs_remote_snapshot_entry(&snap, name, &remote)) > 0) {
+      struct snfs_dentry* entry =
+          snfs_add_remote_child(dir, name, remote.type, remote.no, remote.size);
+      if (IS_ERR(entry)) {
+        status = PTR_ERR(entry);
+        break;
+      }
+      if (S_ISDIR(remote.type)) {
+        status = xa_err(xa_store(&dirs, remote.no, entry->inode, GFP_KERNEL));
+        if (status < 0) {
+          break;
+        }
+      }
+      loaded++;
+    }
+    if (status == 0) {
+      dir->listed = true;
+      dir->listed_time = jiffies;
+    }
+  }
+  xa_destroy(&dirs);
+  snfs_remote_snapshot_put(&snap);
+  LOG("Loaded %zu entries from the server\n", loaded);
+  return status;
+}
+
 void snfs_kill_vfs_sb(struct super_block* sb) {
+  struct snfs_sb_info* info = snfs_sb(sb);
+  kill_anon_super(sb);
+  if (info != NULL) {
+    snfs_wb_destroy(info);
+    snfs_http_pool_destroy(&info->pool);
+    snfs_metrics_destroy(&info->metrics);
+    snfs_destroy_sb(&info->fs);
+    kfree(info);
+  }
   LOG("Super block is destroyed. Unmount successfully.\n");
 }
 
+/* What snfs_mount hands to snfs_fill_vfs_sb */
+struct snfs_mount_opts {
+  const char* token;
+  struct sockaddr_in addr;
+  unsigned int pool_size;
+};
+
+// Options are comma separated: token=<token>, addr=<IPv4>, port=<n> and pool_size=<n>. The
+// server defaults to 127.0.0.1:8080 and the pool to the module parameter.
+static int snfs_parse_opts(char* options, struct snfs_mount_opts* opts) {
+  char* opt;
+  while ((opt = strsep(&options, ",")) != NULL) {
+    if (*opt == '\0') {
+      continue;
+    }
+    char* value = strchr(opt, '=');
+    if (value == NULL) {
+      LOG("Mount option %s has no value\n", opt);
+      return -EINVAL;
+    }
+    *value++ = '\0';
+    int status = 0;
+    if (strcmp(opt, "token") == 0) {
+      opts->token = value;
+    } else if (strcmp(opt, "addr") == 0) {
+      if (!in4_pton(value, -1, (u8*)&opts->addr.sin_addr.s_addr, -1, NULL)) {
+        status = -EINVAL;
+      }
+    } else if (strcmp(opt, "port") == 0) {
+      u16 port = 0;
+      status = kstrtou16(value, 10, &port);
+      if (port == 0) {
+        status = -EINVAL;
+      }
+      opts->addr.sin_port = htons(port);
+    } else if (strcmp(opt, "pool_size") == 0) {
+      status = kstrtouint(value, 10, &opts->pool_size);
+    } else {
+      status = -EINVAL;
+    }
+    if (status < 0) {
+      LOG("Bad mount option %s=%s\n", opt, value);
+      return -EINVAL;
+    }
+  }
+  return 0;
+}
+
 int snfs_fill_vfs_sb(struct super_block* sb, void* data, int silent) {
-  int status = snfs_init_sb();
+  const struct snfs_mount_opts* opts = data;
+  struct snfs_sb_info* info = kzalloc(sizeof(*info), GFP_KERNEL);
+  if (info == NULL) {
+    return -ENOMEM;
+  }
+  int status = snfs_init_sb(&info->fs);
   if (status < 0) {
+    kfree(info);
     return status;
   }
+  strscpy(info->token, opts->token, SNFS_TOKEN_SZ);
+  snfs_wb_init(info);
+  status = snfs_http_pool_init(&info->pool, opts->pool_size, &opts->addr);
+  if (status < 0) {
+    snfs_destroy_sb(&info->fs);
+    kfree(info);
+    return status;
+  }
+  status = snfs_metrics_init(&info->metrics, sb->s_dev);
+  if (status < 0) {
+    snfs_http_pool_destroy(&info->pool);
+    snfs_destroy_sb(&info->fs);
+    kfree(info);
+    return status;
+  }
+  info->pool.metrics = &info->metrics;
+  sb->s_fs_info = info;
+
+  sb->s_op = &snfs_super_ops;
+  sb->s_d_op = &snfs_dentry_ops;
+  sb->s_magic = SNFS_MAGIC;
+  sb->s_blocksize = PAGE_SIZE;
+  sb->s_blocksize_bits = PAGE_SHIFT;
+  sb->s_maxbytes = MAX_LFS_FILESIZE;
+  // own bdi, so dirty pages get written back by the flusher threads
+  status = super_setup_bdi(sb);
+  if (status < 0) {
+    return status;
+  }
+  // every miss is a round trip, so sequential readers get a wider window than disks do
+  sb->s_bdi->ra_pages = readahead_kb / (PAGE_SIZE / 1024);
+  sb->s_bdi->io_pages = sb->s_bdi->ra_pages;
 
-  char* buf = kzalloc(4096, GFP_KERNEL);
-  int st = snfs_http_call("token", "mount", buf, 4096, 0);
-  int32_t i = *(int32_t*)(buf);
-  for(int i = 0; i < 30; i++){
-    printk("%d ", buf[i]);
+  struct snfs_remote_inode root;
+  status = snfs_remote_mount(info, &root);
+  if (status == -EPROTONOSUPPORT) {
+    LOG("Server speaks another protocol version than %d, mounting local only\n",
+        SNFS_REMOTE_VERSION);
+  } else if (status < 0) {
+    // keep working as a local file system, nothing is sent to the server then
+    LOG("Server is unavailable (%d), mounting local only\n", status);
+  } else {
+    struct snfs_inode* rooti = snfs_inode_by_ino(&info->fs, SNFS_ROOT_NO);
+    rooti->remote = root.no;
+    // whatever did not make it in is looked up as it is needed
+    status = snfs_load_snapshot(info, rooti);
+    if (status < 0) {
+      LOG("Failed to load the tree snapshot: %d\n", status);
+    }
+    snfs_inode_put(rooti);
   }
-  LOG("%d, %s, %d", st, buf, i);
-  kfree(buf);
   struct inode* inode = snfs_get_vfs_inode(sb, NULL, S_IFDIR, SNFS_ROOT_NO);
   sb->s_root = d_make_root(inode);
   if (sb->s_root == NULL) {
@@ -36,10 +242,49 @@ int snfs_fill_vfs_sb(struct super_block* sb, void* data, int silent) {
   return 0;
 }
 
+static int snfs_check_token(const char* token) {
+  if (token == NULL || *token == '\0' || strlen(token) >= SNFS_TOKEN_SZ) {
+    LOG("Token has to be 1 to %d characters\n", SNFS_TOKEN_SZ - 1);
+    return -EINVAL;
+  }
+  // anything a query string would need escaped is not sent as is
+  for (const char* c = token; *c != '\0'; c++) {
+    if (!isalnum(*c) && *c != '-' && *c != '_' && *c != '.') {
+      LOG("Token may only hold letters, digits, '-', '_' and '.'\n");
+      return -EINVAL;
+    }
+  }
+  return 0;
+}
+
+// The token picks the tree on the server this mount sees. It is the token option, or the
+// device name when there is none.
 struct dentry* snfs_mount(
-    struct file_system_type* fs_type, int flags, const char* token, void* data
+    struct file_system_type* fs_type, int flags, const char* dev_name, void* data
 ) {
-  struct dentry* ret = mount_nodev(fs_type, flags, data, snfs_fill_vfs_sb);
+  struct snfs_mount_opts opts = {
+      .addr = {
+          .sin_family = AF_INET,
+          .sin_addr = {.s_addr = htonl(INADDR_LOOPBACK)},
+          .sin_port = htons(8080),
+      },
+      .pool_size = pool_size,
+  };
+  if (data != NULL) {
+    // mount hands over a page of its own, so the options can be split in place
+    int status = snfs_parse_opts(data, &opts);
+    if (status < 0) {
+      return ERR_PTR(status);
+    }
+  }
+  if (opts.token == NULL) {
+    opts.token = dev_name;
+  }
+  int status = snfs_check_token(opts.token);
+  if (status < 0) {
+    return ERR_PTR(status);
+  }
+  struct dentry* ret = mount_nodev(fs_type, flags, &opts, snfs_fill_vfs_sb);
   if (ret == NULL) {
     printk(KERN_ERR "[snfs]: Can't mount file system");
   } else {
@@ -48,15 +293,30 @@ struct dentry* snfs_mount(
   return ret;
 }
 
+// one VFS inode per snfs_inode, so the page cache outlives dentries
 struct inode* snfs_get_vfs_inode(
     struct super_block* sb, const struct inode* dir, umode_t mode, ino_t i_ino
 ) {
-  struct inode* inode = new_inode(sb);
-  if (inode != NULL) {
-    inode_init_owner(&nop_mnt_idmap, inode, dir, mode | S_IRWXUGO);
-    inode->i_op = &snfs_inode_ops;
+  struct inode* inode = iget_locked(sb, i_ino);
+  if (inode == NULL || !(inode->i_state & I_NEW)) {
+    return inode;
+  }
+
+  struct snfs_inode* snfsi = snfs_inode_by_ino(&snfs_sb(sb)->fs, i_ino);
+  if (snfsi == NULL) {
+    iget_failed(inode);
+    return NULL;
+  }
+  inode_init_owner(&nop_mnt_idmap, inode, dir, mode | S_IRWXUGO);
+  inode->i_op = &snfs_inode_ops;
+  inode->i_private = snfsi;  // reference is dropped in snfs_evict_inode
+  if (S_ISDIR(mode)) {
+    inode->i_fop = &snfs_dir_ops;
+  } else {
     inode->i_fop = &snfs_file_ops;
-    inode->i_ino = i_ino;
+    inode->i_mapping->a_ops = &snfs_aops;
+    i_size_write(inode, snfsi->size);
   }
+  unlock_new_inode(inode);
   return inode;
 }
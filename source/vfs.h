@@ -4,12 +4,32 @@
 #include <linux/fs.h>
 #include <linux/kobject.h>
 
+#include "http.h"
+#include "impl.h"
+#include "metrics.h"
+#include "writeback.h"
+
+#define SNFS_TOKEN_SZ 64
+
+/* Per-mount state, lives in super_block.s_fs_info */
+struct snfs_sb_info {
+  struct snfs_superblock fs;
+  struct snfs_http_pool pool;
+  char token[SNFS_TOKEN_SZ];
+  struct snfs_wb wb;
+  struct snfs_metrics metrics;
+};
+
+static inline struct snfs_sb_info* snfs_sb(struct super_block* sb) {
+  return sb->s_fs_info;
+}
+
 void snfs_kill_vfs_sb(struct super_block* sb);
 
 int snfs_fill_vfs_sb(struct super_block* sb, void* data, int silent);
 
 struct dentry* snfs_mount(
-    struct file_system_type* fs_type, int flags, const char* token, void* data
+    struct file_system_type* fs_type, int flags, const char* dev_name, void* data
 );
 
 struct inode* snfs_get_vfs_inode(
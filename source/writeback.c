@@ -0,0 +1,415 @@
+#include "writeback.h"
+
+#include <linux/jiffies.h>
+#include <linux/moduleparam.h>
+#include <linux/slab.h>
+
+#include "impl.h"
+#include "remote.h"
+#include "util.h"
+#include "vfs.h"
+
+static unsigned int wb_expire_ms = 5000;
+module_param(wb_expire_ms, uint, 0644);
+MODULE_PARM_DESC(wb_expire_ms, "Age after which written data is pushed to the server");
+
+static unsigned int wb_max_dirty_kb = 4096;
+module_param(wb_max_dirty_kb, uint, 0644);
+MODULE_PARM_DESC(wb_max_dirty_kb, "Unpushed data per mount that triggers an immediate flush");
+
+static void snfs_wb_work(struct work_struct* work);
+static void snfs_wb_free_runs(struct snfs_wb_run* runs);
+
+void snfs_wb_init(struct snfs_sb_info* info) {
+  struct snfs_wb* wb = &info->wb;
+  INIT_LIST_HEAD(&wb->dirty);
+  spin_lock_init(&wb->lock);
+  wb->dirty_bytes = 0;
+  mutex_init(&wb->flush_lock);
+  wb->runs = NULL;
+  INIT_DELAYED_WORK(&wb->work, snfs_wb_work);
+  mutex_init(&wb->ns_lock);
+  snfs_http_batch_init(&wb->removes, false);
+}
+
+// anything still dirty here could not be pushed and is lost
+void snfs_wb_destroy(struct snfs_sb_info* info) {
+  struct snfs_wb* wb = &info->wb;
+  struct snfs_inode* file;
+  struct snfs_inode* tmp;
+
+  cancel_delayed_work_sync(&wb->work);
+  list_for_each_entry_safe(file, tmp, &wb->dirty, dirty) {
+    LOG("Dropping unflushed data of inode %lu\n", file->no);
+    list_del_init(&file->dirty);
+    snfs_inode_put(file);
+  }
+  if (wb->removes.count != 0) {
+    LOG("Dropping %zu unsent removes\n", wb->removes.count);
+  }
+  snfs_http_batch_destroy(&wb->removes);
+  snfs_wb_free_runs(wb->runs);
+}
+
+static void snfs_wb_kick(struct snfs_wb* wb, bool now) {
+  if (now) {
+    mod_delayed_work(system_unbound_wq, &wb->work, 0);
+  } else {
+    queue_delayed_work(system_unbound_wq, &wb->work, msecs_to_jiffies(wb_expire_ms));
+  }
+}
+
+// called once bytes of file made it into its blocks
+void snfs_wb_dirty(struct snfs_sb_info* info, struct snfs_inode* file, size_t bytes) {
+  struct snfs_wb* wb = &info->wb;
+
+  spin_lock(&wb->lock);
+  if (list_empty(&file->dirty)) {
+    snfs_inode_get(file);  // dropped once the data is on the server
+    file->dirtied = jiffies;
+    list_add_tail(&file->dirty, &wb->dirty);
+  }
+  file->dirty_bytes += bytes;
+  wb->dirty_bytes += bytes;
+  bool over = wb->dirty_bytes >= (size_t)wb_max_dirty_kb * 1024;
+  spin_unlock(&wb->lock);
+
+  snfs_wb_kick(wb, over);
+}
+
+static void snfs_wb_requeue(struct snfs_wb* wb, struct snfs_inode* file) {
+  spin_lock(&wb->lock);
+  file->dirtied = jiffies;
+  list_add_tail(&file->dirty, &wb->dirty);
+  spin_unlock(&wb->lock);
+}
+
+/* A run of dirty blocks on its way to the server */
+struct snfs_wb_run {
+  struct snfs_remote_write req;
+  unsigned long index;
+  size_t n;
+  int status;
+  char* data;                            /* copy of the blocks, SNFS_WB_MAX_RUN of them */
+  struct kvec vecs[SNFS_WB_MAX_RUN + 1]; /* vecs[0] is where the header goes */
+};
+
+static void snfs_wb_free_runs(struct snfs_wb_run* runs) {
+  if (runs == NULL) {
+    return;
+  }
+  for (size_t i = 0; i < SNFS_WB_INFLIGHT; i++) {
+    kvfree(runs[i].data);
+  }
+  kfree(runs);
+}
+
+// caller holds flush_lock, the runs are kept for the flushes after it
+static struct snfs_wb_run* snfs_wb_runs(struct snfs_wb* wb) {
+  if (wb->runs != NULL) {
+    return wb->runs;
+  }
+  struct snfs_wb_run* runs = kcalloc(SNFS_WB_INFLIGHT, sizeof(*runs), GFP_KERNEL);
+  if (runs == NULL) {
+    return NULL;
+  }
+  for (size_t i = 0; i < SNFS_WB_INFLIGHT; i++) {
+    runs[i].data = kvmalloc_array(SNFS_WB_MAX_RUN, SNFS_BLOCK_SZ, GFP_KERNEL);
+    if (runs[i].data == NULL) {
+      snfs_wb_free_runs(runs);
+      return NULL;
+    }
+  }
+  wb->runs = runs;
+  return runs;
+}
+
+// Takes the next dirty run at or after *index and copies it into run->data, caller holds
+// file->data_lock. Returns how many blocks it has.
+static size_t snfs_wb_take_run(
+    struct snfs_inode* file, unsigned long* index, struct snfs_wb_run* run
+) {
+  struct kvec* vecs = run->vecs + 1;
+  run->n = snfs_dirty_run(file, index, vecs, SNFS_WB_MAX_RUN);
+  run->index = *index;
+  for (size_t i = 0; i < run->n; i++) {
+    char* copy = run->data + (i << SNFS_BLOCK_SHIFT);
+    memcpy(copy, vecs[i].iov_base, vecs[i].iov_len);
+    vecs[i].iov_base = copy;
+  }
+  return run->n;
+}
+
+// Sends every dirty block of file, caller holds flush_lock and owns its dirty reference.
+// Up to SNFS_WB_INFLIGHT runs are in flight at once, each on a connection of the pool.
+// Returns how far the data sent reaches in *end.
+static int snfs_wb_push_blocks(
+    struct snfs_sb_info* info, struct snfs_inode* file, struct snfs_wb_run* runs, loff_t* end
+) {
+  unsigned long index = 0;
+  int status = 0;
+
+  while (status == 0) {
+    size_t nruns = 0;
+    // Only the copies go out, so writers and truncation are held up by the copying and not
+    // by the round trips. A block written on the way is marked and sent again, a cut is
+    // marked as a resize and goes out with the next push.
+    down_read(&file->data_lock);
+    for (; nruns < SNFS_WB_INFLIGHT; nruns++) {
+      struct snfs_wb_run* run = &runs[nruns];
+      if (snfs_wb_take_run(file, &index, run) == 0) {
+        break;
+      }
+      index += run->n;
+      // only the last block of a run can be short
+      loff_t run_end = ((loff_t)run->index + run->n - 1) << SNFS_BLOCK_SHIFT;
+      *end = max(*end, run_end + (loff_t)run->vecs[run->n].iov_len);
+    }
+    up_read(&file->data_lock);
+    if (nruns == 0) {
+      break;
+    }
+
+    size_t sent = 0;
+    for (; sent < nruns; sent++) {
+      struct snfs_wb_run* run = &runs[sent];
+      loff_t offset = (loff_t)run->index << SNFS_BLOCK_SHIFT;
+      run->status = snfs_remote_write_submit(
+          info, &run->req, file->remote, offset, run->vecs, run->n + 1
+      );
+      if (run->status < 0) {
+        status = run->status;
+        break;
+      }
+    }
+    for (size_t i = 0; i < sent; i++) {
+      runs[i].status = snfs_remote_write_wait(&runs[i].req);
+      if (runs[i].status < 0) {
+        status = runs[i].status;
+      }
+    }
+    if (status < 0) {
+      // the runs that did not go out are sent with the next push
+      down_read(&file->data_lock);
+      for (size_t i = 0; i < nruns; i++) {
+        if (i >= sent || runs[i].status < 0) {
+          snfs_redirty_run(file, runs[i].index, runs[i].n);
+        }
+      }
+      up_read(&file->data_lock);
+    }
+  }
+  return status;
+}
+
+// Ends a push. A size the server may have missed is marked to go out with the next one.
+static void snfs_wb_pushed(struct snfs_inode* file, loff_t resized_to) {
+  down_write(&file->data_lock);
+  if (resized_to >= 0) {
+    snfs_mark_resized(file, resized_to);
+  }
+  WRITE_ONCE(file->pushes, file->pushes + 1);
+  up_write(&file->data_lock);
+}
+
+// A size set locally goes out before the data, so the server drops what was cut off before
+// data written since lands on it, and once more after it if the file was also grown past
+// what the data covers.
+static int snfs_wb_push(
+    struct snfs_sb_info* info, struct snfs_inode* file, struct snfs_wb_run* runs
+) {
+  loff_t resized_to = -1;
+  loff_t end = 0;
+
+  // other pushes wait for flush_lock and setattr for the exclusive lock
+  down_read(&file->data_lock);
+  WRITE_ONCE(file->pushes, file->pushes + 1);
+  if (file->resized) {
+    resized_to = file->resized_to;
+    file->resized = false;
+  }
+  up_read(&file->data_lock);
+  if (resized_to >= 0) {
+    int status = snfs_remote_truncate(info, file->remote, resized_to);
+    if (status < 0) {
+      snfs_wb_pushed(file, resized_to);
+      return status;
+    }
+    end = resized_to;
+  }
+
+  int status = snfs_wb_push_blocks(info, file, runs, &end);
+  // a truncate from here on is marked again, so any size seen here will do
+  loff_t size = READ_ONCE(file->size);
+  if (resized_to >= 0 && status == 0 && size > end) {
+    status = snfs_remote_truncate(info, file->remote, size);
+  }
+  // cutting the server to the size it has here is right whatever it got of the data
+  snfs_wb_pushed(file, resized_to >= 0 && status < 0 ? size : -1);
+  return status;
+}
+
+// Failures of the transport pass, a push that failed on one is tried again later. What the
+// server refused, a file it no longer has, would be refused again.
+static bool snfs_wb_retryable(int status) {
+  switch (status) {
+    case -EIO:
+    case -ENOMEM:
+    case -EINTR:
+    case -EAGAIN:
+    case -ETIMEDOUT:
+    case -EPIPE:
+    case -ECONNREFUSED:
+    case -ECONNRESET:
+    case -ECONNABORTED:
+    case -ENOTCONN:
+    case -EHOSTUNREACH:
+    case -ENETUNREACH:
+      return true;
+    default:
+      return false;
+  }
+}
+
+static int snfs_wb_flush_locked(
+    struct snfs_sb_info* info, struct snfs_inode* file, struct snfs_wb_run* runs
+) {
+  struct snfs_wb* wb = &info->wb;
+
+  spin_lock(&wb->lock);
+  if (list_empty(&file->dirty)) {
+    spin_unlock(&wb->lock);
+    return 0;
+  }
+  list_del_init(&file->dirty);
+  wb->dirty_bytes -= file->dirty_bytes;
+  file->dirty_bytes = 0;
+  spin_unlock(&wb->lock);
+
+  int status = snfs_wb_push(info, file, runs);
+  if (status < 0 && snfs_wb_retryable(status)) {
+    snfs_wb_requeue(wb, file);
+    return status;
+  }
+  if (status < 0) {
+    // its blocks stay marked, a later write puts it on the list and tries once more
+    LOG("Dropping unpushable data of inode %lu: %d\n", file->no, status);
+  }
+  snfs_inode_put(file);
+  return status;
+}
+
+int snfs_wb_flush_inode(struct snfs_sb_info* info, struct snfs_inode* file) {
+  mutex_lock(&info->wb.flush_lock);
+  struct snfs_wb_run* runs = snfs_wb_runs(&info->wb);
+  int status = runs == NULL ? -ENOMEM : snfs_wb_flush_locked(info, file, runs);
+  mutex_unlock(&info->wb.flush_lock);
+  return status;
+}
+
+// Sends the queued removes, caller holds ns_lock. The local tree went ahead long ago, so
+// a single op that fails is only logged. A failed batch stays queued as a whole.
+static int snfs_wb_send_removes(struct snfs_sb_info* info) {
+  struct snfs_wb* wb = &info->wb;
+  if (wb->removes.count == 0) {
+    return 0;
+  }
+  int* results = kmalloc_array(wb->removes.count, sizeof(int), GFP_KERNEL);
+  if (results == NULL) {
+    return -ENOMEM;
+  }
+  int status = snfs_remote_batch_send(info, &wb->removes, results);
+  if (status == 0) {
+    for (size_t i = 0; i < wb->removes.count; i++) {
+      // already gone on the server is as good as removed
+      if (results[i] < 0 && results[i] != -ENOENT) {
+        LOG("Queued remove %zu failed: %d\n", i, results[i]);
+      }
+    }
+    snfs_http_batch_reset(&wb->removes);
+  }
+  kfree(results);
+  return status;
+}
+
+// Queues the remove of name from the server's dir. Every other namespace call flushes the
+// queue first, so the server never sees the calls out of order.
+int snfs_wb_remove(struct snfs_sb_info* info, ino_t dir, const char* name) {
+  struct snfs_wb* wb = &info->wb;
+
+  mutex_lock(&wb->ns_lock);
+  int status = snfs_remote_batch_remove(&wb->removes, dir, name);
+  if (status == 0 && wb->removes.count >= SNFS_WB_MAX_REMOVES) {
+    // what fails stays queued for the worker
+    snfs_wb_send_removes(info);
+  }
+  mutex_unlock(&wb->ns_lock);
+  if (status == 0) {
+    snfs_wb_kick(wb, false);
+  }
+  return status;
+}
+
+int snfs_wb_flush_removes(struct snfs_sb_info* info) {
+  mutex_lock(&info->wb.ns_lock);
+  int status = snfs_wb_send_removes(info);
+  mutex_unlock(&info->wb.ns_lock);
+  return status;
+}
+
+// Pushes inodes oldest first. Unless all is set it stops at the first one that
+// is young enough to wait, as long as the mount is under its dirty limit.
+int snfs_wb_flush(struct snfs_sb_info* info, bool all) {
+  struct snfs_wb* wb = &info->wb;
+  unsigned long expire = msecs_to_jiffies(wb_expire_ms);
+  int status = snfs_wb_flush_removes(info);
+  if (status < 0) {
+    LOG("Failed to send queued removes: %d\n", status);
+  }
+
+  mutex_lock(&wb->flush_lock);
+  struct snfs_wb_run* runs = snfs_wb_runs(wb);
+  if (runs == NULL) {
+    mutex_unlock(&wb->flush_lock);
+    return -ENOMEM;
+  }
+  // a failed inode goes back to the tail, bounding the pass keeps it from being retried at once
+  spin_lock(&wb->lock);
+  size_t left = list_count_nodes(&wb->dirty);
+  spin_unlock(&wb->lock);
+  for (; left != 0; left--) {
+    spin_lock(&wb->lock);
+    if (list_empty(&wb->dirty)) {
+      spin_unlock(&wb->lock);
+      break;
+    }
+    struct snfs_inode* file = list_first_entry(&wb->dirty, struct snfs_inode, dirty);
+    bool over = wb->dirty_bytes >= (size_t)wb_max_dirty_kb * 1024;
+    if (!all && !over && time_before(jiffies, file->dirtied + expire)) {
+      spin_unlock(&wb->lock);
+      snfs_wb_kick(wb, false);
+      break;
+    }
+    snfs_inode_get(file);
+    spin_unlock(&wb->lock);
+
+    int err = snfs_wb_flush_locked(info, file, runs);
+    if (err < 0) {
+      LOG("Failed to push inode %lu: %d\n", file->no, err);
+      status = err;
+    }
+    snfs_inode_put(file);
+  }
+  mutex_unlock(&wb->flush_lock);
+
+  // whatever failed is retried after the usual delay
+  if (status < 0) {
+    snfs_wb_kick(wb, false);
+  }
+  return status;
+}
+
+static void snfs_wb_work(struct work_struct* work) {
+  struct snfs_sb_info* info = container_of(to_delayed_work(work), struct snfs_sb_info, wb.work);
+  snfs_wb_flush(info, false);
+}
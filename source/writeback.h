@@ -0,0 +1,45 @@
+#ifndef __FSMOD_SOURCE_WRITEBACK_H_
+#define __FSMOD_SOURCE_WRITEBACK_H_
+
+#include <linux/list.h>
+#include <linux/mutex.h>
+#include <linux/spinlock.h>
+#include <linux/workqueue.h>
+
+#include "http.h"
+
+struct snfs_sb_info;
+struct snfs_inode;
+struct snfs_wb_run;
+
+/* Most blocks sent in one /write */
+#define SNFS_WB_MAX_RUN 64
+/* Writes of one inode in flight at once */
+#define SNFS_WB_INFLIGHT 8
+/* Queued removes that are sent without waiting for the worker */
+#define SNFS_WB_MAX_REMOVES 64
+
+/* Data that made it from the page cache into snfs_inode blocks is pushed to
+ * the server's /write in batches by a per-mount worker: once it is old enough,
+ * once too much of it piles up, on fsync and on sync/unmount. Removes are
+ * queued the same way and go out as one /batch. */
+struct snfs_wb {
+  struct list_head dirty; /* snfs_inode, oldest first */
+  spinlock_t lock;        /* dirty list and byte counters */
+  size_t dirty_bytes;
+  struct mutex flush_lock; /* one flusher at a time */
+  struct snfs_wb_run* runs; /* what the flusher sends from, allocated by the first one */
+  struct delayed_work work;
+  struct mutex ns_lock;           /* removes and sending them */
+  struct snfs_http_batch removes; /* in the order they were made */
+};
+
+void snfs_wb_init(struct snfs_sb_info* info);
+void snfs_wb_destroy(struct snfs_sb_info* info);
+void snfs_wb_dirty(struct snfs_sb_info* info, struct snfs_inode* file, size_t bytes);
+int snfs_wb_flush_inode(struct snfs_sb_info* info, struct snfs_inode* file);
+int snfs_wb_flush(struct snfs_sb_info* info, bool all);
+int snfs_wb_remove(struct snfs_sb_info* info, ino_t dir, const char* name);
+int snfs_wb_flush_removes(struct snfs_sb_info* info);
+
+#endif  // __FSMOD_SOURCE_WRITEBACK_H_
@@ -0,0 +1,337 @@
+#include "fs.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define STANDIN_MIN_BUCKETS 8
+
+/* Inodes by number, numbers are never reused */
+static struct standin_inode** inodes;
+static size_t ninodes;
+static int32_t next_no = 1;
+static uint64_t next_id = 1;
+
+/* Root of every token seen */
+struct standin_root {
+  char* token;
+  struct standin_inode* inode;
+};
+static struct standin_root* roots;
+static size_t nroots;
+
+static uint32_t standin_hash(const char* name) {
+  uint32_t hash = 2166136261u;
+  for (; *name; name++) {
+    hash = (hash ^ (unsigned char)*name) * 16777619u;
+  }
+  return hash;
+}
+
+static struct standin_inode* standin_new_inode(enum standin_type type) {
+  if ((size_t)next_no >= ninodes) {
+    size_t n = ninodes == 0 ? 1024 : 2 * ninodes;
+    struct standin_inode** bigger = realloc(inodes, n * sizeof(*inodes));
+    if (bigger == NULL) {
+      return NULL;
+    }
+    memset(bigger + ninodes, 0, (n - ninodes) * sizeof(*inodes));
+    inodes = bigger;
+    ninodes = n;
+  }
+  struct standin_inode* inode = calloc(1, sizeof(*inode));
+  if (inode == NULL) {
+    return NULL;
+  }
+  inode->no = next_no++;
+  inode->type = type;
+  inodes[inode->no] = inode;
+  return inode;
+}
+
+struct standin_inode* standin_fs_root(const char* token, bool create) {
+  for (size_t i = 0; i < nroots; i++) {
+    if (strcmp(roots[i].token, token) == 0) {
+      return roots[i].inode;
+    }
+  }
+  if (!create) {
+    return NULL;
+  }
+  struct standin_root* bigger = realloc(roots, (nroots + 1) * sizeof(*roots));
+  if (bigger == NULL) {
+    return NULL;
+  }
+  roots = bigger;
+  char* copy = strdup(token);
+  struct standin_inode* root = copy == NULL ? NULL : standin_new_inode(STANDIN_DIR);
+  if (root == NULL) {
+    free(copy);
+    return NULL;
+  }
+  roots[nroots].token = copy;
+  roots[nroots++].inode = root;
+  return root;
+}
+
+struct standin_inode* standin_fs_inode(int64_t no) {
+  if (no <= 0 || (uint64_t)no >= ninodes) {
+    return NULL;
+  }
+  return inodes[no];
+}
+
+struct standin_dentry* standin_fs_lookup(struct standin_inode* dir, const char* name) {
+  if (dir->dir.count == 0) {
+    return NULL;
+  }
+  uint32_t hash = standin_hash(name);
+  struct standin_dentry* dentry = dir->dir.table[hash & (dir->dir.buckets - 1)];
+  for (; dentry != NULL; dentry = dentry->next) {
+    if (dentry->hash == hash && strcmp(dentry->name, name) == 0) {
+      return dentry;
+    }
+  }
+  return NULL;
+}
+
+// doubles the buckets once there are as many entries, rehashing every chain
+static bool standin_dir_grow(struct standin_dir* dir) {
+  if (dir->count < dir->buckets) {
+    return true;
+  }
+  size_t n = dir->buckets == 0 ? STANDIN_MIN_BUCKETS : 2 * dir->buckets;
+  struct standin_dentry** table = calloc(n, sizeof(*table));
+  if (table == NULL) {
+    return false;
+  }
+  for (size_t i = 0; i < dir->buckets; i++) {
+    struct standin_dentry* next;
+    for (struct standin_dentry* d = dir->table[i]; d != NULL; d = next) {
+      next = d->next;
+      d->next = table[d->hash & (n - 1)];
+      table[d->hash & (n - 1)] = d;
+    }
+  }
+  free(dir->table);
+  dir->table = table;
+  dir->buckets = n;
+  return true;
+}
+
+// squeezes the holes out of the id order once they are half of it
+static void standin_dir_compact(struct standin_dir* dir) {
+  if (dir->holes * 2 < dir->norder) {
+    return;
+  }
+  size_t n = 0;
+  for (size_t i = 0; i < dir->norder; i++) {
+    if (dir->order[i] != NULL) {
+      dir->order[n] = dir->order[i];
+      dir->ids[n++] = dir->ids[i];
+    }
+  }
+  dir->norder = n;
+  dir->holes = 0;
+}
+
+// finds the first slot with an id above after
+static size_t standin_dir_seek(struct standin_dir* dir, uint64_t after) {
+  size_t lo = 0;
+  size_t hi = dir->norder;
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (dir->ids[mid] <= after) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return lo;
+}
+
+// puts dentry into the table and at its id in the order, which is the end unless it comes back
+static bool standin_dir_insert(struct standin_dir* dir, struct standin_dentry* dentry) {
+  if (!standin_dir_grow(dir)) {
+    return false;
+  }
+  size_t at = standin_dir_seek(dir, dentry->id);
+  if (at > 0 && dir->ids[at - 1] == dentry->id) {
+    // its slot is still there as a hole
+    dir->order[at - 1] = dentry;
+    dir->holes--;
+  } else {
+    if (dir->norder == dir->capacity) {
+      size_t n = dir->capacity == 0 ? STANDIN_MIN_BUCKETS : 2 * dir->capacity;
+      struct standin_dentry** order = realloc(dir->order, n * sizeof(*order));
+      if (order == NULL) {
+        return false;
+      }
+      dir->order = order;
+      uint64_t* ids = realloc(dir->ids, n * sizeof(*ids));
+      if (ids == NULL) {
+        return false;
+      }
+      dir->ids = ids;
+      dir->capacity = n;
+    }
+    memmove(dir->order + at + 1, dir->order + at, (dir->norder - at) * sizeof(*dir->order));
+    memmove(dir->ids + at + 1, dir->ids + at, (dir->norder - at) * sizeof(*dir->ids));
+    dir->order[at] = dentry;
+    dir->ids[at] = dentry->id;
+    dir->norder++;
+  }
+  size_t bucket = dentry->hash & (dir->buckets - 1);
+  dentry->next = dir->table[bucket];
+  dir->table[bucket] = dentry;
+  dir->count++;
+  return true;
+}
+
+enum standin_status standin_fs_create(
+    struct standin_inode* dir, const char* name, enum standin_type type, struct standin_dentry** out
+) {
+  if (dir->type != STANDIN_DIR) {
+    return STANDIN_NOTDIR;
+  }
+  if (standin_fs_lookup(dir, name) != NULL) {
+    return STANDIN_DUPLICATE;
+  }
+  size_t len = strlen(name);
+  struct standin_dentry* dentry = malloc(sizeof(*dentry) + len + 1);
+  if (dentry == NULL) {
+    return STANDIN_UNKNOWN;
+  }
+  memcpy(dentry->name, name, len + 1);
+  dentry->hash = standin_hash(name);
+  dentry->id = next_id++;
+  dentry->parent = dir;
+  dentry->inode = standin_new_inode(type);
+  if (dentry->inode == NULL || !standin_dir_insert(&dir->dir, dentry)) {
+    if (dentry->inode != NULL) {
+      inodes[dentry->inode->no] = NULL;
+      free(dentry->inode);
+    }
+    free(dentry);
+    return STANDIN_UNKNOWN;
+  }
+  *out = dentry;
+  return STANDIN_OK;
+}
+
+enum standin_status standin_fs_detach(
+    struct standin_inode* dir, const char* name, struct standin_dentry** out
+) {
+  if (dir->type != STANDIN_DIR) {
+    return STANDIN_NOTDIR;
+  }
+  if (dir->dir.count == 0) {
+    return STANDIN_MISSING;
+  }
+  uint32_t hash = standin_hash(name);
+  struct standin_dentry** link = &dir->dir.table[hash & (dir->dir.buckets - 1)];
+  for (; *link != NULL; link = &(*link)->next) {
+    struct standin_dentry* dentry = *link;
+    if (dentry->hash != hash || strcmp(dentry->name, name) != 0) {
+      continue;
+    }
+    *link = dentry->next;
+    dir->dir.count--;
+    size_t at = standin_dir_seek(&dir->dir, dentry->id) - 1;
+    dir->dir.order[at] = NULL;
+    dir->dir.holes++;
+    standin_dir_compact(&dir->dir);
+    *out = dentry;
+    return STANDIN_OK;
+  }
+  return STANDIN_MISSING;
+}
+
+bool standin_fs_reattach(struct standin_dentry* dentry) {
+  return standin_dir_insert(&dentry->parent->dir, dentry);
+}
+
+void standin_fs_free(struct standin_dentry* dentry) {
+  struct standin_inode* inode = dentry->inode;
+  struct standin_dir* dir = &inode->dir;
+  for (size_t i = 0; i < dir->norder; i++) {
+    if (dir->order[i] != NULL) {
+      standin_fs_free(dir->order[i]);
+    }
+  }
+  free(dir->table);
+  free(dir->order);
+  free(dir->ids);
+  free(inode->data);
+  inodes[inode->no] = NULL;
+  free(inode);
+  free(dentry);
+}
+
+size_t standin_fs_page(
+    struct standin_inode* dir, uint64_t after, struct standin_dentry** out, size_t max, bool* more
+) {
+  size_t n = 0;
+  *more = false;
+  for (size_t i = standin_dir_seek(&dir->dir, after); i < dir->dir.norder; i++) {
+    if (dir->dir.order[i] == NULL) {
+      continue;
+    }
+    if (n == max) {
+      *more = true;
+      break;
+    }
+    out[n++] = dir->dir.order[i];
+  }
+  return n;
+}
+
+void standin_fs_each(
+    struct standin_inode* dir, void (*fn)(struct standin_dentry* dentry, void* arg), void* arg
+) {
+  for (size_t i = 0; i < dir->dir.norder; i++) {
+    if (dir->dir.order[i] != NULL) {
+      fn(dir->dir.order[i], arg);
+    }
+  }
+}
+
+// room for end bytes, what is past the size reads as zeroes
+static bool standin_fs_reserve(struct standin_inode* file, size_t end) {
+  if (end <= file->capacity) {
+    return true;
+  }
+  size_t n = file->capacity == 0 ? 4096 : file->capacity;
+  while (n < end) {
+    n *= 2;
+  }
+  char* bigger = realloc(file->data, n);
+  if (bigger == NULL) {
+    return false;
+  }
+  memset(bigger + file->capacity, 0, n - file->capacity);
+  file->data = bigger;
+  file->capacity = n;
+  return true;
+}
+
+bool standin_fs_write(struct standin_inode* file, uint64_t offset, const char* data, size_t len) {
+  size_t end = offset + len;
+  if (!standin_fs_reserve(file, end)) {
+    return false;
+  }
+  memcpy(file->data + offset, data, len);
+  if (end > file->size) {
+    file->size = end;
+  }
+  return true;
+}
+
+bool standin_fs_truncate(struct standin_inode* file, uint64_t size) {
+  if (size < file->size) {
+    memset(file->data + size, 0, file->size - size);
+  } else if (!standin_fs_reserve(file, size)) {
+    return false;
+  }
+  file->size = size;
+  return true;
+}
@@ -0,0 +1,84 @@
+#ifndef __FSMOD_STANDIN_FS_H_
+#define __FSMOD_STANDIN_FS_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* ErrStatus of the Spring server, every response starts with it */
+enum standin_status {
+  STANDIN_OK,
+  STANDIN_MISSING,
+  STANDIN_NOTDIR,
+  STANDIN_ISDIR,
+  STANDIN_EMPTY,
+  STANDIN_UNKNOWN,
+  STANDIN_DUPLICATE,
+};
+
+/* InodeType */
+enum standin_type {
+  STANDIN_REG,
+  STANDIN_DIR,
+};
+
+struct standin_dentry;
+
+/* Entries of a directory by name, and by id for paging in the order they were made */
+struct standin_dir {
+  struct standin_dentry** table; /* chained by hash */
+  size_t buckets;                /* power of two */
+  size_t count;
+  struct standin_dentry** order; /* by id, NULL where one was removed */
+  uint64_t* ids;                 /* id of every slot in order, holes included */
+  size_t norder;
+  size_t capacity;
+  size_t holes;
+};
+
+struct standin_inode {
+  int32_t no;
+  enum standin_type type;
+  size_t size;
+  char* data; /* file contents, capacity bytes of it allocated */
+  size_t capacity;
+  struct standin_dir dir;
+};
+
+struct standin_dentry {
+  uint64_t id; /* children cursor, grows with every entry made */
+  uint32_t hash;
+  struct standin_dentry* next; /* in the bucket */
+  struct standin_inode* parent;
+  struct standin_inode* inode;
+  char name[];
+};
+
+/* Root of the tree of token, made on first use unless only existing ones are wanted */
+struct standin_inode* standin_fs_root(const char* token, bool create);
+struct standin_inode* standin_fs_inode(int64_t no);
+struct standin_dentry* standin_fs_lookup(struct standin_inode* dir, const char* name);
+enum standin_status standin_fs_create(
+    struct standin_inode* dir, const char* name, enum standin_type type, struct standin_dentry** out
+);
+/* Takes the entry out of its directory, the caller frees it or puts it back at its old place */
+enum standin_status standin_fs_detach(
+    struct standin_inode* dir, const char* name, struct standin_dentry** out
+);
+bool standin_fs_reattach(struct standin_dentry* dentry);
+/* Frees the entry and everything under it */
+void standin_fs_free(struct standin_dentry* dentry);
+/* Up to max entries with an id above after, returns how many. more says whether any follow. */
+size_t standin_fs_page(
+    struct standin_inode* dir, uint64_t after, struct standin_dentry** out, size_t max, bool* more
+);
+/* Calls fn on the live entries of dir in id order */
+void standin_fs_each(
+    struct standin_inode* dir, void (*fn)(struct standin_dentry* dentry, void* arg), void* arg
+);
+/* Returns false if there is no memory for it */
+bool standin_fs_write(struct standin_inode* file, uint64_t offset, const char* data, size_t len);
+/* Sets the size, what is cut off reads as zeroes if the file grows again */
+bool standin_fs_truncate(struct standin_inode* file, uint64_t size);
+
+#endif  // __FSMOD_STANDIN_FS_H_
@@ -0,0 +1,738 @@
+#include "proto.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "fs.h"
+
+/* Entries in a page of /children, the same as ChildrenDto.PAGE_SZ */
+#define STANDIN_PAGE_SZ 28
+/* Names in a DentryDto are zero padded to this */
+#define STANDIN_DENTRY_NAME_SZ 128
+/* Files are kept in memory whole, this bounds one */
+#define STANDIN_MAX_FILE_SZ INT32_MAX
+/* Most bytes one read may ask for, the same as DataResponse.MAX_LENGTH */
+#define STANDIN_MAX_READ (1 << 20)
+/* VersionDto.CURRENT, the revision of the protocol served */
+#define STANDIN_VERSION 2
+/* InodeDto on the wire, the size is an int64 */
+#define STANDIN_INODE_SZ (2 * sizeof(int32_t) + sizeof(int64_t))
+/* ino, offset and length of a write, each le64 */
+#define STANDIN_WRITE_HEADER_SZ 24
+
+/* One lock for the whole tree, lookups and reads share it */
+static pthread_rwlock_t tree_lock = PTHREAD_RWLOCK_INITIALIZER;
+
+/* Undo log of an atomic batch. A created entry is removed again, a removed one put back. */
+struct standin_undo {
+  struct {
+    bool created;
+    struct standin_dentry* dentry;
+  }* at;
+  size_t n;
+};
+
+struct standin_method {
+  const char* name;
+  bool writes; /* takes the tree lock for writing */
+  int (*run)(
+      const struct standin_args* args, const char* body, size_t body_len, struct standin_buf* out,
+      struct standin_undo* undo
+  );
+  bool batchable; /* BatchService runs it */
+  atomic_ulong served;
+};
+
+bool standin_reserve(struct standin_buf* buf, size_t len) {
+  if (buf->len + len <= buf->cap) {
+    return true;
+  }
+  size_t cap = buf->cap == 0 ? 256 : 2 * buf->cap;
+  while (cap < buf->len + len) {
+    cap *= 2;
+  }
+  char* data = realloc(buf->data, cap);
+  if (data == NULL) {
+    return false;
+  }
+  buf->data = data;
+  buf->cap = cap;
+  return true;
+}
+
+bool standin_put(struct standin_buf* buf, const void* data, size_t len) {
+  if (!standin_reserve(buf, len)) {
+    return false;
+  }
+  memcpy(buf->data + buf->len, data, len);
+  buf->len += len;
+  return true;
+}
+
+bool standin_put_le32(struct standin_buf* buf, uint32_t value) {
+  unsigned char bytes[4];
+  for (int i = 0; i < 4; i++) {
+    bytes[i] = value >> (8 * i);
+  }
+  return standin_put(buf, bytes, sizeof(bytes));
+}
+
+bool standin_put_le64(struct standin_buf* buf, uint64_t value) {
+  unsigned char bytes[8];
+  for (int i = 0; i < 8; i++) {
+    bytes[i] = value >> (8 * i);
+  }
+  return standin_put(buf, bytes, sizeof(bytes));
+}
+
+// a count that is only known once what it counts is written
+static void standin_patch_le32(struct standin_buf* buf, size_t at, uint32_t value) {
+  for (int i = 0; i < 4; i++) {
+    buf->data[at + i] = value >> (8 * i);
+  }
+}
+
+static int standin_hex(char c) {
+  if (c >= '0' && c <= '9') {
+    return c - '0';
+  }
+  if (c >= 'a' && c <= 'f') {
+    return c - 'a' + 10;
+  }
+  if (c >= 'A' && c <= 'F') {
+    return c - 'A' + 10;
+  }
+  return -1;
+}
+
+// %XX and + the way URLDecoder takes them, in place
+static void standin_decode(char* s) {
+  char* out = s;
+  for (; *s; s++) {
+    if (*s == '+') {
+      *out++ = ' ';
+    } else if (*s == '%' && standin_hex(s[1]) >= 0 && standin_hex(s[2]) >= 0) {
+      *out++ = standin_hex(s[1]) << 4 | standin_hex(s[2]);
+      s += 2;
+    } else {
+      *out++ = *s;
+    }
+  }
+  *out = '\0';
+}
+
+bool standin_parse_query(char* query, struct standin_args* args) {
+  args->n = 0;
+  while (query != NULL && *query) {
+    char* pair = query;
+    query = strchr(query, '&');
+    if (query != NULL) {
+      *query++ = '\0';
+    }
+    if (*pair == '\0') {
+      continue;
+    }
+    if (args->n == STANDIN_MAX_ARGS) {
+      return false;
+    }
+    char* value = strchr(pair, '=');
+    if (value != NULL) {
+      *value++ = '\0';
+    } else {
+      value = pair + strlen(pair);
+    }
+    standin_decode(pair);
+    standin_decode(value);
+    args->keys[args->n] = pair;
+    args->values[args->n++] = value;
+  }
+  return true;
+}
+
+const char* standin_arg(const struct standin_args* args, const char* key) {
+  for (int i = 0; i < args->n; i++) {
+    if (strcmp(args->keys[i], key) == 0) {
+      return args->values[i];
+    }
+  }
+  return NULL;
+}
+
+// a Long argument, Long.valueOf is as strict
+static bool standin_arg_long(const struct standin_args* args, const char* key, int64_t* out) {
+  const char* value = standin_arg(args, key);
+  if (value == NULL || *value == '\0') {
+    return false;
+  }
+  char* end;
+  errno = 0;
+  long long parsed = strtoll(value, &end, 10);
+  if (errno != 0 || *end != '\0') {
+    return false;
+  }
+  *out = parsed;
+  return true;
+}
+
+static bool standin_put_inode(struct standin_buf* out, const struct standin_inode* inode) {
+  return standin_put_le32(out, inode->no) && standin_put_le32(out, inode->type) &&
+         standin_put_le64(out, inode->size);
+}
+
+static int standin_msg(struct standin_buf* out, enum standin_status status) {
+  return standin_put_le32(out, status) ? 200 : 500;
+}
+
+static int standin_inode_msg(struct standin_buf* out, const struct standin_inode* inode) {
+  return standin_put_le32(out, STANDIN_OK) && standin_put_inode(out, inode) ? 200 : 500;
+}
+
+// the directory argument of create, lookup, remove and children, or the Msg that says why not
+static struct standin_inode* standin_dir_arg(int64_t no, struct standin_buf* out, int* status) {
+  struct standin_inode* dir = standin_fs_inode(no);
+  if (dir == NULL) {
+    *status = standin_msg(out, STANDIN_MISSING);
+  } else if (dir->type != STANDIN_DIR) {
+    *status = standin_msg(out, STANDIN_NOTDIR);
+    dir = NULL;
+  }
+  return dir;
+}
+
+static int standin_mount(
+    const struct standin_args* args, const char* body, size_t body_len, struct standin_buf* out,
+    struct standin_undo* undo
+) {
+  // clients from before versions send none
+  int64_t version = 1;
+  if (standin_arg(args, "version") != NULL && !standin_arg_long(args, "version", &version)) {
+    return 400;
+  }
+  if (version != STANDIN_VERSION) {
+    return standin_msg(out, STANDIN_UNKNOWN);
+  }
+  struct standin_inode* root = standin_fs_root(standin_arg(args, "token"), true);
+  if (root == NULL) {
+    return 500;
+  }
+  int status = standin_inode_msg(out, root);
+  return status == 200 && standin_put_le32(out, STANDIN_VERSION) ? 200 : 500;
+}
+
+/* Directories of one level of a snapshot */
+struct standin_level {
+  struct standin_inode** dirs;
+  size_t n;
+  size_t cap;
+};
+
+static void standin_snapshot_size(struct standin_dentry* dentry, void* arg) {
+  *(size_t*)arg += STANDIN_INODE_SZ + sizeof(int32_t) + strlen(dentry->name);
+}
+
+struct standin_snapshot_ctx {
+  struct standin_buf* out;
+  struct standin_level* next;
+  bool failed;
+};
+
+static void standin_snapshot_entry(struct standin_dentry* dentry, void* arg) {
+  struct standin_snapshot_ctx* ctx = arg;
+  size_t len = strlen(dentry->name);
+  ctx->failed |= !standin_put_inode(ctx->out, dentry->inode) ||
+                 !standin_put_le32(ctx->out, len) || !standin_put(ctx->out, dentry->name, len);
+  if (dentry->inode->type != STANDIN_DIR) {
+    return;
+  }
+  struct standin_level* next = ctx->next;
+  if (next->n == next->cap) {
+    size_t cap = next->cap == 0 ? 64 : 2 * next->cap;
+    struct standin_inode** dirs = realloc(next->dirs, cap * sizeof(*dirs));
+    if (dirs == NULL) {
+      ctx->failed = true;
+      return;
+    }
+    next->dirs = dirs;
+    next->cap = cap;
+  }
+  next->dirs[next->n++] = dentry->inode;
+}
+
+// breadth first like FileService.snapshot, stops before the directory that would pass limit
+static int standin_snapshot(
+    const struct standin_args* args, const char* body, size_t body_len, struct standin_buf* out,
+    struct standin_undo* undo
+) {
+  int64_t depth;
+  int64_t limit;
+  if (!standin_arg_long(args, "depth", &depth) || !standin_arg_long(args, "limit", &limit)) {
+    return 400;
+  }
+  struct standin_inode* root = standin_fs_root(standin_arg(args, "token"), false);
+  if (root == NULL) {
+    return standin_msg(out, STANDIN_MISSING);
+  }
+  if (!standin_put_le32(out, STANDIN_OK)) {
+    return 500;
+  }
+  // the count of directories is filled in at the end
+  size_t count_at = out->len;
+  uint32_t ndirs = 0;
+  if (!standin_put_le32(out, 0)) {
+    return 500;
+  }
+
+  struct standin_level level = {0};
+  struct standin_level next = {0};
+  struct standin_snapshot_ctx ctx = {.out = out, .next = &next};
+  int status = 200;
+  size_t size = 2 * sizeof(int32_t);
+  if ((level.dirs = malloc(sizeof(*level.dirs))) != NULL) {
+    level.dirs[0] = root;
+    level.n = level.cap = 1;
+  } else {
+    status = 500;
+  }
+  bool full = false;
+  for (int64_t i = 0; i < depth && level.n > 0 && !full && status == 200; i++) {
+    next.n = 0;
+    for (size_t d = 0; d < level.n; d++) {
+      struct standin_inode* dir = level.dirs[d];
+      size_t dir_size = 2 * sizeof(int32_t);
+      standin_fs_each(dir, standin_snapshot_size, &dir_size);
+      size += dir_size;
+      if (size > (uint64_t)limit) {
+        full = true;
+        break;
+      }
+      ctx.failed |= !standin_put_le32(out, dir->no) || !standin_put_le32(out, dir->dir.count);
+      standin_fs_each(dir, standin_snapshot_entry, &ctx);
+      if (ctx.failed) {
+        status = 500;
+        break;
+      }
+      ndirs++;
+    }
+    struct standin_level swap = level;
+    level = next;
+    next = swap;
+  }
+  free(level.dirs);
+  free(next.dirs);
+  standin_patch_le32(out, count_at, ndirs);
+  return status;
+}
+
+static int standin_create(
+    const struct standin_args* args, const char* body, size_t body_len, struct standin_buf* out,
+    struct standin_undo* undo
+) {
+  int64_t no;
+  const char* name = standin_arg(args, "name");
+  const char* type = standin_arg(args, "type");
+  if (!standin_arg_long(args, "dir", &no) || name == NULL || type == NULL) {
+    return 400;
+  }
+  enum standin_type parsed;
+  if (strcmp(type, "REG") == 0) {
+    parsed = STANDIN_REG;
+  } else if (strcmp(type, "DIR") == 0) {
+    parsed = STANDIN_DIR;
+  } else {
+    return 400;
+  }
+  int status;
+  struct standin_inode* dir = standin_dir_arg(no, out, &status);
+  if (dir == NULL) {
+    return status;
+  }
+  struct standin_dentry* dentry;
+  enum standin_status created = standin_fs_create(dir, name, parsed, &dentry);
+  if (created != STANDIN_OK) {
+    return standin_msg(out, created);
+  }
+  if (undo != NULL) {
+    undo->at[undo->n].created = true;
+    undo->at[undo->n++].dentry = dentry;
+  }
+  return standin_inode_msg(out, dentry->inode);
+}
+
+static int standin_lookup(
+    const struct standin_args* args, const char* body, size_t body_len, struct standin_buf* out,
+    struct standin_undo* undo
+) {
+  int64_t no;
+  const char* name = standin_arg(args, "name");
+  if (!standin_arg_long(args, "dir", &no) || name == NULL) {
+    return 400;
+  }
+  int status;
+  struct standin_inode* dir = standin_dir_arg(no, out, &status);
+  if (dir == NULL) {
+    return status;
+  }
+  struct standin_dentry* dentry = standin_fs_lookup(dir, name);
+  if (dentry == NULL) {
+    return standin_msg(out, STANDIN_MISSING);
+  }
+  return standin_inode_msg(out, dentry->inode);
+}
+
+static int standin_getattr(
+    const struct standin_args* args, const char* body, size_t body_len, struct standin_buf* out,
+    struct standin_undo* undo
+) {
+  int64_t no;
+  if (!standin_arg_long(args, "ino", &no)) {
+    return 400;
+  }
+  struct standin_inode* inode = standin_fs_inode(no);
+  if (inode == NULL) {
+    return standin_msg(out, STANDIN_MISSING);
+  }
+  return standin_inode_msg(out, inode);
+}
+
+static int standin_remove(
+    const struct standin_args* args, const char* body, size_t body_len, struct standin_buf* out,
+    struct standin_undo* undo
+) {
+  int64_t no;
+  const char* name = standin_arg(args, "name");
+  if (!standin_arg_long(args, "dir", &no) || name == NULL) {
+    return 400;
+  }
+  int status;
+  struct standin_inode* dir = standin_dir_arg(no, out, &status);
+  if (dir == NULL) {
+    return status;
+  }
+  struct standin_dentry* dentry;
+  enum standin_status removed = standin_fs_detach(dir, name, &dentry);
+  if (removed != STANDIN_OK) {
+    return standin_msg(out, removed);
+  }
+  if (undo != NULL) {
+    // freed once the batch commits
+    undo->at[undo->n].created = false;
+    undo->at[undo->n++].dentry = dentry;
+  } else {
+    standin_fs_free(dentry);
+  }
+  return standin_msg(out, STANDIN_OK);
+}
+
+static int standin_children(
+    const struct standin_args* args, const char* body, size_t body_len, struct standin_buf* out,
+    struct standin_undo* undo
+) {
+  int64_t no;
+  int64_t after = 0;
+  if (!standin_arg_long(args, "dir", &no) ||
+      (standin_arg(args, "after") != NULL && !standin_arg_long(args, "after", &after))) {
+    return 400;
+  }
+  int status;
+  struct standin_inode* dir = standin_dir_arg(no, out, &status);
+  if (dir == NULL) {
+    return status;
+  }
+  struct standin_dentry* page[STANDIN_PAGE_SZ];
+  bool more;
+  size_t n = standin_fs_page(dir, after, page, STANDIN_PAGE_SZ, &more);
+  uint64_t next = more ? page[n - 1]->id : 0;
+  if (!standin_put_le32(out, STANDIN_OK) || !standin_put_le32(out, n) ||
+      !standin_put_le64(out, next)) {
+    return 500;
+  }
+  for (size_t i = 0; i < n; i++) {
+    size_t len = strlen(page[i]->name);
+    if (!standin_put(out, page[i]->name, len)) {
+      return 500;
+    }
+    if (len < STANDIN_DENTRY_NAME_SZ) {
+      if (!standin_reserve(out, STANDIN_DENTRY_NAME_SZ - len)) {
+        return 500;
+      }
+      memset(out->data + out->len, 0, STANDIN_DENTRY_NAME_SZ - len);
+      out->len += STANDIN_DENTRY_NAME_SZ - len;
+    }
+    if (!standin_put_inode(out, page[i]->inode)) {
+      return 500;
+    }
+  }
+  return 200;
+}
+
+static int standin_read(
+    const struct standin_args* args, const char* body, size_t body_len, struct standin_buf* out,
+    struct standin_undo* undo
+) {
+  int64_t no;
+  int64_t offset;
+  int64_t length;
+  if (!standin_arg_long(args, "ino", &no) || !standin_arg_long(args, "offset", &offset) ||
+      !standin_arg_long(args, "length", &length) || offset < 0 || length < 0 ||
+      length > STANDIN_MAX_READ) {
+    return 400;
+  }
+  struct standin_inode* file = standin_fs_inode(no);
+  if (file == NULL) {
+    return standin_msg(out, STANDIN_MISSING);
+  }
+  if (file->type != STANDIN_REG) {
+    return standin_msg(out, STANDIN_ISDIR);
+  }
+  uint64_t end = (uint64_t)offset + length;
+  if (end > file->size) {
+    end = file->size;
+  }
+  if ((uint64_t)offset >= end) {
+    return standin_msg(out, STANDIN_EMPTY);
+  }
+  size_t len = end - offset;
+  return standin_put_le32(out, STANDIN_OK) && standin_put_le32(out, len) &&
+                 standin_put(out, file->data + offset, len)
+             ? 200
+             : 500;
+}
+
+static uint32_t standin_le32(const char* bytes) {
+  uint32_t value = 0;
+  for (int i = 3; i >= 0; i--) {
+    value = value << 8 | (unsigned char)bytes[i];
+  }
+  return value;
+}
+
+static uint64_t standin_le64(const char* bytes) {
+  uint64_t value = 0;
+  for (int i = 7; i >= 0; i--) {
+    value = value << 8 | (unsigned char)bytes[i];
+  }
+  return value;
+}
+
+static int standin_write(
+    const struct standin_args* args, const char* body, size_t body_len, struct standin_buf* out,
+    struct standin_undo* undo
+) {
+  if (body_len < STANDIN_WRITE_HEADER_SZ) {
+    return 400;
+  }
+  int64_t no = standin_le64(body);
+  uint64_t offset = standin_le64(body + 8);
+  uint64_t length = standin_le64(body + 16);
+  if (length != body_len - STANDIN_WRITE_HEADER_SZ || offset > STANDIN_MAX_FILE_SZ ||
+      length > STANDIN_MAX_FILE_SZ - offset) {
+    return 400;
+  }
+  struct standin_inode* file = standin_fs_inode(no);
+  if (file == NULL) {
+    return standin_msg(out, STANDIN_MISSING);
+  }
+  if (file->type != STANDIN_REG) {
+    return standin_msg(out, STANDIN_ISDIR);
+  }
+  if (!standin_fs_write(file, offset, body + STANDIN_WRITE_HEADER_SZ, length)) {
+    return 500;
+  }
+  return standin_msg(out, STANDIN_OK);
+}
+
+static int standin_truncate(
+    const struct standin_args* args, const char* body, size_t body_len, struct standin_buf* out,
+    struct standin_undo* undo
+) {
+  int64_t no;
+  int64_t size;
+  if (!standin_arg_long(args, "ino", &no) || !standin_arg_long(args, "size", &size) || size < 0 ||
+      size > STANDIN_MAX_FILE_SZ) {
+    return 400;
+  }
+  struct standin_inode* file = standin_fs_inode(no);
+  if (file == NULL) {
+    return standin_msg(out, STANDIN_MISSING);
+  }
+  if (file->type != STANDIN_REG) {
+    return standin_msg(out, STANDIN_ISDIR);
+  }
+  if (!standin_fs_truncate(file, size)) {
+    return 500;
+  }
+  return standin_msg(out, STANDIN_OK);
+}
+
+static int standin_batch(
+    const struct standin_args* args, const char* body, size_t body_len, struct standin_buf* out,
+    struct standin_undo* undo
+);
+
+static struct standin_method methods[] = {
+    {"mount", true, standin_mount, false},
+    {"snapshot", false, standin_snapshot, false},
+    {"create", true, standin_create, true},
+    {"lookup", false, standin_lookup, true},
+    {"getattr", false, standin_getattr, true},
+    {"remove", true, standin_remove, true},
+    {"children", false, standin_children, true},
+    {"read", false, standin_read, false},
+    {"write", true, standin_write, false},
+    {"truncate", true, standin_truncate, false},
+    {"batch", true, standin_batch, false},
+};
+
+static struct standin_method* standin_method(const char* name) {
+  for (size_t i = 0; i < sizeof(methods) / sizeof(*methods); i++) {
+    if (strcmp(methods[i].name, name) == 0) {
+      return &methods[i];
+    }
+  }
+  return NULL;
+}
+
+// puts back what an atomic batch did, newest first
+static void standin_rollback(struct standin_undo* undo) {
+  while (undo->n > 0) {
+    struct standin_dentry* dentry = undo->at[--undo->n].dentry;
+    if (undo->at[undo->n].created) {
+      standin_fs_detach(dentry->parent, dentry->name, &dentry);
+      standin_fs_free(dentry);
+    } else {
+      standin_fs_reattach(dentry);
+    }
+  }
+}
+
+// frees what an atomic batch removed
+static void standin_commit(struct standin_undo* undo) {
+  for (size_t i = 0; i < undo->n; i++) {
+    if (!undo->at[i].created) {
+      standin_fs_free(undo->at[i].dentry);
+    }
+  }
+  undo->n = 0;
+}
+
+// one op, le32 length and then "method?query", into results. Bad ones answer UNKNOWN.
+static enum standin_status standin_batch_op(
+    const char* op, size_t len, struct standin_buf* results, struct standin_undo* undo
+) {
+  char* query = strndup(op, len);
+  if (query == NULL) {
+    return STANDIN_UNKNOWN;
+  }
+  char* params = strchr(query, '?');
+  if (params != NULL) {
+    *params++ = '\0';
+  }
+  struct standin_args args;
+  struct standin_method* method = standin_method(query);
+  // the length of the result is filled in after it
+  size_t len_at = results->len;
+  int status = standin_put_le32(results, 0) ? 400 : 500;
+  if (status == 400 && method != NULL && method->batchable &&
+      standin_parse_query(params, &args)) {
+    status = method->run(&args, NULL, 0, results, undo);
+  }
+  free(query);
+  if (status != 200) {
+    results->len = len_at + sizeof(int32_t);
+    if (!standin_put_le32(results, STANDIN_UNKNOWN)) {
+      results->len = len_at;
+      return STANDIN_UNKNOWN;
+    }
+  }
+  standin_patch_le32(results, len_at, results->len - len_at - sizeof(int32_t));
+  return standin_le32(results->data + len_at + sizeof(int32_t));
+}
+
+static int standin_batch(
+    const struct standin_args* args, const char* body, size_t body_len, struct standin_buf* out,
+    struct standin_undo* undo
+) {
+  const char* atomic = standin_arg(args, "atomic");
+  struct standin_undo log = {0};
+  if (atomic != NULL && strcmp(atomic, "true") == 0) {
+    undo = &log;
+  } else if (atomic != NULL && strcmp(atomic, "false") != 0) {
+    return 400;
+  }
+  // every op is checked before any runs, a truncated body changes nothing
+  size_t nops = 0;
+  for (size_t pos = 0; pos < body_len; nops++) {
+    if (body_len - pos < sizeof(int32_t)) {
+      return 400;
+    }
+    uint32_t len = standin_le32(body + pos);
+    if (len > INT32_MAX || body_len - pos - sizeof(int32_t) < len) {
+      return 400;
+    }
+    pos += sizeof(int32_t) + len;
+  }
+  if (undo != NULL && nops > 0 && (log.at = malloc(nops * sizeof(*log.at))) == NULL) {
+    return 500;
+  }
+
+  struct standin_buf results = {0};
+  enum standin_status top = STANDIN_OK;
+  uint32_t count = 0;
+  for (size_t pos = 0; pos < body_len; count++) {
+    uint32_t len = standin_le32(body + pos);
+    enum standin_status status =
+        standin_batch_op(body + pos + sizeof(int32_t), len, &results, undo);
+    pos += sizeof(int32_t) + len;
+    if (undo != NULL && status != STANDIN_OK) {
+      // nothing of the batch stays, the last result tells which op it was
+      standin_rollback(undo);
+      top = status;
+      count++;
+      break;
+    }
+  }
+  if (undo != NULL) {
+    standin_commit(undo);
+  }
+  free(log.at);
+  bool ok = standin_put_le32(out, top) && standin_put_le32(out, count) &&
+            standin_put(out, results.data, results.len);
+  free(results.data);
+  return ok ? 200 : 500;
+}
+
+int standin_handle(
+    const char* name, const struct standin_args* args, const char* body, size_t body_len,
+    struct standin_buf* out
+) {
+  struct standin_method* method = standin_method(name);
+  if (method == NULL) {
+    return 404;
+  }
+  // the token is required everywhere, as a @RequestParam of every mapping
+  if (standin_arg(args, "token") == NULL) {
+    return 400;
+  }
+  if (method->writes) {
+    pthread_rwlock_wrlock(&tree_lock);
+  } else {
+    pthread_rwlock_rdlock(&tree_lock);
+  }
+  size_t start = out->len;
+  int status = method->run(args, body, body_len, out, NULL);
+  pthread_rwlock_unlock(&tree_lock);
+  if (status != 200) {
+    out->len = start;
+  }
+  atomic_fetch_add_explicit(&method->served, 1, memory_order_relaxed);
+  return status;
+}
+
+void standin_print_stats(FILE* out) {
+  for (size_t i = 0; i < sizeof(methods) / sizeof(*methods); i++) {
+    fprintf(out, "%-10s %12lu\n", methods[i].name, atomic_load(&methods[i].served));
+  }
+}
@@ -0,0 +1,45 @@
+#ifndef __FSMOD_STANDIN_PROTO_H_
+#define __FSMOD_STANDIN_PROTO_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/* Most arguments any method takes, with room for ones it ignores */
+#define STANDIN_MAX_ARGS 8
+
+/* A growing buffer responses are written into */
+struct standin_buf {
+  char* data;
+  size_t len;
+  size_t cap;
+};
+
+/* Returns false if there is no memory for it */
+bool standin_reserve(struct standin_buf* buf, size_t len);
+bool standin_put(struct standin_buf* buf, const void* data, size_t len);
+bool standin_put_le32(struct standin_buf* buf, uint32_t value);
+bool standin_put_le64(struct standin_buf* buf, uint64_t value);
+
+/* Arguments of a request the way they came in its query, decoded */
+struct standin_args {
+  int n;
+  const char* keys[STANDIN_MAX_ARGS];
+  const char* values[STANDIN_MAX_ARGS];
+};
+
+/* Splits and decodes query in place. Returns false if it has too many arguments. */
+bool standin_parse_query(char* query, struct standin_args* args);
+const char* standin_arg(const struct standin_args* args, const char* key);
+
+/* Runs method and writes its response without the length in front into out. Returns the HTTP
+ * status, which is 200 for every request that parsed, whatever the Msg says. */
+int standin_handle(
+    const char* method, const struct standin_args* args, const char* body, size_t body_len,
+    struct standin_buf* out
+);
+/* Requests served per method so far */
+void standin_print_stats(FILE* out);
+
+#endif  // __FSMOD_STANDIN_PROTO_H_
@@ -0,0 +1,554 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "proto.h"
+
+/* Longest request line and headers taken, the client's are a few hundred bytes */
+#define STANDIN_MAX_HEAD 16384
+/* Largest body taken, well above what one write or batch of the client carries */
+#define STANDIN_MAX_BODY (64 << 20)
+#define STANDIN_READ_SZ 65536
+#define STANDIN_EVENTS 256
+
+/* Options, the same for every worker */
+static int port = 8080;
+static int nworkers = 4;
+static uint64_t latency_ns;
+static uint64_t jitter_ns;
+
+/* A response held back until the injected latency has passed */
+struct standin_pending {
+  struct standin_pending* next;
+  uint64_t due;
+  size_t len;
+  char data[];
+};
+
+struct standin_conn {
+  int fd;
+  struct standin_buf in;
+  struct standin_buf out;
+  size_t sent; /* of out */
+  bool writing; /* EPOLLOUT is armed */
+  bool closing; /* closes once out is sent */
+  bool eof;     /* the client sent all it will, only answers are left */
+  /* responses not due yet, in the order of their requests */
+  struct standin_pending* first;
+  struct standin_pending* last;
+  struct standin_conn* next_delayed; /* on the worker's list while first is set */
+  bool delayed;
+};
+
+/* One thread with its own listener and epoll, connections never move between workers */
+struct standin_worker {
+  pthread_t thread;
+  int epoll;
+  int listener;
+  int timer;
+  struct standin_conn* delayed;
+  struct standin_buf payload; /* response being built, reused */
+  uint64_t seed;
+};
+
+/* Tags epoll data of the two fds that are not connections */
+static char listener_tag;
+static char timer_tag;
+
+static uint64_t standin_now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// xorshift, only there to spread the latency
+static uint64_t standin_rand(uint64_t* state) {
+  uint64_t x = *state;
+  x ^= x << 13;
+  x ^= x >> 7;
+  x ^= x << 17;
+  return *state = x;
+}
+
+static void standin_close(struct standin_worker* w, struct standin_conn* c) {
+  if (c->delayed) {
+    struct standin_conn** link = &w->delayed;
+    while (*link != c) {
+      link = &(*link)->next_delayed;
+    }
+    *link = c->next_delayed;
+  }
+  while (c->first != NULL) {
+    struct standin_pending* next = c->first->next;
+    free(c->first);
+    c->first = next;
+  }
+  epoll_ctl(w->epoll, EPOLL_CTL_DEL, c->fd, NULL);
+  close(c->fd);
+  free(c->in.data);
+  free(c->out.data);
+  free(c);
+}
+
+static void standin_watch(struct standin_worker* w, struct standin_conn* c, bool writing) {
+  struct epoll_event ev = {
+      .events = (c->eof ? 0 : EPOLLIN) | (writing ? EPOLLOUT : 0),
+      .data.ptr = c,
+  };
+  epoll_ctl(w->epoll, EPOLL_CTL_MOD, c->fd, &ev);
+  c->writing = writing;
+}
+
+// sends what it can of out, waits for EPOLLOUT for the rest. Returns false if c was closed.
+static bool standin_flush(struct standin_worker* w, struct standin_conn* c) {
+  while (c->sent < c->out.len) {
+    ssize_t n = send(c->fd, c->out.data + c->sent, c->out.len - c->sent, MSG_NOSIGNAL);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n < 0 && errno == EAGAIN) {
+      break;
+    }
+    if (n <= 0) {
+      standin_close(w, c);
+      return false;
+    }
+    c->sent += n;
+  }
+  if (c->sent == c->out.len) {
+    c->sent = c->out.len = 0;
+    if (c->closing && c->first == NULL) {
+      standin_close(w, c);
+      return false;
+    }
+  }
+  bool writing = c->out.len > 0;
+  if (writing != c->writing) {
+    standin_watch(w, c, writing);
+  }
+  return true;
+}
+
+// moves the responses that are due from the queue to out
+static void standin_release(struct standin_conn* c, uint64_t now) {
+  while (c->first != NULL && c->first->due <= now) {
+    struct standin_pending* p = c->first;
+    if (!standin_put(&c->out, p->data, p->len)) {
+      c->closing = true;
+    }
+    c->first = p->next;
+    free(p);
+  }
+  if (c->first == NULL) {
+    c->last = NULL;
+  }
+}
+
+// points the timer at the earliest response still held back
+static void standin_arm(struct standin_worker* w) {
+  uint64_t due = 0;
+  for (struct standin_conn* c = w->delayed; c != NULL; c = c->next_delayed) {
+    if (due == 0 || c->first->due < due) {
+      due = c->first->due;
+    }
+  }
+  struct itimerspec spec = {
+      .it_value = {.tv_sec = due / 1000000000, .tv_nsec = due % 1000000000},
+  };
+  timerfd_settime(w->timer, TFD_TIMER_ABSTIME, &spec, NULL);
+}
+
+// queues a whole response, straight into out unless latency is injected
+static void standin_respond(
+    struct standin_worker* w, struct standin_conn* c, int status, const struct standin_buf* payload
+) {
+  char head[160];
+  int len;
+  if (status == 200) {
+    // the body is the le64 length and then the payload, as toSizedByteArray makes it
+    len = snprintf(
+        head, sizeof(head),
+        "HTTP/1.1 200 \r\nContent-Type: application/octet-stream\r\nContent-Length: %zu\r\n\r\n",
+        sizeof(uint64_t) + payload->len
+    );
+  } else {
+    len = snprintf(head, sizeof(head), "HTTP/1.1 %d \r\nContent-Length: 0\r\n\r\n", status);
+  }
+
+  if (latency_ns == 0 && jitter_ns == 0) {
+    bool ok = standin_put(&c->out, head, len);
+    if (ok && status == 200) {
+      ok = standin_put_le64(&c->out, payload->len) &&
+           standin_put(&c->out, payload->data, payload->len);
+    }
+    c->closing |= !ok;
+    return;
+  }
+
+  size_t total = len + (status == 200 ? sizeof(uint64_t) + payload->len : 0);
+  struct standin_pending* p = malloc(sizeof(*p) + total);
+  if (p == NULL) {
+    c->closing = true;
+    return;
+  }
+  struct standin_buf buf = {.data = p->data, .cap = total};
+  standin_put(&buf, head, len);
+  if (status == 200) {
+    standin_put_le64(&buf, payload->len);
+    standin_put(&buf, payload->data, payload->len);
+  }
+  p->len = total;
+  p->next = NULL;
+  p->due = standin_now() + latency_ns + (jitter_ns ? standin_rand(&w->seed) % jitter_ns : 0);
+  // a pipelined response never overtakes the one before it
+  if (c->last != NULL && p->due < c->last->due) {
+    p->due = c->last->due;
+  }
+  if (c->last != NULL) {
+    c->last->next = p;
+  } else {
+    c->first = p;
+  }
+  c->last = p;
+  if (!c->delayed) {
+    c->delayed = true;
+    c->next_delayed = w->delayed;
+    w->delayed = c;
+  }
+}
+
+// the value of header name in line, which runs to end, NULL if the line is another header
+static const char* standin_header(const char* line, const char* end, const char* name) {
+  size_t len = strlen(name);
+  if ((size_t)(end - line) <= len || strncasecmp(line, name, len) != 0 || line[len] != ':') {
+    return NULL;
+  }
+  line += len + 1;
+  while (line < end && (*line == ' ' || *line == '\t')) {
+    line++;
+  }
+  return line;
+}
+
+// Reads the headers that matter here from the head, which ends in the blank line.
+// Returns false for a head that can not be served.
+static bool standin_parse_head(const char* head, const char* end, size_t* body_len, bool* close) {
+  *body_len = 0;
+  *close = false;
+  const char* line = memchr(head, '\n', end - head);
+  while (line != NULL && ++line < end) {
+    const char* eol = memchr(line, '\r', end - line);
+    const char* value;
+    if (eol == NULL) {
+      return false;
+    }
+    if ((value = standin_header(line, eol, "Content-Length")) != NULL) {
+      char* num_end;
+      *body_len = strtoull(value, &num_end, 10);
+      if (num_end != eol || *body_len > STANDIN_MAX_BODY) {
+        return false;
+      }
+    } else if ((value = standin_header(line, eol, "Connection")) != NULL) {
+      *close = eol - value == 5 && strncasecmp(value, "close", 5) == 0;
+    } else if (standin_header(line, eol, "Transfer-Encoding") != NULL) {
+      // the client always sends a Content-Length
+      return false;
+    }
+    line = memchr(line, '\n', end - line);
+  }
+  return true;
+}
+
+// Runs every complete request in in, pipelined ones one after the other.
+// A stream that can not be parsed any more gets a 400 and is closed.
+static void standin_serve(struct standin_worker* w, struct standin_conn* c) {
+  size_t pos = 0;
+  bool ok = true;
+  while (!c->closing) {
+    char* start = c->in.data + pos;
+    size_t avail = c->in.len - pos;
+    char* end = memmem(start, avail, "\r\n\r\n", 4);
+    if (end == NULL) {
+      ok = avail <= STANDIN_MAX_HEAD;
+      break;
+    }
+    size_t head_len = end - start + 4;
+    size_t body_len;
+    bool close;
+    if (!(ok = standin_parse_head(start, end + 2, &body_len, &close))) {
+      break;
+    }
+    if (avail < head_len + body_len) {
+      break;
+    }
+
+    // the request line is cut up in place, it is consumed with this
+    *end = '\0';
+    char* target = strchr(start, ' ');
+    char* version = target == NULL ? NULL : strchr(target + 1, ' ');
+    if (version == NULL || strncmp(version + 1, "HTTP/1.", 7) != 0) {
+      ok = false;
+      break;
+    }
+    *target++ = '\0';
+    *version = '\0';
+    char* query = strchr(target, '?');
+    if (query != NULL) {
+      *query++ = '\0';
+    }
+    struct standin_args args;
+    int status = 400;
+    w->payload.len = 0;
+    if (*target == '/' && standin_parse_query(query, &args)) {
+      status = standin_handle(target + 1, &args, start + head_len, body_len, &w->payload);
+    }
+    standin_respond(w, c, status, &w->payload);
+    pos += head_len + body_len;
+    c->closing |= close;
+  }
+  if (!ok) {
+    w->payload.len = 0;
+    standin_respond(w, c, 400, &w->payload);
+    c->closing = true;
+  }
+  memmove(c->in.data, c->in.data + pos, c->in.len - pos);
+  c->in.len -= pos;
+  c->closing |= c->eof;
+}
+
+static void standin_accept(struct standin_worker* w) {
+  while (true) {
+    int fd = accept4(w->listener, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd < 0) {
+      if (errno != EAGAIN && errno != EINTR) {
+        perror("accept");
+      }
+      if (errno != EINTR) {
+        return;
+      }
+      continue;
+    }
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    struct standin_conn* c = calloc(1, sizeof(*c));
+    struct epoll_event ev = {.events = EPOLLIN, .data.ptr = c};
+    if (c == NULL || epoll_ctl(w->epoll, EPOLL_CTL_ADD, fd, &ev) < 0) {
+      free(c);
+      close(fd);
+      continue;
+    }
+    c->fd = fd;
+  }
+}
+
+// reads everything there is and answers it. Returns false if c was closed.
+static bool standin_receive(struct standin_worker* w, struct standin_conn* c) {
+  while (true) {
+    if (!standin_reserve(&c->in, STANDIN_READ_SZ)) {
+      standin_close(w, c);
+      return false;
+    }
+    ssize_t n = recv(c->fd, c->in.data + c->in.len, c->in.cap - c->in.len, 0);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n < 0 && errno == EAGAIN) {
+      break;
+    }
+    if (n < 0) {
+      standin_close(w, c);
+      return false;
+    }
+    if (n == 0) {
+      // the client closed its side after the last request, it still gets the answers
+      c->eof = true;
+      standin_watch(w, c, c->writing);
+      break;
+    }
+    c->in.len += n;
+    if ((size_t)n < STANDIN_READ_SZ) {
+      break;
+    }
+  }
+  standin_serve(w, c);
+  return true;
+}
+
+static void* standin_work(void* arg) {
+  struct standin_worker* w = arg;
+  struct epoll_event events[STANDIN_EVENTS];
+  while (true) {
+    int n = epoll_wait(w->epoll, events, STANDIN_EVENTS, -1);
+    if (n < 0 && errno != EINTR) {
+      perror("epoll_wait");
+      exit(1);
+    }
+    for (int i = 0; i < n; i++) {
+      void* ptr = events[i].data.ptr;
+      if (ptr == &listener_tag) {
+        standin_accept(w);
+        continue;
+      }
+      if (ptr == &timer_tag) {
+        uint64_t expired;
+        if (read(w->timer, &expired, sizeof(expired)) < 0 && errno != EAGAIN) {
+          perror("timerfd");
+        }
+        continue;
+      }
+      struct standin_conn* c = ptr;
+      if (events[i].events & (EPOLLERR | EPOLLHUP)) {
+        standin_close(w, c);
+        continue;
+      }
+      if ((events[i].events & EPOLLIN) && !standin_receive(w, c)) {
+        continue;
+      }
+      if (!c->delayed) {
+        standin_flush(w, c);
+      }
+    }
+
+    if (w->delayed == NULL) {
+      continue;
+    }
+    uint64_t now = standin_now();
+    struct standin_conn* next;
+    for (struct standin_conn* c = w->delayed; c != NULL; c = next) {
+      next = c->next_delayed;
+      standin_release(c, now);
+      if (c->first == NULL) {
+        // off the list first, standin_flush may free c
+        struct standin_conn** link = &w->delayed;
+        while (*link != c) {
+          link = &(*link)->next_delayed;
+        }
+        *link = c->next_delayed;
+        c->delayed = false;
+      }
+      standin_flush(w, c);
+    }
+    standin_arm(w);
+  }
+  return NULL;
+}
+
+static int standin_listen(void) {
+  int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    return -1;
+  }
+  int one = 1;
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  // every worker binds the port, the kernel spreads the connections over them
+  setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one));
+  struct sockaddr_in addr = {
+      .sin_family = AF_INET,
+      .sin_port = htons(port),
+      .sin_addr.s_addr = htonl(INADDR_ANY),
+  };
+  if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(fd, SOMAXCONN) < 0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+static int standin_worker_init(struct standin_worker* w, int index) {
+  w->seed = 0x9e3779b97f4a7c15 ^ (uint64_t)(index + 1);
+  w->listener = standin_listen();
+  w->epoll = epoll_create1(EPOLL_CLOEXEC);
+  w->timer = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  if (w->listener < 0 || w->epoll < 0 || w->timer < 0) {
+    return -1;
+  }
+  struct epoll_event ev = {.events = EPOLLIN, .data.ptr = &listener_tag};
+  if (epoll_ctl(w->epoll, EPOLL_CTL_ADD, w->listener, &ev) < 0) {
+    return -1;
+  }
+  ev.data.ptr = &timer_tag;
+  return epoll_ctl(w->epoll, EPOLL_CTL_ADD, w->timer, &ev);
+}
+
+static void usage(const char* prog) {
+  fprintf(
+      stderr,
+      "Usage: %s [-p port] [-t threads] [-l latency us] [-j jitter us]\n"
+      "Serves the fserver protocol from memory until SIGINT or SIGTERM, then prints the\n"
+      "requests served per method. Every response waits latency plus up to jitter first.\n",
+      prog
+  );
+  exit(2);
+}
+
+int main(int argc, char** argv) {
+  int opt;
+  while ((opt = getopt(argc, argv, "p:t:l:j:h")) != -1) {
+    switch (opt) {
+      case 'p':
+        port = atoi(optarg);
+        break;
+      case 't':
+        nworkers = atoi(optarg);
+        break;
+      case 'l':
+        latency_ns = strtoull(optarg, NULL, 10) * 1000;
+        break;
+      case 'j':
+        jitter_ns = strtoull(optarg, NULL, 10) * 1000;
+        break;
+      default:
+        usage(argv[0]);
+    }
+  }
+  if (optind != argc || port <= 0 || port > 65535 || nworkers <= 0) {
+    usage(argv[0]);
+  }
+
+  // only this thread takes the signals, the workers never see them
+  sigset_t stop;
+  sigemptyset(&stop);
+  sigaddset(&stop, SIGINT);
+  sigaddset(&stop, SIGTERM);
+  pthread_sigmask(SIG_BLOCK, &stop, NULL);
+
+  struct standin_worker* workers = calloc(nworkers, sizeof(*workers));
+  if (workers == NULL) {
+    perror("calloc");
+    return 1;
+  }
+  for (int i = 0; i < nworkers; i++) {
+    if (standin_worker_init(&workers[i], i) < 0) {
+      perror("listen");
+      return 1;
+    }
+  }
+  for (int i = 0; i < nworkers; i++) {
+    int error = pthread_create(&workers[i].thread, NULL, standin_work, &workers[i]);
+    if (error != 0) {
+      fprintf(stderr, "pthread_create: %s\n", strerror(error));
+      return 1;
+    }
+  }
+  fprintf(
+      stderr, "listening on %d with %d threads, latency %llu us, jitter %llu us\n", port, nworkers,
+      (unsigned long long)latency_ns / 1000, (unsigned long long)jitter_ns / 1000
+  );
+
+  int sig;
+  sigwait(&stop, &sig);
+  standin_print_stats(stdout);
+  return 0;
+}